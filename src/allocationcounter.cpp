@@ -0,0 +1,42 @@
+#include "allocationcounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+
+std::atomic<std::size_t> allocations {0};
+
+}
+
+std::size_t allocation_count()
+{
+    return allocations.load();
+}
+
+void * operator new(std::size_t size)
+{
+    ++allocations;
+    if (auto memory = std::malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void * memory) noexcept
+{
+    std::free(memory);
+}
+
+void * operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete[](void * memory) noexcept
+{
+    operator delete(memory);
+}
@@ -0,0 +1,16 @@
+/*
+ * allocationcounter.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef ALLOCATION_COUNTER_H_
+#define ALLOCATION_COUNTER_H_
+
+#include <cstddef>
+
+/*! \brief Number of calls to operator new and new[] so far, in a program linked with allocationcounter.cpp.
+ *
+ * The replaced operators live in their own translation unit, so that they are never inlined into the code they count.
+ */
+std::size_t allocation_count();
+
+#endif /* end of include guard: ALLOCATION_COUNTER_H_ */
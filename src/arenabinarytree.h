@@ -0,0 +1,203 @@
+/*
+ * arenabinarytree.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef ARENA_BINARY_TREE_H_
+#define ARENA_BINARY_TREE_H_
+
+#include <iterator>
+#include <limits>
+#include <vector>
+
+/*! \brief Binary tree holding values T, with all nodes in one vector.
+ *
+ * Nodes are referred to by their index in the vector and know their parent,
+ * so that stepping through the tree needs neither recursion nor a stack,
+ * and destroying it is freeing a single array.
+ * Nodes are added bottom-up, branches before the node that joins them.
+ */
+template <typename T>
+class ArenaBinaryTree
+{
+    public:
+        typedef std::size_t NodeIndex;
+
+        /*!\brief Marks a missing branch or parent. */
+        static const NodeIndex none = std::numeric_limits<NodeIndex>::max();
+
+        /*!\brief A node of the tree. */
+        struct Node
+        {
+            NodeIndex left;   //< left branch, none for a leaf
+            NodeIndex right;  //< right branch, none for a leaf
+            NodeIndex parent; //< node this node is a branch of, none for a root
+            T         value;  //< the value to be stored
+        };
+
+        /*!\brief Pre-order iterator over the nodes of a (sub)tree, yielding node indices. */
+        class Iterator : public std::iterator<std::forward_iterator_tag, NodeIndex>
+        {
+            public:
+                /*!\brief Start at the root of a (sub)tree, none for the end. */
+                Iterator(const ArenaBinaryTree * tree, NodeIndex root) :
+                    tree_ {tree}, root_ {root}, current_ {root}
+                {};
+
+                /*!\brief Step to the next node: down left if possible, else down right,
+                 * else up to the closest ancestor with an unvisited right branch. */
+                Iterator &operator++()
+                {
+                    const auto &nodes = tree_->nodes_;
+                    if (nodes[current_].left != none)
+                    {
+                        current_ = nodes[current_].left;
+                        return *this;
+                    }
+                    if (nodes[current_].right != none)
+                    {
+                        current_ = nodes[current_].right;
+                        return *this;
+                    }
+                    while (current_ != root_)
+                    {
+                        const auto parent = nodes[current_].parent;
+                        if (nodes[parent].right != none && nodes[parent].right != current_)
+                        {
+                            current_ = nodes[parent].right;
+                            return *this;
+                        }
+                        current_ = parent;
+                    }
+                    current_ = none;
+                    return *this;
+                };
+
+                NodeIndex operator*() const { return current_; };
+                bool operator==(const Iterator &rhs) const { return current_ == rhs.current_; };
+                bool operator!=(const Iterator &rhs) const { return !(*this == rhs); };
+
+            private:
+                const ArenaBinaryTree * tree_;    //< the tree to step through
+                NodeIndex               root_;    //< stepping ends when returning here
+                NodeIndex               current_; //< current iterator position
+        };
+
+        /*!\brief An empty tree, optionally with room for a number of nodes. */
+        explicit ArenaBinaryTree(std::size_t capacity = 0)
+        {
+            nodes_.reserve(capacity);
+        };
+
+        /*!\brief Add a node without branches. */
+        NodeIndex add_leaf(T value)
+        {
+            nodes_.push_back({none, none, none, std::move(value)});
+            return nodes_.size()-1;
+        };
+
+        /*!\brief Add a node joining two roots.
+         * \param[in] left Root to become the left branch.
+         * \param[in] right Root to become the right branch.
+         * \param[in] value The value for the new node.
+         */
+        NodeIndex add(NodeIndex left, NodeIndex right, T value)
+        {
+            nodes_.push_back({left, right, none, std::move(value)});
+            nodes_[left].parent  = nodes_.size()-1;
+            nodes_[right].parent = nodes_.size()-1;
+            return nodes_.size()-1;
+        };
+
+        /*!\brief The number of nodes, including those in cut branches. */
+        std::size_t size() const { return nodes_.size(); };
+
+        /*!\brief The node added last, the root of a tree built bottom-up. */
+        NodeIndex root() const { return nodes_.empty() ? none : nodes_.size()-1; };
+
+        /*!\brief Access a node. */
+        const Node &node(NodeIndex index) const { return nodes_[index]; };
+
+        /*!\brief Access the value of a node. */
+        T &operator[](NodeIndex index) { return nodes_[index].value; };
+
+        /*!\brief Access the value of a node. */
+        const T &operator[](NodeIndex index) const { return nodes_[index].value; };
+
+        /*!\brief True if the node has no branches. */
+        bool is_leaf(NodeIndex index) const { return nodes_[index].left == none && nodes_[index].right == none; };
+
+        /*!\brief Iterator to the root of the tree. */
+        Iterator begin() const { return Iterator(this, root()); };
+
+        /*!\brief Iterator past the last node. */
+        Iterator end() const { return Iterator(this, none); };
+
+        /*!\brief Iterator to the top of the subtree below a node. */
+        Iterator begin(NodeIndex subtree) const { return Iterator(this, subtree); };
+
+        /*!\brief Beginning from the top, detaches complete branches for which cut_criterium(value) is true.
+         * If a branch is detached, it is not further checked.
+         * Nodes further down a cut branch may not fulfill cut_criterium.
+         * Cut branches stay in the arena as roots of their own.
+         *
+         * \returns The roots of the cut branches.
+         */
+        template <typename UnaryPredicate>
+        std::vector<NodeIndex> cut(UnaryPredicate cut_criterium, NodeIndex subtree = none)
+        {
+            std::vector<NodeIndex> result;
+            for (auto it = begin(subtree == none ? root() : subtree); it != end(); ++it)
+            {
+                auto &branch = nodes_[*it];
+                for (auto child : {&branch.left, &branch.right})
+                {
+                    if (*child != none && cut_criterium(nodes_[*child].value))
+                    {
+                        result.push_back(*child);
+                        nodes_[*child].parent = none;
+                        *child                = none;
+                    }
+                }
+            }
+            return result;
+        };
+
+        /*!\brief The node with the largest value, where compare(a, b) is true if a is larger than b.
+         * Among equal values, the first node in pre-order.
+         */
+        template <typename ComparisonFunction>
+        NodeIndex max_element(ComparisonFunction compare, NodeIndex subtree = none) const
+        {
+            auto result = subtree == none ? root() : subtree;
+            for (auto it = begin(result); it != end(); ++it)
+            {
+                if (compare(nodes_[*it].value, nodes_[result].value))
+                {
+                    result = *it;
+                }
+            }
+            return result;
+        };
+
+        /*!\brief The bottom of the tree, i.e. all nodes without branches. */
+        std::vector<NodeIndex> bottom(NodeIndex subtree = none) const
+        {
+            std::vector<NodeIndex> result;
+            for (auto it = begin(subtree == none ? root() : subtree); it != end(); ++it)
+            {
+                if (is_leaf(*it))
+                {
+                    result.push_back(*it);
+                }
+            }
+            return result;
+        };
+
+    private:
+        std::vector<Node> nodes_; //< all nodes, branches before the nodes that join them
+};
+
+template <typename T>
+const typename ArenaBinaryTree<T>::NodeIndex ArenaBinaryTree<T>::none;
+
+#endif /* end of include guard: ARENA_BINARY_TREE_H_ */
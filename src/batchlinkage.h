@@ -0,0 +1,204 @@
+/*
+ * batchlinkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef BATCH_LINKAGE_H_
+#define BATCH_LINKAGE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "condenseddistancematrix.h"
+#include "linkage.h"
+#include "linkagepolicies.h"
+#include "nnchain.h"
+#include "threadpool.h"
+
+/*! \brief Working memory for clustering one problem after the other on the same thread.
+ *
+ * Every buffer only grows, so after the largest problem has been seen, clustering allocates nothing.
+ */
+template <typename DistanceType>
+struct LinkageWorkspace
+{
+    std::vector<DistanceType>    distances {}; //< copy of the matrix being clustered, which the engine overwrites
+    LinkageBuilder<DistanceType> builder {0};  //< merges in the order they are found
+    NnChainWorkspace             chain {};     //< working memory of the engine
+    std::vector<DistanceType>    heights {};   //< height of each merge
+    std::vector<std::size_t>     order {};     //< merges by increasing height
+    std::vector<std::size_t>     new_id {};    //< cluster id of each merge after sorting
+
+    /*!\brief Grow all buffers for problems of up to n leaves at once. */
+    void reserve(std::size_t n)
+    {
+        if (n < 2)
+        {
+            return;
+        }
+        distances.reserve(n*(n-1)/2);
+        builder.reset(n);
+        chain.active.reserve(n);
+        chain.chain.reserve(n);
+        heights.reserve(n-1);
+        order.reserve(n-1);
+        new_id.reserve(n-1);
+    };
+};
+
+/*! \brief The linkages of many clustering problems in one array of merges.
+ *
+ * Can be passed to batch_linkage again, which then reuses its memory.
+ */
+template <typename DistanceType>
+class BatchLinkage
+{
+    public:
+        /*!\brief The number of problems. */
+        std::size_t size() const { return leaves_.size(); };
+
+        /*!\brief The number of leaves of a problem. */
+        std::size_t leaves(std::size_t problem) const { return leaves_[problem]; };
+
+        /*!\brief The merges of a problem, sorted as by Linkage::sort. */
+        const LinkageStep<DistanceType> * begin(std::size_t problem) const { return steps_.data() + offsets_[problem]; };
+        const LinkageStep<DistanceType> * end(std::size_t problem) const { return steps_.data() + offsets_[problem+1]; };
+
+        /*!\brief Copy the merges of a problem into a Linkage, e.g. for cut_at_distance. */
+        Linkage<DistanceType> linkage(std::size_t problem) const
+        {
+            Linkage<DistanceType> result {leaves_[problem]};
+            for (auto step = begin(problem); step != end(problem); ++step)
+            {
+                result.push_back(*step);
+            }
+            return result;
+        };
+
+        /*!\brief Make room for a complete linkage of each problem. */
+        template <typename Problems>
+        void resize(const Problems &problems)
+        {
+            leaves_.resize(problems.size());
+            offsets_.resize(problems.size() + 1);
+            offsets_[0] = 0;
+            for (std::size_t i = 0; i < problems.size(); ++i)
+            {
+                leaves_[i]    = problems[i].size();
+                offsets_[i+1] = offsets_[i] + (leaves_[i] > 0 ? leaves_[i]-1 : 0);
+            }
+            steps_.resize(offsets_.back());
+        };
+
+        /*!\brief Where the merges of a problem go. */
+        LinkageStep<DistanceType> * rows(std::size_t problem) { return steps_.data() + offsets_[problem]; };
+
+    private:
+        std::vector<std::size_t>                   leaves_;  //< number of leaves per problem
+        std::vector<std::size_t>                   offsets_; //< first merge of each problem in steps_, and the end
+        std::vector < LinkageStep < DistanceType>> steps_;   //< the merges of all problems after each other
+};
+
+/*! \brief Cluster one problem with the nearest-neighbour chain in a workspace, without allocating once it is large enough.
+ * \param[in] source Mutual distances of the leaves, left untouched.
+ * \param[in] workspace Working memory of the calling thread.
+ * \param[out] rows Receives the n-1 merges, sorted as by Linkage::sort.
+ */
+template <typename Policy, typename DistanceType>
+void workspace_linkage(const CondensedDistanceMatrix<DistanceType> &source, LinkageWorkspace<DistanceType> &workspace, LinkageStep<DistanceType> * rows)
+{
+    static_assert(Policy::reducible, "The nearest-neighbour chain needs a reducible linkage, use generic_linkage for centroid and median.");
+    const auto n = source.size();
+    if (n < 2)
+    {
+        return;
+    }
+    workspace.distances.assign(source.row(0), source.row(0) + n*(n-1)/2);
+    CondensedDistanceMatrix<DistanceType> distances {n, workspace.distances.data(), [](DistanceType*){}};
+    workspace.builder.reset(n);
+    nn_chain_merges(distances, Policy(), workspace.builder, workspace.chain);
+
+    /* Linkage::sort, with the buffers of the workspace; ties keep their order through the index comparison */
+    const auto &merges  = workspace.builder.linkage();
+    auto       &heights = workspace.heights;
+    auto       &order   = workspace.order;
+    auto       &new_id  = workspace.new_id;
+    heights.resize(merges.size());
+    order.resize(merges.size());
+    new_id.resize(merges.size());
+    for (std::size_t k = 0; k < merges.size(); ++k)
+    {
+        heights[k] = merges[k].distance;
+        for (auto branch : {merges[k].left, merges[k].right})
+        {
+            if (branch >= n && heights[k] < heights[branch-n])
+            {
+                heights[k] = heights[branch-n];
+            }
+        }
+        order[k] = k;
+    }
+    std::sort(std::begin(order), std::end(order), [&heights](std::size_t a, std::size_t b){
+                  return heights[a] < heights[b] || (!(heights[b] < heights[a]) && a < b);
+              });
+    for (std::size_t k = 0; k < order.size(); ++k)
+    {
+        new_id[order[k]] = n + k;
+    }
+    auto renumber = [n, &new_id](std::size_t id){ return id < n ? id : new_id[id-n]; };
+    for (std::size_t k = 0; k < order.size(); ++k)
+    {
+        const auto &step = merges[order[k]];
+        rows[k] = {renumber(step.left), renumber(step.right), step.distance, step.size};
+    }
+}
+
+/*! \brief Cluster many independent distance matrices at once, one matrix per thread at a time.
+ *
+ * Meant for many small problems, where allocating per clustering would dominate: each thread grows its
+ * workspace for the largest problem once and keeps it from problem to problem, and the results share one array.
+ * Threads take the next problem from a shared counter as soon as they are done with the last,
+ * largest problems first, so that uneven sizes balance out. The result of each problem is that of hierarchical_linkage with the nn_chain engine.
+ *
+ * \tparam Policy A reducible linkage policy from linkagepolicies.h.
+ * \param[in] matrices The problems, left untouched.
+ * \param[in] pool Threads that cluster the problems.
+ * \param[in] workspaces One per thread, kept between calls to reuse their memory.
+ * \param[out] result The linkage of each problem, its memory reused as well.
+ */
+template <typename Policy, typename DistanceType>
+void batch_linkage(const std::vector < CondensedDistanceMatrix < DistanceType>> &matrices, ThreadPool &pool,
+                   std::vector < LinkageWorkspace < DistanceType>> &workspaces, BatchLinkage<DistanceType> &result)
+{
+    workspaces.resize(std::max(workspaces.size(), pool.size()));
+    result.resize(matrices);
+
+    std::vector<std::size_t> order(matrices.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(std::begin(order), std::end(order), [&matrices](std::size_t a, std::size_t b){ return matrices[a].size() > matrices[b].size(); });
+
+    const auto               largest = order.empty() ? 0 : matrices[order.front()].size();
+    std::atomic<std::size_t> next {0};
+    pool.run([&](std::size_t thread){
+                 workspaces[thread].reserve(largest);
+                 for (auto i = next++; i < order.size(); i = next++)
+                 {
+                     workspace_linkage<Policy>(matrices[order[i]], workspaces[thread], result.rows(order[i]));
+                 }
+             });
+}
+
+/*! \brief Cluster many independent distance matrices at once, see batch_linkage above. */
+template <typename Policy, typename DistanceType>
+BatchLinkage<DistanceType> batch_linkage(const std::vector < CondensedDistanceMatrix < DistanceType>> &matrices, ThreadPool &pool)
+{
+    std::vector < LinkageWorkspace < DistanceType>> workspaces {};
+    BatchLinkage<DistanceType>                      result {};
+    batch_linkage<Policy>(matrices, pool, workspaces, result);
+    return result;
+}
+
+#endif /* end of include guard: BATCH_LINKAGE_H_ */
@@ -5,6 +5,7 @@
 #include <functional>
 #include <iterator>
 #include <list>
+#include <vector>
 
 /*!\brief Forward declaration of BinaryTreeIterator */
 template <typename T>
@@ -41,6 +42,36 @@ class BinaryTree
         BinaryTree(BinaryTree &&other) :
             left_ {std::move(other.left_)}, right_ {std::move(other.right_)}, value_ {std::move(other.value_)}
         {};
+        /*!\brief Destroy the branches one node at a time.
+         *
+         * Letting the unique_ptrs destroy the branches recursively overflows the stack
+         * for deep trees, e.g. single linkage dendrograms of chained data.
+         */
+        ~BinaryTree()
+        {
+            std::vector < std::unique_ptr < BinaryTree < T>>> pending;
+            if (left_ != nullptr)
+            {
+                pending.push_back(std::move(left_));
+            }
+            if (right_ != nullptr)
+            {
+                pending.push_back(std::move(right_));
+            }
+            while (!pending.empty())
+            {
+                auto branch = std::move(pending.back());
+                pending.pop_back();
+                if (branch->left_ != nullptr)
+                {
+                    pending.push_back(std::move(branch->left_));
+                }
+                if (branch->right_ != nullptr)
+                {
+                    pending.push_back(std::move(branch->right_));
+                }
+            }
+        };
 
         /*!\brief Access operator
          * \returns a reference to the value this node holds.
@@ -72,21 +103,18 @@ class BinaryTree
         };
 
 
-        /*!\brief Beginning from the top, removes complete branches for which cut_criterium(value) is true.
-         * If a branch is removed, it is not further checked.
-         * Nodes further down a cut branch may not fulfill cut_criterium.
-         *
-         * \returns list of unique_ptrs to the cut branches.
+        /*!\brief The node with the largest value, where compare(a, b) is true if a is larger than b.
+         * \returns observing pointer to the first such node in iteration order.
          */
         template <typename ComparisonFunction>
-        BinaryTreeIterator<T> max_element(ComparisonFunction compare)
+        BinaryTree<T> * max_element(ComparisonFunction compare)
         {
-            BinaryTreeIterator<T> result{this};
+            BinaryTree<T> * result = this;
             for(auto & branch : *this)
             {
-                if (compare(branch.value_,*result) == true )
+                if (compare(branch.value_, result->value_) == true )
                 {
-                    result(*branch);
+                    result = &branch;
                 }
             }
             return result;
@@ -0,0 +1,380 @@
+/*
+ * centroidlinkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef CENTROID_LINKAGE_H_
+#define CENTROID_LINKAGE_H_
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "distancematrixbuilder.h"
+#include "indexedminheap.h"
+#include "lancewilliamskernels.h"
+#include "linkage.h"
+#include "mergestop.h"
+#include "threadpool.h"
+
+/*! \brief Centroids and sizes of clusters by slot, for linkages that only depend on cluster geometry.
+ *
+ * Distances are those the Lance-Williams updates yield from squared Euclidean distances of the points,
+ * as distance_matrix with Metric::squared_euclidean gives them:
+ *  - centroid: squared distance between the cluster means,
+ *  - median: squared distance between the cluster "medians", the midpoints of the merged medians,
+ *  - ward_minimum_distance: 2 n_i n_j / (n_i + n_j) times the squared distance between the cluster means.
+ *
+ * A point with a leaf size of w counts as w elements at that point, also for the distances between leaves:
+ * with Ward, two leaves are 2 w_i w_j / (w_i + w_j) |x_i - x_j|^2 apart, not |x_i - x_j|^2.
+ */
+template <typename DistanceType>
+class ClusterCentroids
+{
+    public:
+        static const std::size_t none = std::numeric_limits<std::size_t>::max();
+
+        /*!\brief One cluster per point.
+         * \param[in] points The points, copied.
+         * \param[in] method One of centroid, median and ward_minimum_distance.
+         * \param[in] sizes Number of elements in each point.
+         * \param[in] threads Number of threads that will call nearest.
+         * \throws std::invalid_argument for linkages that are not defined by centroids.
+         */
+        ClusterCentroids(const Coordinates<DistanceType> &points, LinkageMethod method, const std::vector<std::size_t> &sizes, std::size_t threads) :
+            method_ {method}, d_ {points.dimension()}, sizes_(std::begin(sizes), std::end(sizes)), candidates_(threads)
+        {
+            if (method != LinkageMethod::centroid && method != LinkageMethod::median && method != LinkageMethod::ward_minimum_distance)
+            {
+                throw std::invalid_argument("Only centroid, median and Ward linkage can be computed from coordinates.");
+            }
+            centroids_.reserve(points.size()*d_);
+            for (std::size_t i = 0; i < points.size(); ++i)
+            {
+                centroids_.insert(std::end(centroids_), points.point(i), points.point(i) + d_);
+            }
+        };
+
+        /*!\brief The distance between the clusters in slots i and j. */
+        DistanceType distance(std::size_t i, std::size_t j) const
+        {
+            const auto d2 = squared_distance(&centroids_[i*d_], &centroids_[j*d_], d_);
+            if (method_ == LinkageMethod::ward_minimum_distance)
+            {
+                return 2*sizes_[i]*sizes_[j]/(sizes_[i]+sizes_[j]) * d2;
+            }
+            return d2;
+        };
+
+        /*!\brief The centroid (or median) of the cluster in slot i. */
+        const DistanceType * centroid(std::size_t i) const { return &centroids_[i*d_]; };
+
+        /*!\brief Centroids of all slots, one after the other. */
+        const DistanceType * centroids() const { return centroids_.data(); };
+
+        /*!\brief The number of elements in the cluster in slot i. */
+        DistanceType size(std::size_t i) const { return sizes_[i]; };
+
+        /*!\brief Merge the clusters in slots left and right into slot into. */
+        void merge(std::size_t left, std::size_t right, std::size_t into)
+        {
+            const auto weight_left  = method_ == LinkageMethod::median ? DistanceType(0.5) : sizes_[left]/(sizes_[left]+sizes_[right]);
+            const auto weight_right = 1 - weight_left;
+            for (std::size_t k = 0; k < d_; ++k)
+            {
+                centroids_[into*d_ + k] = weight_left*centroids_[left*d_ + k] + weight_right*centroids_[right*d_ + k];
+            }
+            sizes_[into] = sizes_[left] + sizes_[right];
+        };
+
+        /*!\brief The closest cluster to slot i among the candidate slots, preferring the lowest slot among equal distances.
+         * \param[in] i The slot whose neighbour is searched.
+         * \param[in] first Candidate slots in ascending order; slot i is skipped.
+         * \param[in] last End of the candidates.
+         * \returns The neighbour and its distance, none if there is no candidate.
+         */
+        std::pair<std::size_t, DistanceType> nearest(std::size_t i, const std::size_t * first, const std::size_t * last) const
+        {
+            std::pair<std::size_t, DistanceType> result {none, std::numeric_limits<DistanceType>::infinity()};
+            for (auto candidate = first; candidate != last; ++candidate)
+            {
+                if (*candidate != i)
+                {
+                    const auto d = distance(i, *candidate);
+                    if (result.first == none || d < result.second)
+                    {
+                        result = {*candidate, d};
+                    }
+                }
+            }
+            return result;
+        };
+
+        /*!\brief As nearest, with long candidate lists split across the threads of the pool. */
+        std::pair<std::size_t, DistanceType> nearest(std::size_t i, const std::size_t * first, const std::size_t * last, ThreadPool &pool)
+        {
+            const std::size_t count = last - first;
+            if (pool.size() == 1 || count*d_ < 32768)
+            {
+                return nearest(i, first, last);
+            }
+            pool.run([&](std::size_t thread){
+                         const auto range = pool.chunk(0, count, thread);
+                         candidates_[thread] = nearest(i, first + range.first, first + range.second);
+                     });
+            /* Chunks are in ascending order, so keeping the first minimum keeps the lowest slot */
+            auto result = candidates_.front();
+            for (const auto &candidate : candidates_)
+            {
+                if (candidate.first != none && (result.first == none || candidate.second < result.second))
+                {
+                    result = candidate;
+                }
+            }
+            return result;
+        };
+
+    private:
+        LinkageMethod             method_;    //< how clusters are merged
+        std::size_t               d_;         //< coordinates per centroid
+        std::vector<DistanceType> centroids_; //< the centroid (or median) of each slot
+        std::vector<DistanceType> sizes_;     //< number of elements by slot
+        std::vector < std::pair < std::size_t, DistanceType>> candidates_; //< nearest neighbour found by each thread
+};
+
+template <typename DistanceType>
+const std::size_t ClusterCentroids<DistanceType>::none;
+
+/*! \brief Ward clustering of points with the nearest-neighbour-chain algorithm, without a distance matrix.
+ *
+ * Follows nn_chain_linkage, but computes distances from the cluster centroids when needed:
+ * O(n*d) memory, O(n^2*d) time. Without leaf sizes, same dendrogram as nn_chain_linkage with ward_minimum_distance
+ * on the squared Euclidean distances of the points, up to rounding.
+ *
+ * With leaf sizes, every point stands for that many elements at the point, see ClusterCentroids.
+ * nn_chain_linkage with the same leaf sizes then only gives the same dendrogram if the distance of leaves i and j
+ * is 2 w_i w_j / (w_i + w_j) |x_i - x_j|^2 in its matrix; it takes plain squared distances as they are.
+ *
+ * \param[in] points The points to be clustered.
+ * \param[in] pool Threads that search nearest neighbours.
+ * \param[in] leaf_sizes Number of elements in each point, one each if empty.
+ * \param[in] stop Where to stop merging, as in nn_chain_linkage.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> ward_linkage(const Coordinates<DistanceType> &points, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                   const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    const auto n = points.size();
+
+    LinkageBuilder<DistanceType>   builder {n, std::move(leaf_sizes)};
+    ClusterCentroids<DistanceType> clusters {points, LinkageMethod::ward_minimum_distance, builder.sizes(), pool.size()};
+    if (n < 2)
+    {
+        return builder.release();
+    }
+
+    /* Slots that still hold a cluster, in ascending order */
+    std::vector<std::size_t> active(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        active[i] = i;
+    }
+
+    std::vector<std::size_t> chain {};
+    chain.reserve(n);
+
+    while (active.size() > 1)
+    {
+        if (chain.empty())
+        {
+            chain.push_back(active.front());
+        }
+
+        /* Grow the chain until its last two clusters are mutual nearest neighbours; the predecessor wins ties */
+        std::size_t a, b;
+        DistanceType minimum_distance;
+        bool         isolated = false;
+        while (true)
+        {
+            a = chain.back();
+            const auto closest = clusters.nearest(a, active.data(), active.data() + active.size(), pool);
+            b                = closest.first;
+            minimum_distance = closest.second;
+            if (chain.size() > 1)
+            {
+                const auto predecessor = chain[chain.size()-2];
+                const auto d           = clusters.distance(a, predecessor);
+                if (!(minimum_distance < d))
+                {
+                    b                = predecessor;
+                    minimum_distance = d;
+                    break;
+                }
+            }
+            if (stop.too_far(minimum_distance))
+            {
+                /* Ward is reducible, no merge brings a cluster closer than both its parts were */
+                isolated = true;
+                break;
+            }
+            chain.push_back(b);
+        }
+        if (isolated)
+        {
+            chain.pop_back();
+            active.erase(std::lower_bound(std::begin(active), std::end(active), a));
+            continue;
+        }
+        chain.pop_back();
+        chain.pop_back();
+
+        const auto left  = std::min(a, b);
+        const auto right = std::max(a, b);
+        clusters.merge(left, right, left);
+        active.erase(std::lower_bound(std::begin(active), std::end(active), right));
+        builder.merge(left, right, minimum_distance);
+    }
+
+    auto linkage = builder.release();
+    linkage.sort();
+    linkage.truncate(stop);
+    return linkage;
+}
+
+/*! \brief Centroid or median clustering of points with cached nearest neighbours, without a distance matrix.
+ *
+ * Follows generic_linkage, but computes distances from the cluster centroids when needed:
+ * O(n*d) memory, typically O(n^2*d) time. Same dendrogram as generic_linkage with centroid or median on the
+ * squared Euclidean distances of the points, up to rounding.
+ *
+ * \param[in] points The points to be clustered.
+ * \param[in] method centroid or median.
+ * \param[in] pool Threads that search nearest neighbours.
+ * \param[in] leaf_sizes Number of elements in each point, one each if empty.
+ * \param[in] stop Where to stop merging, as in generic_linkage.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> centroid_generic_linkage(const Coordinates<DistanceType> &points, LinkageMethod method, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                               const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    const auto n = points.size();
+
+    LinkageBuilder<DistanceType>   builder {n, std::move(leaf_sizes)};
+    ClusterCentroids<DistanceType> clusters {points, method, builder.sizes(), pool.size()};
+    if (n < 2)
+    {
+        return builder.release();
+    }
+
+    std::vector<std::size_t>  active(n);
+    std::vector<std::size_t>  nearest(n-1);
+    std::vector<DistanceType> minimum_distances(n-1);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        active[i] = i;
+    }
+
+    /* The nearest active neighbour among the following slots */
+    auto following = [&active](std::size_t i){ return active.data() + (std::upper_bound(std::begin(active), std::end(active), i) - std::begin(active)); };
+    auto find_nearest = [&](std::size_t i){
+            const auto closest = clusters.nearest(i, following(i), active.data() + active.size(), pool);
+            nearest[i]           = closest.first;
+            minimum_distances[i] = closest.second;
+        };
+
+    pool.run([&](std::size_t thread){
+                 for (auto i = thread; i < n-1; i += pool.size())
+                 {
+                     const auto closest = clusters.nearest(i, active.data() + i+1, active.data() + n);
+                     nearest[i]           = closest.first;
+                     minimum_distances[i] = closest.second;
+                 }
+             });
+    IndexedMinHeap<DistanceType> queue {minimum_distances};
+
+    std::vector<DistanceType> to_merged(n);
+    std::vector<std::size_t>  refreshed(n-1, n);
+    for (std::size_t merge = 0; merge < n-1 && n-merge > stop.clusters; ++merge)
+    {
+        /* Refresh cached neighbours at the top of the queue until one is up to date, each at most once per merge as in generic_linkage */
+        auto left = queue.top();
+        while (refreshed[left] != merge && clusters.distance(left, nearest[left]) != minimum_distances[left])
+        {
+            find_nearest(left);
+            refreshed[left] = merge;
+            queue.update(left, minimum_distances[left]);
+            left = queue.top();
+        }
+        const auto right            = nearest[left];
+        const auto minimum_distance = minimum_distances[left];
+        if (stop.too_far(minimum_distance))
+        {
+            break;
+        }
+
+        queue.remove(left);
+        active.erase(std::lower_bound(std::begin(active), std::end(active), left));
+        clusters.merge(left, right, right);
+        builder.merge(left, right, minimum_distance, right);
+
+        /* Distances of the preceding clusters to the merged one */
+        const auto preceding = std::lower_bound(std::begin(active), std::end(active), right) - std::begin(active);
+        pool.run([&](std::size_t thread){
+                     const auto range = pool.chunk(0, preceding, thread);
+                     for (auto k = range.first; k < range.second; ++k)
+                     {
+                         to_merged[k] = clusters.distance(active[k], right);
+                     }
+                 });
+
+        /* Redirect cached neighbours of the retired cluster, keep lower bounds for increased distances
+         * and push decreased distances to the queue right away */
+        for (std::size_t position = 0; position < static_cast<std::size_t>(preceding); ++position)
+        {
+            const auto k = active[position];
+            if (nearest[k] == left)
+            {
+                nearest[k] = right;
+            }
+            if (to_merged[position] < minimum_distances[k])
+            {
+                minimum_distances[k] = to_merged[position];
+                nearest[k]           = right;
+                queue.update(k, minimum_distances[k]);
+            }
+        }
+        if (right < n-1 && queue.contains(right))
+        {
+            /* Slot n-1 is never retired, so right always has a following neighbour */
+            find_nearest(right);
+            queue.update(right, minimum_distances[right]);
+        }
+    }
+
+    return builder.release();
+}
+
+/*! \brief Hierarchical clustering of points for linkages defined by cluster centroids, in O(n*d) memory.
+ *
+ * Takes the place of a distance matrix of squared Euclidean distances when it would not fit into memory.
+ *
+ * \param[in] points The points to be clustered, in memory or mapped by map_coordinates.
+ * \param[in] method ward_minimum_distance (nearest-neighbour chain), centroid or median (cached nearest neighbours).
+ * \param[in] pool Threads that search nearest neighbours.
+ * \param[in] leaf_sizes Number of elements in each point, one each if empty.
+ * \param[in] stop Where to stop merging.
+ * \throws std::invalid_argument for other linkages, which need the distances of all elements.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> centroid_linkage(const Coordinates<DistanceType> &points, LinkageMethod method, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                       const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    if (method == LinkageMethod::ward_minimum_distance)
+    {
+        return ward_linkage(points, pool, std::move(leaf_sizes), stop);
+    }
+    return centroid_generic_linkage(points, method, pool, std::move(leaf_sizes), stop);
+}
+
+#endif /* end of include guard: CENTROID_LINKAGE_H_ */
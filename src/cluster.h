@@ -13,22 +13,32 @@
 #include <vector>
 
 #include "binarytree.h"
+#include "clusterobserver.h"
+#include "compactdistance.h"
+#include "mergestop.h"
 
-/*! \brief Construct a binary tree by hierarchically merging list items.
+/*! \brief Construct binary trees by hierarchically merging list items until a stop is reached.
  *
  * \tparam Clusterable The items to be clustered must provide the following:
  *  DistanceType, deleteDistance, merge, distances, size.
  * \tparam MergeFunction
  * \param[in] items_to_cluster List of items to cluster.
  * \param[in] merge_distance A function defining how to calculate the new distances to the merged cluster.
+ * \param[in] stop Merging ends before the first merge that is too far, or when few enough clusters are left.
+ * \param[in] observer Is told about phases, counts and progress of the merge loop, see NullClusterObserver for the interface.
+ * \returns One tree per cluster that is left, a single one if the stop is never reached.
  *
  * Clusters are represented by binary trees.
  * Store only distances to the next clusters in the list to employ symmetry in the distance matrix.
+ * Since every merge scans all distances, stopping early saves the most expensive merges per result.
  *
  */
-template <typename Clusterable, typename MergeFunction>
-std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_into_tree(std::list<Clusterable> &items_to_cluster, MergeFunction merge_distance)
+template <typename Clusterable, typename MergeFunction, typename Observer>
+std::list < std::unique_ptr < BinaryTree < Clusterable>> > hierarchical_merge_into_forest(std::list<Clusterable> &items_to_cluster, MergeFunction merge_distance,
+                                                                                      const MergeStop<typename Clusterable::DistanceType> &stop, Observer &observer)
 {
+    observer.start(items_to_cluster.size());
+    observer.begin(ClusterPhase::tree_construction);
     /* Treat each item as single cluster, i.e. binary tree for hierarchical clustering */
     std::list < std::unique_ptr < BinaryTree < Clusterable>> > list_of_trees {};
     /* Store the size of the clusters in a vector. */
@@ -38,10 +48,12 @@ std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_into_tree(std::l
         cluster_sizes.push_back(cluster.size());
         list_of_trees.emplace_back( new BinaryTree<Clusterable>{std::move(cluster)} );
     }
+    observer.end(ClusterPhase::tree_construction);
 
     /* For brevity, define a function to give the distance to the next up neighbour */
-    auto next_up_neighbour_distance = []( BinaryTree < Clusterable> &a){
-            return *std::min_element(std::begin((*a).distances()), std::end((*a).distances()), [](const typename Clusterable::DistanceType &a, const typename Clusterable::DistanceType &b){ return a < b; });
+    auto next_up_neighbour_distance = [&observer]( BinaryTree < Clusterable> &a){
+            observer.read((*a).distances().size());
+            return smallest_distance((*a).distances().data(), (*a).distances().size());
         };
 
     /* For brevity, define a function to give the next up neighbour */
@@ -51,7 +63,7 @@ std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_into_tree(std::l
     /* Merge trees until two independent trees are left (then selecting the two trees to be merged is trivial). */
     while (list_of_trees.size() > 2)
     {
-
+        observer.begin(ClusterPhase::minimum_search);
         /* The new left element in the merged tree will be the element with the lowest distance to another element */
         auto left = std::min_element(std::begin(list_of_trees), --std::end(list_of_trees),
                                      [next_up_neighbour_distance] ( std::unique_ptr < BinaryTree < Clusterable>> &a, std::unique_ptr < BinaryTree < Clusterable>> &b )
@@ -63,10 +75,17 @@ std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_into_tree(std::l
         Clusterable   &left_cluster     = ***left;
         /* The new right element in the merged tree will be the closest element to the left element just picked */
         auto           minimum_distance = next_up_neighbour_distance(**left);
+        if (stop.reached(minimum_distance, list_of_trees.size()))
+        {
+            observer.end(ClusterPhase::minimum_search);
+            break;
+        }
 
         auto           right            = left;
         std::advance(right, next_up_neighbour(**left));
         Clusterable   &right_cluster = ***right;
+        observer.end(ClusterPhase::minimum_search);
+        observer.begin(ClusterPhase::distance_collection);
 
         /* Collect distances to the "to-be-merged" clusters into a new vector
          * and discard them in their old storage place.
@@ -77,55 +96,67 @@ std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_into_tree(std::l
         auto left_index    = std::distance(list_of_trees.begin(), left );
         auto right_index   = std::distance(list_of_trees.begin(), right );
 
+        /* The distance from cluster i to a following cluster k is stored at distances()[k-i-1].
+         * Both vectors hold the distances to all other clusters, in list order. */
         std::vector<typename Clusterable::DistanceType>  distances_to_left {};
         std::vector<typename Clusterable::DistanceType>  distances_to_right {};
+        std::vector<std::size_t>                         other_sizes {};
+        distances_to_left.reserve(list_of_trees.size()-2);
+        distances_to_right.reserve(list_of_trees.size()-2);
+        other_sizes.reserve(list_of_trees.size()-2);
         auto current = list_of_trees.begin();
-        for (auto current_index = 0; current_index < left_index; ++current_index)
+        for (decltype(left_index) current_index = 0; current_index < left_index; ++current_index)
         {
-            distances_to_left.push_back((***current).distances()[left_index-current_index]);
-            distances_to_right.push_back((***current).distances()[right_index-current_index]);
-            (***current).deleteDistance(left_index-current_index);
-            (***current).deleteDistance(right_index-current_index-1); // already deleted distance at left_index, so go back one more
+            distances_to_left.push_back((***current).distances()[left_index-current_index-1]);
+            distances_to_right.push_back((***current).distances()[right_index-current_index-1]);
+            other_sizes.push_back(cluster_sizes[current_index]);
+            (***current).deleteDistance(right_index-current_index-1);
+            (***current).deleteDistance(left_index-current_index-1);
             ++current;
         }
-        /* when at the first element to be merged, store all its distances */
-        for (auto &distance : left_cluster.distances())
-        {
-            distances_to_left.push_back(distance);
-        }
-        distances_to_right.push_back((***current).distances()[right_index-left_index]);
         ++current;
         for (auto i = left_index+1; i < right_index; ++i)
         {
-            distances_to_right.push_back((***current).distances()[right_index-i]);
-            (***current).deleteDistance(right_index-i);
+            distances_to_left.push_back(left_cluster.distances()[i-left_index-1]);
+            distances_to_right.push_back((***current).distances()[right_index-i-1]);
+            other_sizes.push_back(cluster_sizes[i]);
+            (***current).deleteDistance(right_index-i-1);
             ++current;
         }
-
-        for (auto &distance : right_cluster.distances())
+        for (auto i = right_index+1; i < static_cast<decltype(right_index)>(list_of_trees.size()); ++i)
         {
-            distances_to_right.push_back(distance);
+            distances_to_left.push_back(left_cluster.distances()[i-left_index-1]);
+            distances_to_right.push_back(right_cluster.distances()[i-right_index-1]);
+            other_sizes.push_back(cluster_sizes[i]);
         }
 
         /* end collect distances */
+        observer.read(2*distances_to_left.size());
+        observer.end(ClusterPhase::distance_collection);
+        observer.begin(ClusterPhase::lance_williams_update);
 
         /* Merge the two clusters and calculate new distances */
         auto d_right   = distances_to_right.begin();
-        auto n_current = cluster_sizes.begin();
+        auto n_current = other_sizes.begin();
         std::vector<typename Clusterable::DistanceType> new_distances;
+        new_distances.reserve(distances_to_left.size());
         for (auto d_left : distances_to_left)
         {
-            new_distances.push_back(merge_distance(minimum_distance, *n_current, cluster_sizes[left_index], cluster_sizes[right_index], d_left, *d_right));
+            new_distances.emplace_back(merge_distance(minimum_distance, *n_current, cluster_sizes[left_index], cluster_sizes[right_index], d_left, *d_right));
             d_right++;
             n_current++;
         }
+        observer.written(new_distances.size());
+        observer.end(ClusterPhase::lance_williams_update);
+        observer.begin(ClusterPhase::tree_construction);
 
         /* Put the new constructed cluster in place */
         list_of_trees.emplace_front(new BinaryTree<Clusterable>(std::move(*left), std::move(*right), *left_cluster.merger(right_cluster, std::move(new_distances), minimum_distance)));
         /* Update the array that holds the cluster sizes */
-        cluster_sizes.insert(cluster_sizes.begin(), cluster_sizes[left_index]+cluster_sizes[right_index]);
-        cluster_sizes.erase(cluster_sizes.begin()+left_index);
+        auto merged_size = cluster_sizes[left_index]+cluster_sizes[right_index];
         cluster_sizes.erase(cluster_sizes.begin()+right_index);
+        cluster_sizes.erase(cluster_sizes.begin()+left_index);
+        cluster_sizes.insert(cluster_sizes.begin(), merged_size);
 
         /* Remove the merged elements from the list of clusters */
         list_of_trees.erase(left);
@@ -134,19 +165,57 @@ std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_into_tree(std::l
         /* Reset the distance containers */
         distances_to_left.resize(0);
         distances_to_right.resize(0);
+        observer.end(ClusterPhase::tree_construction);
+        observer.merged(list_of_trees.size());
     }
 
     /* Merge the two left-over clusters into one */
-    auto left_cluster  = **list_of_trees.front();
-    auto right_cluster = **list_of_trees.back();
-    std::unique_ptr<Clusterable> new_cluster {
-        left_cluster.merger(right_cluster, std::move(std::vector<typename Clusterable::DistanceType>(left_cluster.distances().front())), left_cluster.distances().front())
-    };
-    list_of_trees.emplace_front(new BinaryTree<Clusterable>(std::move(list_of_trees.front()), std::move(list_of_trees.back()), *new_cluster));
-    list_of_trees.pop_back();
-    list_of_trees.pop_back();
+    if (list_of_trees.size() == 2 && !stop.reached((**list_of_trees.front()).distances().front(), 2))
+    {
+        auto left_cluster  = **list_of_trees.front();
+        auto right_cluster = **list_of_trees.back();
+        std::unique_ptr<Clusterable> new_cluster {
+            left_cluster.merger(right_cluster, std::vector<typename Clusterable::DistanceType>(), left_cluster.distances().front())
+        };
+        list_of_trees.emplace_front(new BinaryTree<Clusterable>(std::move(list_of_trees.front()), std::move(list_of_trees.back()), *new_cluster));
+        list_of_trees.pop_back();
+        list_of_trees.pop_back();
+        observer.merged(1);
+    }
+    observer.finish();
 
-    return std::move(list_of_trees.front());
+    return list_of_trees;
+}
+
+/*! \brief Construct binary trees by hierarchically merging list items until a stop is reached, without observing the merge loop. */
+template <typename Clusterable, typename MergeFunction>
+std::list < std::unique_ptr < BinaryTree < Clusterable>> > hierarchical_merge_into_forest(std::list<Clusterable> &items_to_cluster, MergeFunction merge_distance,
+                                                                                      const MergeStop<typename Clusterable::DistanceType> &stop)
+{
+    NullClusterObserver observer {};
+    return hierarchical_merge_into_forest(items_to_cluster, merge_distance, stop, observer);
+}
+
+/*! \brief Construct a binary tree by hierarchically merging list items.
+ *
+ * \param[in] items_to_cluster List of items to cluster.
+ * \param[in] merge_distance A function defining how to calculate the new distances to the merged cluster.
+ * \param[in] observer Is told about phases, counts and progress of the merge loop, see NullClusterObserver for the interface.
+ * \returns The root of the tree, nullptr if there are no items.
+ */
+template <typename Clusterable, typename MergeFunction, typename Observer>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_into_tree(std::list<Clusterable> &items_to_cluster, MergeFunction merge_distance, Observer &observer)
+{
+    auto trees = hierarchical_merge_into_forest(items_to_cluster, merge_distance, MergeStop<typename Clusterable::DistanceType>(), observer);
+    return trees.empty() ? nullptr : std::move(trees.front());
+}
+
+/*! \brief Construct a binary tree by hierarchically merging list items, without observing the merge loop. */
+template <typename Clusterable, typename MergeFunction>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_into_tree(std::list<Clusterable> &items_to_cluster, MergeFunction merge_distance)
+{
+    NullClusterObserver observer {};
+    return hierarchical_merge_into_tree(items_to_cluster, merge_distance, observer);
 }
 
 template <typename DistanceType>
@@ -165,7 +234,8 @@ class LanceWilliamsUpdate
         static DistanceType
         single_linkage(DistanceType /*d_left_right*/, std::size_t /*size_current*/, std::size_t /*size_left*/, std::size_t /*size_right*/, DistanceType d_to_left, DistanceType d_to_right )
         {
-            return 0.5 * d_to_left + 0.5 * d_to_right - 0.5 * std::abs(d_to_left - d_to_right);
+            /* equal to 0.5 * d_to_left + 0.5 * d_to_right - 0.5 * |d_to_left - d_to_right|, without rounding */
+            return std::min(d_to_left, d_to_right);
         }
 
         /*!\brief Complete linkage merge, also known as diameter or max dist merge.
@@ -178,9 +248,10 @@ class LanceWilliamsUpdate
          *  \param[in] d_to_right Distance to "right" or second cluster to be merged.
          */
         static DistanceType
-        complete_linkage(DistanceType d_left_right, std::size_t size_current, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right)
+        complete_linkage(DistanceType /*d_left_right*/, std::size_t /*size_current*/, std::size_t /*size_left*/, std::size_t /*size_right*/, DistanceType d_to_left, DistanceType d_to_right)
         {
-            return 0.5 * d_to_left + 0.5 * d_to_right + 0.5 * std::abs(d_to_left - d_to_right);
+            /* equal to 0.5 * d_to_left + 0.5 * d_to_right + 0.5 * |d_to_left - d_to_right|, without rounding */
+            return std::max(d_to_left, d_to_right);
         }
 
         /*!\brief Simple average, also known as McQuitty's or Weighted Pair Group Method with Arithmetic Mean (WPGMA).
@@ -212,8 +283,8 @@ class LanceWilliamsUpdate
         static DistanceType
         centroid(DistanceType d_left_right, std::size_t /*size_current*/, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right)
         {
-            auto a_left  = size_left/(size_left+size_right);
-            auto a_right = size_right/(size_left+size_right);
+            DistanceType a_left  = size_left/(DistanceType)(size_left+size_right);
+            DistanceType a_right = size_right/(DistanceType)(size_left+size_right);
             return a_left * d_to_left +  a_right  * d_to_right - a_left * a_right * d_left_right;
         }
         /*!\brief Median merge, also known as Gowers or Weighted Pair Group Method with Centroid Mean (WPGMC).
@@ -0,0 +1,458 @@
+/*
+ * clusterbench.cpp
+ *      Author: cblau@gwdg.de
+ *
+ * Benchmark of all clustering engines on synthetic data.
+ *
+ * Usage: clusterbench [--sizes 1000,2000,5000,10000,20000,50000] [--workloads blobs,uniform,chained]
+ *                     [--linkages single_linkage,...] [--engines list,condensed,...]
+ *                     [--dimension 4] [--threads 0] [--seed 42] [--list-max 2000] [--cubic-max 5000] [--format csv|json]
+ *
+ * Prints one record per workload, size, linkage and engine, as CSV with a header line or as one JSON object per line.
+ * Seconds and allocations cover the clustering only, not copying the input matrix for the engines that consume it.
+ * The list engine, O(n^3), runs up to --list-max elements; the condensed and generic engines, O(n^3) in the worst case,
+ * up to --cubic-max elements. Larger sizes only run the O(n^2) engines nn_chain and mst and the matrix-free engines.
+ * Configure with -DCMAKE_BUILD_TYPE=Release for meaningful timings.
+ * At 50000 elements each condensed matrix takes 5 GB and up to three are held at once; pass smaller --sizes on smaller machines.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "allocationcounter.h"
+#include "centroidlinkage.h"
+#include "cluster.h"
+#include "condensedcluster.h"
+#include "condenseddistancematrix.h"
+#include "distancecluster.h"
+#include "distancematrixbuilder.h"
+#include "genericlinkage.h"
+#include "kdtreelinkage.h"
+#include "mstlinkage.h"
+#include "nnchain.h"
+
+namespace
+{
+
+typedef float DistanceType;
+typedef DistanceType (*MergeFunction)(DistanceType, std::size_t, std::size_t, std::size_t, DistanceType, DistanceType);
+
+/*! \brief A linkage by name, as function for the list engine and as method for the kernels. */
+struct LinkageChoice
+{
+    std::string   name;
+    LinkageMethod method;
+    MergeFunction merge;
+};
+
+const std::vector<LinkageChoice> &all_linkages()
+{
+    typedef LanceWilliamsUpdate<DistanceType> LW;
+    static const std::vector<LinkageChoice> linkages {
+        {"single_linkage", LinkageMethod::single_linkage, LW::single_linkage},
+        {"complete_linkage", LinkageMethod::complete_linkage, LW::complete_linkage},
+        {"simple_average", LinkageMethod::simple_average, LW::simple_average},
+        {"centroid", LinkageMethod::centroid, LW::centroid},
+        {"median", LinkageMethod::median, LW::median},
+        {"group_average", LinkageMethod::group_average, LW::group_average},
+        {"ward_minimum_distance", LinkageMethod::ward_minimum_distance, LW::ward_minimum_distance}
+    };
+    return linkages;
+}
+
+bool reducible(LinkageMethod method)
+{
+    return method != LinkageMethod::centroid && method != LinkageMethod::median;
+}
+
+/*! \brief Reproducible synthetic points.
+ *  - blobs: ten Gaussian clusters of width 2 in a box of width 100,
+ *  - uniform: uniform in a box of width 100,
+ *  - chained: a random walk with unit steps, which single linkage merges in one long chain.
+ */
+Coordinates<DistanceType> synthetic_points(const std::string &workload, std::size_t n, std::size_t d, unsigned seed)
+{
+    std::mt19937                               generator {seed};
+    std::uniform_real_distribution<DistanceType> uniform(0, 100);
+    std::normal_distribution<DistanceType>       normal(0, 1);
+    std::vector<DistanceType>                  values(n*d);
+    if (workload == "blobs")
+    {
+        std::vector<DistanceType> centers(10*d);
+        for (auto &x : centers)
+        {
+            x = uniform(generator);
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const auto center = generator() % 10;
+            for (std::size_t k = 0; k < d; ++k)
+            {
+                values[i*d + k] = centers[center*d + k] + 2*normal(generator);
+            }
+        }
+    }
+    else if (workload == "chained")
+    {
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            for (std::size_t k = 0; k < d; ++k)
+            {
+                values[i*d + k] = (i > 0 ? values[(i-1)*d + k] : 0) + normal(generator)/std::sqrt(DistanceType(d));
+            }
+        }
+    }
+    else
+    {
+        for (auto &x : values)
+        {
+            x = uniform(generator);
+        }
+    }
+    return Coordinates<DistanceType>(std::move(values), d);
+}
+
+CondensedDistanceMatrix<DistanceType> copy_of(const CondensedDistanceMatrix<DistanceType> &distances)
+{
+    CondensedDistanceMatrix<DistanceType> copy {distances.size()};
+    std::copy(distances.data(), distances.data() + distances.length(), copy.data());
+    return copy;
+}
+
+/* Distance buffers of CondensedDistanceMatrix, which are allocated with posix_memalign rather than new */
+std::atomic<std::size_t> matrix_allocations {0};
+
+void count_matrix_allocation(std::size_t /*bytes*/)
+{
+    ++matrix_allocations;
+}
+
+/*! \brief Wall time and allocations of one engine run, from start(), once its input is ready, to stop(). */
+class Stopwatch
+{
+    public:
+        void start()
+        {
+            allocations_ = allocation_count() + matrix_allocations.load();
+            start_       = std::chrono::steady_clock::now();
+        };
+
+        void stop()
+        {
+            seconds_     = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+            allocations_ = allocation_count() + matrix_allocations.load() - allocations_;
+        };
+
+        double seconds() const { return seconds_; };
+
+        std::size_t allocations() const { return allocations_; };
+
+    private:
+        std::chrono::steady_clock::time_point start_;           //< when the engine started
+        double                                seconds_ {0};     //< wall time of the engine
+        std::size_t                           allocations_ {0}; //< allocations of the engine, the count so far while it runs
+};
+
+/*! \brief Peak resident memory in kB since the last reset, from /proc if possible. */
+long peak_rss_kb()
+{
+    std::ifstream status {"/proc/self/status"};
+    std::string   line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return std::atol(line.c_str() + 6);
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/*! \brief Start measuring the peak from the current memory use; only on Linux, elsewhere the peak of the whole run is reported. */
+void reset_peak_rss()
+{
+    std::ofstream clear_refs {"/proc/self/clear_refs"};
+    if (clear_refs)
+    {
+        clear_refs << "5";
+    }
+}
+
+/*! \brief Measurements of one run. */
+struct Record
+{
+    std::string  workload;
+    std::size_t  n;
+    std::size_t  dimension;
+    std::string  linkage;
+    std::string  engine;
+    std::size_t  threads;
+    double       seconds;
+    double       merges_per_second;
+    long         peak_rss_kb;
+    std::size_t  allocations;
+    double       allocations_per_merge;
+    DistanceType top_height;
+};
+
+void print(const Record &r, bool json, bool header)
+{
+    if (json)
+    {
+        std::printf("{\"workload\":\"%s\",\"n\":%zu,\"dimension\":%zu,\"linkage\":\"%s\",\"engine\":\"%s\",\"threads\":%zu,"
+                    "\"seconds\":%.6f,\"merges_per_second\":%.1f,\"peak_rss_kb\":%ld,\"allocations\":%zu,\"allocations_per_merge\":%.3f,\"top_height\":%.9g}\n",
+                    r.workload.c_str(), r.n, r.dimension, r.linkage.c_str(), r.engine.c_str(), r.threads,
+                    r.seconds, r.merges_per_second, r.peak_rss_kb, r.allocations, r.allocations_per_merge, r.top_height);
+    }
+    else
+    {
+        if (header)
+        {
+            std::printf("workload,n,dimension,linkage,engine,threads,seconds,merges_per_second,peak_rss_kb,allocations,allocations_per_merge,top_height\n");
+        }
+        std::printf("%s,%zu,%zu,%s,%s,%zu,%.6f,%.1f,%ld,%zu,%.3f,%.9g\n",
+                    r.workload.c_str(), r.n, r.dimension, r.linkage.c_str(), r.engine.c_str(), r.threads,
+                    r.seconds, r.merges_per_second, r.peak_rss_kb, r.allocations, r.allocations_per_merge, r.top_height);
+    }
+    std::fflush(stdout);
+}
+
+std::vector<std::string> split(const std::string &list)
+{
+    std::vector<std::string> result;
+    std::stringstream        stream {list};
+    std::string              item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+        {
+            result.push_back(item);
+        }
+    }
+    return result;
+}
+
+bool contains(const std::vector<std::string> &list, const std::string &item)
+{
+    return std::find(std::begin(list), std::end(list), item) != std::end(list);
+}
+
+/*! \brief A whole decimal number, std::invalid_argument for anything else. */
+unsigned long parse_number(const std::string &text)
+{
+    std::size_t end    = 0;
+    const auto  number = std::stoul(text, &end);
+    if (end != text.size())
+    {
+        throw std::invalid_argument(text);
+    }
+    return number;
+}
+
+void print_usage(std::FILE * stream)
+{
+    std::fprintf(stream, "Usage: clusterbench [--sizes 1000,2000,5000,10000,20000,50000] [--workloads blobs,uniform,chained]\n"
+                 "                    [--linkages single_linkage,...] [--engines list,condensed,...]\n"
+                 "                    [--dimension 4] [--threads 0] [--seed 42] [--list-max 2000] [--cubic-max 5000] [--format csv|json]\n");
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    std::vector<std::string> sizes {"1000", "2000", "5000", "10000", "20000", "50000"};
+    std::vector<std::string> workloads {"blobs", "uniform", "chained"};
+    std::vector<std::string> linkages {};
+    for (const auto &linkage : all_linkages())
+    {
+        linkages.push_back(linkage.name);
+    }
+    std::vector<std::string> engines {"list", "condensed", "nn_chain", "generic", "mst", "kd_tree", "centroid"};
+    std::size_t              dimension = 4;
+    std::size_t              threads   = 0;
+    unsigned                 seed      = 42;
+    std::size_t              list_max  = 2000;
+    std::size_t              cubic_max = 5000;
+    bool                     json      = false;
+
+    for (int i = 1; i < argc; i += 2)
+    {
+        const std::string option = argv[i];
+        if (option == "--help" || option == "-h")
+        {
+            print_usage(stdout);
+            return 0;
+        }
+        if (i + 1 == argc)
+        {
+            std::fprintf(stderr, "Option %s needs a value.\n", option.c_str());
+            print_usage(stderr);
+            return 1;
+        }
+        const std::string value = argv[i+1];
+        try
+        {
+            if (option == "--sizes") { sizes = split(value); for (const auto &size : sizes) { parse_number(size); } }
+            else if (option == "--workloads") { workloads = split(value); }
+            else if (option == "--linkages") { linkages = split(value); }
+            else if (option == "--engines") { engines = split(value); }
+            else if (option == "--dimension") { dimension = parse_number(value); }
+            else if (option == "--threads") { threads = parse_number(value); }
+            else if (option == "--seed") { seed = parse_number(value); }
+            else if (option == "--list-max") { list_max = parse_number(value); }
+            else if (option == "--cubic-max") { cubic_max = parse_number(value); }
+            else if (option == "--format" && (value == "csv" || value == "json")) { json = value == "json"; }
+            else
+            {
+                std::fprintf(stderr, "Unknown option %s %s\n", option.c_str(), value.c_str());
+                print_usage(stderr);
+                return 1;
+            }
+        }
+        catch (const std::logic_error &)
+        {
+            std::fprintf(stderr, "Option %s needs a number, not %s\n", option.c_str(), value.c_str());
+            print_usage(stderr);
+            return 1;
+        }
+    }
+#if !defined(__OPTIMIZE__)
+    std::fprintf(stderr, "clusterbench was built without optimization, timings are not representative.\n");
+#endif
+
+    ThreadPool pool {threads == 0 ? ThreadPool::default_size() : threads};
+    CondensedDistanceMatrix<DistanceType>::allocation_hook = count_matrix_allocation;
+    bool       header = true;
+
+    for (const auto &workload : workloads)
+    {
+        for (const auto &size : sizes)
+        {
+            const std::size_t n         = parse_number(size);
+            const auto        points    = synthetic_points(workload, n, dimension, seed);
+            const auto        euclidean = distance_matrix(points, Metric::euclidean, pool);
+            const auto        squared   = distance_matrix(points, Metric::squared_euclidean, pool);
+
+            for (const auto &linkage : all_linkages())
+            {
+                if (!contains(linkages, linkage.name))
+                {
+                    continue;
+                }
+                /* Centroid, median and Ward are defined on squared Euclidean distances */
+                const auto  geometric = linkage.method == LinkageMethod::centroid || linkage.method == LinkageMethod::median || linkage.method == LinkageMethod::ward_minimum_distance;
+                const auto &input     = geometric ? squared : euclidean;
+
+                /* Each engine with its name; prepares its input, times the clustering with the stopwatch and returns the height of the last merge */
+                std::vector < std::pair < std::string, std::function<DistanceType(Stopwatch &)>>> runs {};
+                if (n <= list_max)
+                {
+                    runs.emplace_back("list", [&](Stopwatch &watch){
+                                          std::list<DistanceCluster> items {};
+                                          for (std::size_t i = 0; i < n; ++i)
+                                          {
+                                              items.emplace_back(std::vector<DistanceType>(input.row(i), input.row(i) + n-i-1), std::vector<std::size_t> {i});
+                                          }
+                                          watch.start();
+                                          auto tree = hierarchical_merge_into_tree(items, linkage.merge);
+                                          watch.stop();
+                                          return (**tree).merge_distance();
+                                      });
+                }
+                if (n <= cubic_max)
+                {
+                    runs.emplace_back("condensed", [&](Stopwatch &watch){
+                                          auto distances = copy_of(input);
+                                          watch.start();
+                                          const auto result = condensed_linkage(distances, linkage.method, pool);
+                                          watch.stop();
+                                          return result[n-2].distance;
+                                      });
+                }
+                if (reducible(linkage.method))
+                {
+                    runs.emplace_back("nn_chain", [&](Stopwatch &watch){
+                                          auto distances = copy_of(input);
+                                          watch.start();
+                                          const auto result = nn_chain_linkage(distances, linkage.merge);
+                                          watch.stop();
+                                          return result[n-2].distance;
+                                      });
+                }
+                if (n <= cubic_max)
+                {
+                    runs.emplace_back("generic", [&](Stopwatch &watch){
+                                          auto distances = copy_of(input);
+                                          watch.start();
+                                          const auto result = generic_linkage(distances, linkage.merge);
+                                          watch.stop();
+                                          return result[n-2].distance;
+                                      });
+                }
+                if (linkage.method == LinkageMethod::single_linkage)
+                {
+                    runs.emplace_back("mst", [&](Stopwatch &watch){
+                                          watch.start();
+                                          const auto result = mst_linkage(input, pool);
+                                          watch.stop();
+                                          return result[n-2].distance;
+                                      });
+                    runs.emplace_back("kd_tree", [&](Stopwatch &watch){
+                                          watch.start();
+                                          const auto result = kd_tree_single_linkage(points, pool);
+                                          watch.stop();
+                                          return result[n-2].distance;
+                                      });
+                }
+                if (linkage.method == LinkageMethod::ward_minimum_distance)
+                {
+                    runs.emplace_back("kd_tree", [&](Stopwatch &watch){
+                                          watch.start();
+                                          const auto result = kd_tree_ward_linkage(points, pool);
+                                          watch.stop();
+                                          return result[n-2].distance;
+                                      });
+                }
+                if (geometric)
+                {
+                    runs.emplace_back("centroid", [&](Stopwatch &watch){
+                                          watch.start();
+                                          const auto result = centroid_linkage(points, linkage.method, pool);
+                                          watch.stop();
+                                          return result[n-2].distance;
+                                      });
+                }
+
+                for (const auto &run : runs)
+                {
+                    if (!contains(engines, run.first) || n < 2)
+                    {
+                        continue;
+                    }
+                    reset_peak_rss();
+                    Stopwatch  watch {};
+                    const auto top_height = run.second(watch);
+                    print({workload, n, dimension, linkage.name, run.first, pool.size(), watch.seconds(), (n-1)/watch.seconds(),
+                           peak_rss_kb(), watch.allocations(), watch.allocations()/static_cast<double>(n-1), top_height}, json, header);
+                    header = false;
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * clusterobserver.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef CLUSTER_OBSERVER_H_
+#define CLUSTER_OBSERVER_H_
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+/*! \brief The phases of a merge step in hierarchical_merge_into_tree. */
+enum class ClusterPhase
+{
+    minimum_search,         //< find the closest pair of clusters
+    distance_collection,    //< gather the distances to the pair and drop them from their old place
+    lance_williams_update,  //< compute the distances to the merged cluster
+    tree_construction,      //< build the merged cluster and its tree node
+    count                   //< number of phases
+};
+
+/*! \brief Observer that does nothing and is compiled out entirely.
+ *
+ * It also documents the interface that hierarchical_merge_into_tree expects of an observer.
+ */
+struct NullClusterObserver
+{
+    /*!\brief Clustering of items starts. */
+    void start(std::size_t /*items*/) {}
+    /*!\brief A phase of a merge step begins. */
+    void begin(ClusterPhase /*phase*/) {}
+    /*!\brief The phase that began last ends. */
+    void end(ClusterPhase /*phase*/) {}
+    /*!\brief Distances were read from storage. */
+    void read(std::size_t /*distances*/) {}
+    /*!\brief Distances were written to storage. */
+    void written(std::size_t /*distances*/) {}
+    /*!\brief A merge was completed, with clusters left afterwards. */
+    void merged(std::size_t /*clusters_left*/) {}
+    /*!\brief Clustering is done. */
+    void finish() {}
+};
+
+/*! \brief State of a running clustering, as passed to progress callbacks. */
+struct ClusterProgress
+{
+    std::size_t merges;           //< merges done
+    std::size_t total_merges;     //< merges needed in total
+    double      elapsed_seconds;  //< since start
+    double      eta_seconds;      //< estimated time until finish
+};
+
+/*! \brief Observer that collects phase timings and counts, and reports progress periodically.
+ *
+ * The estimated time of arrival assumes that a merge costs clusters_left^work_exponent,
+ * which for the quadratic scan of hierarchical_merge_into_tree is an exponent of two.
+ * Allocations are only counted if the program counts them, see count_allocations.
+ */
+class ClusterStatistics
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        /*!\brief Statistics without progress reports. */
+        ClusterStatistics() : ClusterStatistics(nullptr) {};
+
+        /*!\brief Statistics that call back with the progress at most every interval seconds and once at the end.
+         * \param[in] progress Called with the current progress, may be empty.
+         * \param[in] interval Minimum time between two calls in seconds.
+         * \param[in] work_exponent Cost of a merge grows like this power of the number of clusters left.
+         */
+        explicit ClusterStatistics(std::function<void(const ClusterProgress &)> progress, double interval = 1, double work_exponent = 2) :
+            progress_ {std::move(progress)}, interval_ {interval}, work_exponent_ {work_exponent}
+        {
+            reset(0);
+        };
+
+        void start(std::size_t items)
+        {
+            reset(items);
+            for (std::size_t clusters = items; clusters > 1; --clusters)
+            {
+                total_work_ += work(clusters);
+            }
+            allocations_at_start_ = allocations_so_far_ ? allocations_so_far_() : 0;
+            start_                = Clock::now();
+            last_progress_        = start_;
+        }
+
+        void begin(ClusterPhase /*phase*/)
+        {
+            phase_start_ = Clock::now();
+        }
+
+        void end(ClusterPhase phase)
+        {
+            seconds_[static_cast<std::size_t>(phase)] += std::chrono::duration<double>(Clock::now() - phase_start_).count();
+        }
+
+        void read(std::size_t distances) { reads_ += distances; }
+        void written(std::size_t distances) { writes_ += distances; }
+
+        /*!\brief Measure the allocations from start to finish with a counter of all allocations so far.
+         * \param[in] allocations_so_far Returns the number of allocations of the program, e.g. counted by a replaced global operator new.
+         *  The count then includes the allocations inside the Clusterable and of any other thread.
+         */
+        void count_allocations(std::function<std::size_t()> allocations_so_far)
+        {
+            allocations_so_far_ = std::move(allocations_so_far);
+        }
+
+        void merged(std::size_t clusters_left)
+        {
+            ++merges_;
+            work_done_ += work(clusters_left+1);
+            if (progress_)
+            {
+                const auto now = Clock::now();
+                if (std::chrono::duration<double>(now - last_progress_).count() >= interval_)
+                {
+                    last_progress_ = now;
+                    progress_(progress());
+                }
+            }
+        }
+
+        void finish()
+        {
+            elapsed_     = std::chrono::duration<double>(Clock::now() - start_).count();
+            finished_    = true;
+            allocations_ = allocations_so_far_ ? allocations_so_far_() - allocations_at_start_ : 0;
+            if (progress_)
+            {
+                progress_(progress());
+            }
+        }
+
+        /*!\brief Current progress with an estimate of the remaining time; the time so far until finish. */
+        ClusterProgress progress() const
+        {
+            const auto elapsed = finished_ ? elapsed_ : std::chrono::duration<double>(Clock::now() - start_).count();
+            const auto eta     = work_done_ > 0 ? elapsed * (total_work_ - work_done_) / work_done_ : 0;
+            return {merges_, total_merges_, elapsed, eta};
+        }
+
+        /*!\brief Accumulated seconds spent in a phase. */
+        double seconds(ClusterPhase phase) const { return seconds_[static_cast<std::size_t>(phase)]; }
+        /*!\brief Total seconds from start to finish. */
+        double elapsed_seconds() const { return elapsed_; }
+        std::size_t merges() const { return merges_; }
+        /*!\brief Number of distances read, including those scanned in minimum searches. */
+        std::size_t distance_reads() const { return reads_; }
+        /*!\brief Number of distances written. */
+        std::size_t distance_writes() const { return writes_; }
+        /*!\brief Allocations from start to finish as measured by the counter given to count_allocations, zero without one. */
+        std::size_t allocations() const { return allocations_; }
+
+    private:
+        double work(std::size_t clusters) const
+        {
+            return std::pow(static_cast<double>(clusters), work_exponent_);
+        }
+
+        void reset(std::size_t items)
+        {
+            seconds_.fill(0);
+            merges_               = 0;
+            total_merges_         = items > 0 ? items-1 : 0;
+            reads_                = 0;
+            writes_               = 0;
+            allocations_          = 0;
+            allocations_at_start_ = 0;
+            work_done_            = 0;
+            total_work_           = 0;
+            elapsed_              = 0;
+            finished_             = false;
+        }
+
+        std::function<void(const ClusterProgress &)>                         progress_;             //< progress callback
+        double                                                               interval_;             //< minimum seconds between callbacks
+        double                                                               work_exponent_;        //< cost model for the eta
+        std::array<double, static_cast<std::size_t>(ClusterPhase::count)>   seconds_;              //< time per phase
+        std::size_t                                                          merges_;               //< merges done
+        std::size_t                                                          total_merges_;         //< merges to do
+        std::size_t                                                          reads_;                //< distances read
+        std::size_t                                                          writes_;               //< distances written
+        std::function<std::size_t()>                                         allocations_so_far_;   //< counter of all allocations, may be empty
+        std::size_t                                                          allocations_at_start_; //< counter at start
+        std::size_t                                                          allocations_;          //< allocations from start to finish
+        double                                                               work_done_;            //< modelled work done
+        double                                                               total_work_;           //< modelled work in total
+        double                                                               elapsed_;              //< seconds from start to finish
+        bool                                                                 finished_;             //< finish was called since start
+        Clock::time_point                                                    start_;                //< start of clustering
+        Clock::time_point                                                    last_progress_;        //< last progress callback
+        Clock::time_point                                                    phase_start_;          //< start of the current phase
+};
+
+#endif /* end of include guard: CLUSTER_OBSERVER_H_ */
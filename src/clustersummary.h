@@ -0,0 +1,171 @@
+/*
+ * clustersummary.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef CLUSTER_SUMMARY_H_
+#define CLUSTER_SUMMARY_H_
+
+#include <limits>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "binarytree.h"
+#include "compactdistance.h"
+#include "condenseddistancematrix.h"
+#include "threadpool.h"
+
+/*! \brief Representative and spread of one flat cluster. */
+template <typename DistanceType>
+struct ClusterSummary
+{
+    std::size_t  size;          //< number of elements
+    std::size_t  medoid;        //< element with the smallest sum of distances to the others, the lowest of ties
+    DistanceType diameter;      //< largest distance between two elements, zero for a single element
+    DistanceType mean_distance; //< mean distance over all pairs of elements, zero for a single element
+};
+
+/*! \brief Label of elements that belong to no cluster. */
+const std::size_t unclustered = std::numeric_limits<std::size_t>::max();
+
+/*! \brief Medoid, diameter and mean distance of all flat clusters with a single pass over the distances.
+ *
+ * Reads every stored distance once, row after row, so a mapped matrix is paged in sequentially
+ * instead of once per cluster. Rows are dealt out to the threads in turn, which balances the triangle;
+ * each thread sums distances per element in its own array, so memory is O(threads * n) on top of the matrix.
+ * Sums are kept in double for all distance types.
+ *
+ * \param[in] distances Mutual distances of the elements, e.g. from map_distance_matrix, left untouched.
+ * \param[in] labels The cluster of each element, numbered 0, 1, ... as by cut_at_distance; unclustered to leave an element out.
+ * \param[in] pool Threads that read the distances.
+ * \returns One summary per label, empty clusters have size 0.
+ */
+template <typename DistanceType>
+std::vector < ClusterSummary < typename distance_arithmetic < DistanceType>::type>> cluster_summaries(const CondensedDistanceMatrix<DistanceType> &distances, const std::vector<std::size_t> &labels,
+                                                                                                       ThreadPool &pool)
+{
+    typedef typename distance_arithmetic<DistanceType>::type Arithmetic;
+
+    const auto  n        = distances.size();
+    std::size_t clusters = 0;
+    for (auto label : labels)
+    {
+        if (label != unclustered && label >= clusters)
+        {
+            clusters = label + 1;
+        }
+    }
+
+    /* Distance sums of each element and diameters of each cluster, per thread */
+    std::vector < std::vector < double>> thread_sums(pool.size());
+    std::vector < std::vector < Arithmetic>> thread_diameters(pool.size());
+    pool.run([&](std::size_t thread){
+                 auto &sums      = thread_sums[thread];
+                 auto &diameters = thread_diameters[thread];
+                 sums.assign(n, 0);
+                 diameters.assign(clusters, Arithmetic(0));
+                 for (auto i = thread; i < n; i += pool.size())
+                 {
+                     const auto cluster = labels[i];
+                     if (cluster == unclustered)
+                     {
+                         continue;
+                     }
+                     const auto row      = distances.row(i);
+                     double     row_sum  = 0;
+                     auto       diameter = diameters[cluster];
+                     for (auto j = i+1; j < n; ++j)
+                     {
+                         if (labels[j] == cluster)
+                         {
+                             const Arithmetic d = row[j-i-1];
+                             row_sum += d;
+                             sums[j] += d;
+                             if (diameter < d)
+                             {
+                                 diameter = d;
+                             }
+                         }
+                     }
+                     sums[i]            += row_sum;
+                     diameters[cluster]  = diameter;
+                 }
+             });
+
+    /* Add up the sums of the threads element by element */
+    auto &sums = thread_sums[0];
+    pool.run([&](std::size_t thread){
+                 const auto range = pool.chunk(0, n, thread);
+                 for (std::size_t t = 1; t < thread_sums.size(); ++t)
+                 {
+                     for (auto i = range.first; i < range.second; ++i)
+                     {
+                         sums[i] += thread_sums[t][i];
+                     }
+                 }
+             });
+
+    std::vector < ClusterSummary < Arithmetic>> summaries(clusters, ClusterSummary<Arithmetic> {0, unclustered, Arithmetic(0), Arithmetic(0)});
+    std::vector<double> totals(clusters, 0);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const auto cluster = labels[i];
+        if (cluster == unclustered)
+        {
+            continue;
+        }
+        auto &summary = summaries[cluster];
+        if (summary.size == 0 || sums[i] < sums[summary.medoid])
+        {
+            summary.medoid = i;
+        }
+        ++summary.size;
+        totals[cluster] += sums[i];
+    }
+    for (std::size_t cluster = 0; cluster < clusters; ++cluster)
+    {
+        auto &summary = summaries[cluster];
+        for (const auto &diameters : thread_diameters)
+        {
+            if (summary.diameter < diameters[cluster])
+            {
+                summary.diameter = diameters[cluster];
+            }
+        }
+        if (summary.size > 1)
+        {
+            /* every pair is counted in the sums of both its elements */
+            summary.mean_distance = static_cast<Arithmetic>(totals[cluster]/(static_cast<double>(summary.size)*(summary.size-1)));
+        }
+    }
+    return summaries;
+}
+
+/*! \brief Medoid, diameter and mean distance of the branches cut from a tree, see cluster_summaries above.
+ *
+ * \tparam Clusterable Must provide elements(), the rows of the distance matrix in the cluster.
+ * \param[in] distances Mutual distances of the elements, left untouched.
+ * \param[in] branches The clusters, e.g. from BinaryTree::cut or a forest from MergeStop; elements in none are left out.
+ * \param[in] pool Threads that read the distances.
+ * \returns One summary per branch, in the order of branches.
+ */
+template <typename DistanceType, typename Clusterable>
+std::vector < ClusterSummary < typename distance_arithmetic < DistanceType>::type>> cluster_summaries(const CondensedDistanceMatrix<DistanceType> &distances,
+                                                                                                       const std::list < std::unique_ptr < BinaryTree < Clusterable>> > &branches, ThreadPool &pool)
+{
+    std::vector<std::size_t> labels(distances.size(), unclustered);
+    std::size_t              label = 0;
+    for (const auto &branch : branches)
+    {
+        for (auto element : (**branch).elements())
+        {
+            labels[element] = label;
+        }
+        ++label;
+    }
+    auto summaries = cluster_summaries(distances, labels, pool);
+    summaries.resize(branches.size(), ClusterSummary < typename distance_arithmetic < DistanceType>::type> {0, unclustered, 0, 0});
+    return summaries;
+}
+
+#endif /* end of include guard: CLUSTER_SUMMARY_H_ */
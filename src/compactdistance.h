@@ -0,0 +1,427 @@
+/*
+ * compactdistance.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef COMPACT_DISTANCE_H_
+#define COMPACT_DISTANCE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#if defined(__F16C__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*! \brief Distances stored in 16 bits, for clustering whose merge order only depends on comparisons.
+ *
+ * Each type converts explicitly from float, rounding to the nearest representable value, and implicitly
+ * back to float, exactly. Rounding is monotone: a <= b implies stored(a) <= stored(b), so the order of
+ * distances is kept, except that distinct distances may become tied. The 16 bits are kept in an order
+ * preserving form, so that comparing two stored distances is a single integer comparison that agrees
+ * with comparing their float values. The types are trivial, like float: value initialization gives
+ * zero and vectors of them are moved with memmove. Ties are broken
+ * by the clustering as for float distances, e.g. hierarchical_merge_into_tree merges the first
+ * closest pair in list order. Negative zero is stored as zero.
+ *
+ * Lance-Williams updates are computed in float, see distance_arithmetic, and rounded when stored.
+ *
+ * Error bound on merge heights, with e(h) = max_error(h) of the storage type:
+ *  - single linkage: the heights are exactly the true heights h rounded, so off by at most e(h),
+ *  - complete linkage: the result is the exact clustering of distances that are each off by at most e;
+ *    when no two distances differ by less than 2e, the merge order is unchanged and heights are off by at most e(h),
+ *  - averaging linkages round every updated distance again, errors may accumulate with the number of merges.
+ */
+
+/*! \brief Key of a sign-magnitude 16 bit code, whose signed integer order is the order of the values.
+ *
+ * Positive codes stay as they are, negative ones get their magnitude inverted; zero stays zero.
+ * The mapping is its own inverse.
+ */
+constexpr std::int16_t sign_magnitude_key(std::uint16_t bits)
+{
+    return static_cast<std::int16_t>(bits ^ ((bits >> 15) * 0x7fffu));
+}
+
+/*! \brief The smallest of stored distances, as found by std::min_element.
+ * \param[in] distances The distances, length must be larger than zero.
+ */
+template <typename DistanceType>
+DistanceType smallest_distance(const DistanceType * distances, std::size_t length)
+{
+    auto minimum = distances[0];
+    for (std::size_t k = 1; k < length; ++k)
+    {
+        if (distances[k] < minimum)
+        {
+            minimum = distances[k];
+        }
+    }
+    return minimum;
+}
+
+/*! \brief The smallest of 16 bit integers, signed if bias is zero, unsigned if bias is 0x8000.
+ *
+ * A scalar minimum is a chain of compares and conditional moves; the vector version takes eight at a time.
+ * \param[in] values The integers, length must be larger than zero.
+ */
+inline std::uint16_t smallest_16bit(const void * values, std::size_t length, std::uint16_t bias)
+{
+    std::int16_t first;
+    std::memcpy(&first, values, sizeof(first));
+    std::int16_t minimum = static_cast<std::int16_t>(first ^ bias);
+    std::size_t  k       = 0;
+#if defined(__SSE2__)
+    if (length >= 8)
+    {
+        const auto bytes  = static_cast<const char*>(values);
+        const auto biases = _mm_set1_epi16(static_cast<short>(bias));
+        auto       minima = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes)), biases);
+        for (k = 8; k + 8 <= length; k += 8)
+        {
+            minima = _mm_min_epi16(minima, _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 2*k)), biases));
+        }
+        minima  = _mm_min_epi16(minima, _mm_srli_si128(minima, 8));
+        minima  = _mm_min_epi16(minima, _mm_srli_si128(minima, 4));
+        minima  = _mm_min_epi16(minima, _mm_srli_si128(minima, 2));
+        minimum = static_cast<std::int16_t>(_mm_cvtsi128_si32(minima));
+    }
+#endif
+    for (; k < length; ++k)
+    {
+        std::int16_t value;
+        std::memcpy(&value, static_cast<const char*>(values) + 2*k, sizeof(value));
+        value   = static_cast<std::int16_t>(value ^ bias);
+        minimum = value < minimum ? value : minimum;
+    }
+    return static_cast<std::uint16_t>(minimum ^ bias);
+}
+
+/*! \brief IEEE 754 half precision bits of a float, rounded to nearest even. */
+inline std::uint16_t float_to_half_bits(float value)
+{
+#if defined(__F16C__)
+    return static_cast<std::uint16_t>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+#else
+    std::uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    const std::uint32_t sign = (f >> 16) & 0x8000u;
+    f &= 0x7fffffffu;
+    if (f >= 0x7f800000u)
+    {
+        /* Infinity, or a quiet not-a-number */
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (f > 0x7f800000u ? 0x200u : 0));
+    }
+    if (f >= 0x477ff000u)
+    {
+        /* 65520 and above round to infinity */
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+    if (f < 0x38800000u)
+    {
+        /* Below the smallest normal half, 2^-14 */
+        if (f < 0x33000000u)
+        {
+            return static_cast<std::uint16_t>(sign);
+        }
+        const std::uint32_t shift     = 126 - (f >> 23);
+        const std::uint32_t mantissa  = (f & 0x7fffffu) | 0x800000u;
+        std::uint32_t       half      = mantissa >> shift;
+        const std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const std::uint32_t halfway   = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+        {
+            ++half;
+        }
+        return static_cast<std::uint16_t>(sign | half);
+    }
+    std::uint32_t       half      = (f >> 13) - (112u << 10);
+    const std::uint32_t remainder = f & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1)))
+    {
+        ++half;
+    }
+    return static_cast<std::uint16_t>(sign | half);
+#endif
+}
+
+/*! \brief The float value of IEEE 754 half precision bits. */
+inline float half_bits_to_float(std::uint16_t bits)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(bits);
+#else
+    const std::uint32_t sign     = (bits & 0x8000u) << 16;
+    std::uint32_t       exponent = (bits >> 10) & 0x1fu;
+    std::uint32_t       mantissa = bits & 0x3ffu;
+    std::uint32_t       f;
+    if (exponent == 0x1fu)
+    {
+        f = sign | 0x7f800000u | (mantissa << 13);
+    }
+    else if (exponent != 0)
+    {
+        f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if (mantissa == 0)
+    {
+        f = sign;
+    }
+    else
+    {
+        /* Subnormal half, normal as float */
+        exponent = 113;
+        while (!(mantissa & 0x400u))
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        f = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    float value;
+    std::memcpy(&value, &f, sizeof(value));
+    return value;
+#endif
+}
+
+/*! \brief IEEE 754 half precision distance: 11 significant bits, finite up to 65504. */
+class HalfDistance
+{
+    public:
+        HalfDistance() = default;
+        explicit HalfDistance(float value) : key_ {sign_magnitude_key(float_to_half_bits(value == 0 ? 0.0f : value))} {};
+        operator float() const { return half_bits_to_float(static_cast<std::uint16_t>(sign_magnitude_key(static_cast<std::uint16_t>(key_)))); };
+
+        /*!\brief The distance with the given IEEE 754 binary16 bits. */
+        static constexpr HalfDistance from_bits(std::uint16_t bits) { return HalfDistance(sign_magnitude_key(bits), 0); };
+
+        /*!\brief Largest difference between a distance and its stored value, for distances up to 65504. */
+        static float max_error(float distance)
+        {
+            return std::max(std::abs(distance)/2048, 1.0f/33554432);
+        };
+
+        friend bool operator<(HalfDistance a, HalfDistance b) { return a.key_ < b.key_; };
+        friend bool operator>(HalfDistance a, HalfDistance b) { return b.key_ < a.key_; };
+        friend bool operator<=(HalfDistance a, HalfDistance b) { return a.key_ <= b.key_; };
+        friend bool operator>=(HalfDistance a, HalfDistance b) { return a.key_ >= b.key_; };
+        friend bool operator==(HalfDistance a, HalfDistance b) { return a.key_ == b.key_; };
+        friend bool operator!=(HalfDistance a, HalfDistance b) { return a.key_ != b.key_; };
+
+        friend HalfDistance smallest_distance(const HalfDistance * distances, std::size_t length)
+        {
+            HalfDistance minimum;
+            minimum.key_ = static_cast<std::int16_t>(smallest_16bit(distances, length, 0));
+            return minimum;
+        };
+
+    private:
+        constexpr HalfDistance(std::int16_t key, int) : key_ {key} {};
+
+        std::int16_t key_; //< sign_magnitude_key of the IEEE 754 binary16 bits
+};
+
+/*! \brief Brain floating point distance: the upper half of a float, 8 significant bits, the full float range. */
+class BFloat16Distance
+{
+    public:
+        BFloat16Distance() = default;
+        explicit BFloat16Distance(float value)
+        {
+            std::uint32_t f;
+            value = value == 0 ? 0.0f : value;
+            std::memcpy(&f, &value, sizeof(f));
+            if ((f & 0x7fffffffu) > 0x7f800000u)
+            {
+                key_ = sign_magnitude_key(static_cast<std::uint16_t>((f >> 16) | 0x40u));
+            }
+            else
+            {
+                /* Round to nearest even; overflow rounds to infinity */
+                key_ = sign_magnitude_key(static_cast<std::uint16_t>((f + 0x7fffu + ((f >> 16) & 1)) >> 16));
+            }
+        };
+        operator float() const
+        {
+            const std::uint32_t f = static_cast<std::uint32_t>(static_cast<std::uint16_t>(sign_magnitude_key(static_cast<std::uint16_t>(key_)))) << 16;
+            float value;
+            std::memcpy(&value, &f, sizeof(value));
+            return value;
+        };
+
+        /*!\brief The distance with the given upper 16 bits of a float. */
+        static constexpr BFloat16Distance from_bits(std::uint16_t bits) { return BFloat16Distance(sign_magnitude_key(bits), 0); };
+
+        /*!\brief Largest difference between a distance and its stored value, for normal floats. */
+        static float max_error(float distance)
+        {
+            return std::abs(distance)/256;
+        };
+
+        friend bool operator<(BFloat16Distance a, BFloat16Distance b) { return a.key_ < b.key_; };
+        friend bool operator>(BFloat16Distance a, BFloat16Distance b) { return b.key_ < a.key_; };
+        friend bool operator<=(BFloat16Distance a, BFloat16Distance b) { return a.key_ <= b.key_; };
+        friend bool operator>=(BFloat16Distance a, BFloat16Distance b) { return a.key_ >= b.key_; };
+        friend bool operator==(BFloat16Distance a, BFloat16Distance b) { return a.key_ == b.key_; };
+        friend bool operator!=(BFloat16Distance a, BFloat16Distance b) { return a.key_ != b.key_; };
+
+        friend BFloat16Distance smallest_distance(const BFloat16Distance * distances, std::size_t length)
+        {
+            BFloat16Distance minimum;
+            minimum.key_ = static_cast<std::int16_t>(smallest_16bit(distances, length, 0));
+            return minimum;
+        };
+
+    private:
+        constexpr BFloat16Distance(std::int16_t key, int) : key_ {key} {};
+
+        std::int16_t key_; //< sign_magnitude_key of the upper 16 bits of a float
+};
+
+/*! \brief Distance quantized linearly to 16 bits over a supplied range.
+ *
+ * \tparam Range Provides static float lowest() and highest(), constexpr or read at run time,
+ *  but fixed while distances are stored.
+ *
+ * Codes 0 .. 65534 cover lowest() .. highest() in equal steps, values outside are clamped.
+ * Code 65535 is infinity, which engines use for retired clusters.
+ */
+template <typename Range>
+class QuantizedDistance
+{
+    public:
+        QuantizedDistance() = default;
+        explicit QuantizedDistance(float value)
+        {
+            if (value == std::numeric_limits<float>::infinity())
+            {
+                code_ = infinity_code;
+                return;
+            }
+            const float scaled = (value - Range::lowest()) * (static_cast<float>(steps)/(Range::highest() - Range::lowest()));
+            code_ = !(scaled > 0) ? 0 : scaled >= steps ? static_cast<std::uint16_t>(steps) : static_cast<std::uint16_t>(scaled + 0.5f);
+        };
+        operator float() const
+        {
+            return code_ == infinity_code ? std::numeric_limits<float>::infinity() : Range::lowest() + code_ * ((Range::highest() - Range::lowest())/steps);
+        };
+
+        /*!\brief The distance with the given code, steps for highest() and infinity_code for infinity. */
+        static constexpr QuantizedDistance from_code(std::uint16_t code) { return QuantizedDistance(code, 0); };
+
+        static const std::uint16_t steps         = 65534; //< codes for finite distances are 0 .. steps
+        static const std::uint16_t infinity_code = 65535; //< code for infinity
+
+        /*!\brief Largest difference between a distance and its stored value, for distances within the range. */
+        static float max_error(float /*distance*/)
+        {
+            return (Range::highest() - Range::lowest())/steps/2;
+        };
+
+        friend bool operator<(QuantizedDistance a, QuantizedDistance b) { return a.code_ < b.code_; };
+        friend bool operator>(QuantizedDistance a, QuantizedDistance b) { return b.code_ < a.code_; };
+        friend bool operator<=(QuantizedDistance a, QuantizedDistance b) { return a.code_ <= b.code_; };
+        friend bool operator>=(QuantizedDistance a, QuantizedDistance b) { return a.code_ >= b.code_; };
+        friend bool operator==(QuantizedDistance a, QuantizedDistance b) { return a.code_ == b.code_; };
+        friend bool operator!=(QuantizedDistance a, QuantizedDistance b) { return a.code_ != b.code_; };
+
+        friend QuantizedDistance smallest_distance(const QuantizedDistance * distances, std::size_t length)
+        {
+            QuantizedDistance minimum;
+            minimum.code_ = smallest_16bit(distances, length, 0x8000);
+            return minimum;
+        };
+
+    private:
+        constexpr QuantizedDistance(std::uint16_t code, int) : code_ {code} {};
+
+        std::uint16_t code_; //< quantized distance
+};
+
+template <typename Range>
+const std::uint16_t QuantizedDistance<Range>::steps;
+
+template <typename Range>
+const std::uint16_t QuantizedDistance<Range>::infinity_code;
+
+/*! \brief Limits of the 16 bit distances, as for float: engines retire clusters by setting their distances to infinity(). */
+namespace std
+{
+
+template <>
+struct numeric_limits<HalfDistance>
+{
+    static constexpr bool is_specialized = true;
+    static constexpr bool is_signed      = true;
+    static constexpr bool has_infinity   = true;
+    static constexpr bool has_quiet_NaN  = true;
+    static constexpr int  digits         = 11;
+
+    static constexpr HalfDistance min() noexcept { return HalfDistance::from_bits(0x0400); };
+    static constexpr HalfDistance max() noexcept { return HalfDistance::from_bits(0x7bff); };
+    static constexpr HalfDistance lowest() noexcept { return HalfDistance::from_bits(0xfbff); };
+    static constexpr HalfDistance epsilon() noexcept { return HalfDistance::from_bits(0x1400); };
+    static constexpr HalfDistance infinity() noexcept { return HalfDistance::from_bits(0x7c00); };
+    static constexpr HalfDistance quiet_NaN() noexcept { return HalfDistance::from_bits(0x7e00); };
+};
+
+template <>
+struct numeric_limits<BFloat16Distance>
+{
+    static constexpr bool is_specialized = true;
+    static constexpr bool is_signed      = true;
+    static constexpr bool has_infinity   = true;
+    static constexpr bool has_quiet_NaN  = true;
+    static constexpr int  digits         = 8;
+
+    static constexpr BFloat16Distance min() noexcept { return BFloat16Distance::from_bits(0x0080); };
+    static constexpr BFloat16Distance max() noexcept { return BFloat16Distance::from_bits(0x7f7f); };
+    static constexpr BFloat16Distance lowest() noexcept { return BFloat16Distance::from_bits(0xff7f); };
+    static constexpr BFloat16Distance epsilon() noexcept { return BFloat16Distance::from_bits(0x3c00); };
+    static constexpr BFloat16Distance infinity() noexcept { return BFloat16Distance::from_bits(0x7f80); };
+    static constexpr BFloat16Distance quiet_NaN() noexcept { return BFloat16Distance::from_bits(0x7fc0); };
+};
+
+/* Quantized distances have no NaN; lowest() and max() are the ends of the range */
+template <typename Range>
+struct numeric_limits < QuantizedDistance < Range>>
+{
+    static constexpr bool is_specialized = true;
+    static constexpr bool has_infinity   = true;
+    static constexpr bool has_quiet_NaN  = false;
+
+    static constexpr QuantizedDistance<Range> max() noexcept { return QuantizedDistance<Range>::from_code(QuantizedDistance<Range>::steps); };
+    static constexpr QuantizedDistance<Range> lowest() noexcept { return QuantizedDistance<Range>::from_code(0); };
+    static constexpr QuantizedDistance<Range> infinity() noexcept { return QuantizedDistance<Range>::from_code(QuantizedDistance<Range>::infinity_code); };
+};
+
+}
+
+/*! \brief The type Lance-Williams updates of stored distances are computed in. */
+template <typename DistanceType>
+struct distance_arithmetic
+{
+    typedef DistanceType type;
+};
+
+template <>
+struct distance_arithmetic<HalfDistance>
+{
+    typedef float type;
+};
+
+template <>
+struct distance_arithmetic<BFloat16Distance>
+{
+    typedef float type;
+};
+
+template <typename Range>
+struct distance_arithmetic < QuantizedDistance < Range>>
+{
+    typedef float type;
+};
+
+#endif /* end of include guard: COMPACT_DISTANCE_H_ */
@@ -0,0 +1,265 @@
+/*
+ * condensedcluster.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef CONDENSED_CLUSTER_H_
+#define CONDENSED_CLUSTER_H_
+
+#include <algorithm>
+#include <limits>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "binarytree.h"
+#include "condenseddistancematrix.h"
+#include "lancewilliamskernels.h"
+#include "linkage.h"
+#include "threadpool.h"
+
+/*! \brief Merge the closest pair of clusters in a condensed matrix until one cluster is left.
+ *
+ * The merged cluster takes the matrix row of its left (lower-index) part; the row of the right part
+ * is retired by setting its column to infinity, so that no distance is ever moved in memory.
+ * Of all pairs at minimal distance, the one with the lowest row, then column index is merged first,
+ * whatever the number of threads.
+ *
+ * \param[in] distances Mutual distances of the clusters, overwritten during merging.
+ * \param[in] builder Records the merges, one slot per row of the distance matrix.
+ * \param[in] update_distances Called as update_distances(left, right, d_left_right, active, first, last, thread)
+ *            to set the distances of the clusters active[first..last) but left and right to the merged cluster
+ *            in the row and column of left; sizes in the builder are those before the merge.
+ * \param[in] pool Threads that search the minimum and update the distances.
+ * \param[in] stop Merging ends before the first merge that is too far, or when few enough clusters are left.
+ */
+template <typename DistanceType, typename UpdateDistances>
+void merge_closest_pairs(CondensedDistanceMatrix<DistanceType> &distances, LinkageBuilder<DistanceType> &builder, UpdateDistances update_distances, ThreadPool &pool,
+                         const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    const auto n        = distances.size();
+    const auto infinity = std::numeric_limits<DistanceType>::infinity();
+
+    if (n < 2)
+    {
+        return;
+    }
+
+    /* Indices of the rows that still hold a cluster, in ascending order */
+    std::vector<std::size_t> active(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        active[i] = i;
+    }
+
+    /* The closest pair found by each thread */
+    struct Candidate
+    {
+        DistanceType distance;
+        std::size_t  left;
+        std::size_t  right;
+    };
+    std::vector<Candidate> thread_candidate(pool.size());
+
+    while (active.size() > 1 && active.size() > stop.clusters)
+    {
+        /* Find the closest pair; retired columns hold infinity and are skipped implicitly.
+         * Rows are dealt out to the threads in turn, which balances the triangle. */
+        pool.run([&](std::size_t thread){
+                     Candidate candidate {infinity, n, n};
+                     for (auto position = thread; position < active.size(); position += pool.size())
+                     {
+                         const auto i = active[position];
+                         if (i+1 < n)
+                         {
+                             const auto row_closest = row_minimum(distances.row(i), n-i-1);
+                             if (row_closest.second < candidate.distance)
+                             {
+                                 candidate = {row_closest.second, i, i+1+row_closest.first};
+                             }
+                         }
+                     }
+                     thread_candidate[thread] = candidate;
+                 });
+        Candidate closest {infinity, n, n};
+        for (const auto &candidate : thread_candidate)
+        {
+            if (candidate.distance < closest.distance || (!(closest.distance < candidate.distance) && candidate.left < closest.left))
+            {
+                closest = candidate;
+            }
+        }
+        if (closest.left == n)
+        {
+            /* only infinite distances are left, merge the first two clusters */
+            closest = {distances(active[0], active[1]), active[0], active[1]};
+        }
+        if (stop.too_far(closest.distance))
+        {
+            break;
+        }
+        const auto left             = closest.left;
+        const auto right            = closest.right;
+        const auto minimum_distance = closest.distance;
+
+        /* Update the distances of the merged cluster in place and retire the right cluster */
+        pool.run([&](std::size_t thread){
+                     const auto range = pool.chunk(0, active.size(), thread);
+                     update_distances(left, right, minimum_distance, active, range.first, range.second, thread);
+                     for (auto position = range.first; position < range.second && active[position] < right; ++position)
+                     {
+                         distances(active[position], right) = infinity;
+                     }
+                 });
+        active.erase(std::lower_bound(std::begin(active), std::end(active), right));
+
+        builder.merge(left, right, minimum_distance);
+    }
+}
+
+/*! \brief Hierarchical clustering of a condensed distance matrix.
+ *
+ * \tparam MergeFunction A LanceWilliamsUpdate function or equivalent.
+ * \param[in] distances Mutual distances of the leaves, overwritten during merging.
+ * \param[in] merge_distance A function defining how to calculate the new distances to the merged cluster.
+ * \param[in] pool Threads that search the minimum and update the distances.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Where to stop merging, which leaves an incomplete linkage.
+ *
+ * See merge_closest_pairs for the order of merges.
+ */
+template <typename DistanceType, typename MergeFunction>
+Linkage<DistanceType> condensed_linkage(CondensedDistanceMatrix<DistanceType> &distances, MergeFunction merge_distance, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                        const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    LinkageBuilder<DistanceType> builder {distances.size(), std::move(leaf_sizes)};
+    const auto &cluster_sizes = builder.sizes();
+    auto update_distances = [&](std::size_t left, std::size_t right, DistanceType minimum_distance, const std::vector<std::size_t> &active, std::size_t first, std::size_t last, std::size_t /*thread*/){
+            for (auto position = first; position < last; ++position)
+            {
+                const auto k = active[position];
+                if (k != left && k != right)
+                {
+                    auto &d_to_left = distances(k, left);
+                    d_to_left = DistanceType(merge_distance(minimum_distance, cluster_sizes[k], cluster_sizes[left], cluster_sizes[right], d_to_left, distances(k, right)));
+                }
+            }
+        };
+    merge_closest_pairs(distances, builder, update_distances, pool, stop);
+    return builder.release();
+}
+
+/*! \brief Hierarchical clustering of a condensed distance matrix, updating whole rows with vector kernels.
+ *
+ * Distances to clusters after the right cluster are contiguous in the rows of left and right and are
+ * updated in place with lance_williams_update_row, retired columns included as they stay infinite.
+ * Distances to clusters before the right cluster are gathered into a buffer, updated and scattered back.
+ *
+ * \param[in] distances Mutual distances of the leaves, overwritten during merging.
+ * \param[in] method The linkage.
+ * \param[in] pool Threads that search the minimum and update the distances.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Where to stop merging, which leaves an incomplete linkage.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> condensed_linkage(CondensedDistanceMatrix<DistanceType> &distances, LinkageMethod method, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                        const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    LinkageBuilder<DistanceType> builder {distances.size(), std::move(leaf_sizes)};
+    const auto &weights = builder.weights();
+
+    /* Gathered distances to left, to right and sizes of each thread */
+    struct Buffer
+    {
+        std::vector<DistanceType>                                  to_left, to_right;
+        std::vector<typename LinkageBuilder<DistanceType>::Weight> sizes;
+        std::vector<std::size_t>                                   clusters;
+    };
+    std::vector<Buffer> buffers(pool.size());
+
+    auto update_distances = [&](std::size_t left, std::size_t right, DistanceType minimum_distance, const std::vector<std::size_t> &active, std::size_t first, std::size_t last, std::size_t thread){
+            auto &buffer = buffers[thread];
+            buffer.to_left.clear();
+            buffer.to_right.clear();
+            buffer.sizes.clear();
+            buffer.clusters.clear();
+            auto position = first;
+            for (; position < last && active[position] < right; ++position)
+            {
+                const auto k = active[position];
+                if (k != left)
+                {
+                    buffer.to_left.push_back(distances(k, left));
+                    buffer.to_right.push_back(distances(k, right));
+                    buffer.sizes.push_back(weights[k]);
+                    buffer.clusters.push_back(k);
+                }
+            }
+            lance_williams_update_row(method, minimum_distance, weights[left], weights[right], buffer.sizes.data(), buffer.to_left.data(), buffer.to_right.data(), buffer.to_left.data(), buffer.to_left.size());
+            for (std::size_t i = 0; i < buffer.clusters.size(); ++i)
+            {
+                distances(buffer.clusters[i], left) = buffer.to_left[i];
+            }
+
+            if (position < last)
+            {
+                /* Skip the right cluster itself */
+                const auto begin = std::max(active[position], right+1);
+                const auto end   = active[last-1]+1;
+                if (begin < end)
+                {
+                    auto d_to_left = distances.row(left) + (begin-left-1);
+                    lance_williams_update_row(method, minimum_distance, weights[left], weights[right], weights.data() + begin, d_to_left, distances.row(right) + (begin-right-1), d_to_left, end-begin);
+                }
+            }
+        };
+    merge_closest_pairs(distances, builder, update_distances, pool, stop);
+    return builder.release();
+}
+
+/*! \brief Hierarchical clustering of a condensed distance matrix on a single thread. */
+template <typename DistanceType, typename MergeFunction>
+Linkage<DistanceType> condensed_linkage(CondensedDistanceMatrix<DistanceType> &distances, MergeFunction merge_distance)
+{
+    ThreadPool pool {1};
+    return condensed_linkage(distances, merge_distance, pool);
+}
+
+/*! \brief Hierarchically merge items whose distances are stored in a condensed matrix.
+ *
+ * \tparam Clusterable The items to be clustered must provide DistanceType, merger and size.
+ * \tparam MergeFunction A LanceWilliamsUpdate function or a LinkageMethod.
+ * \param[in] distances Mutual distances of the items, overwritten during merging.
+ * \param[in] leaves One clusterable per row of the distance matrix.
+ * \param[in] merge_distance A function defining how to calculate the new distances to the merged cluster.
+ * \param[in] pool Threads that search the minimum and update the distances.
+ *
+ * The tree is built from condensed_linkage.
+ */
+template <typename Clusterable, typename MergeFunction>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_condensed(CondensedDistanceMatrix<typename Clusterable::DistanceType> &distances, std::vector<Clusterable> leaves, MergeFunction merge_distance, ThreadPool &pool)
+{
+    auto linkage = condensed_linkage(distances, merge_distance, pool, leaf_sizes(leaves));
+    return linkage.tree(std::move(leaves));
+}
+
+/*! \brief Hierarchically merge items whose distances are stored in a condensed matrix, on a single thread. */
+template <typename Clusterable, typename MergeFunction>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_condensed(CondensedDistanceMatrix<typename Clusterable::DistanceType> &distances, std::vector<Clusterable> leaves, MergeFunction merge_distance)
+{
+    ThreadPool pool {1};
+    return hierarchical_merge_condensed(distances, std::move(leaves), merge_distance, pool);
+}
+
+/*! \brief Hierarchically merge list items, copying their distances into one condensed matrix first.
+ *
+ * Drop-in replacement for hierarchical_merge_into_tree.
+ * The distances of the items are moved into the matrix, the items themselves into the leaves.
+ */
+template <typename Clusterable, typename MergeFunction>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_condensed(std::list<Clusterable> &items_to_cluster, MergeFunction merge_distance)
+{
+    CondensedDistanceMatrix<typename Clusterable::DistanceType> distances {items_to_cluster};
+    return hierarchical_merge_condensed(distances, leaves_without_distances(items_to_cluster), merge_distance);
+}
+
+#endif /* end of include guard: CONDENSED_CLUSTER_H_ */
@@ -0,0 +1,128 @@
+/*
+ * condenseddistancematrix.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef CONDENSED_DISTANCE_MATRIX_H_
+#define CONDENSED_DISTANCE_MATRIX_H_
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <list>
+#include <memory>
+#include <new>
+
+/*! \brief Upper triangle of a symmetric distance matrix in one contiguous, cache-aligned buffer.
+ *
+ * Row i holds the n-i-1 distances to the following elements, just like
+ * DistanceCluster::distances(), but all rows share a single allocation.
+ * The distance between i < j is stored at i*(2n-i-1)/2 + j-i-1.
+ */
+template <typename DistanceType>
+class CondensedDistanceMatrix
+{
+    public:
+        /*!\brief Alignment of the distance buffer in bytes, one cache line. */
+        static const std::size_t alignment = 64;
+
+        /*!\brief Called with the size in bytes of each distance buffer before it is allocated, nullptr for none.
+         * Meant for counting allocations in tests and benchmarks; set it while no matrices are being allocated.
+         */
+        static void (*allocation_hook)(std::size_t bytes);
+
+        /*!\brief Allocate an uninitialized matrix for n elements.
+         * \param[in] n The number of elements.
+         */
+        explicit CondensedDistanceMatrix(std::size_t n) :
+            n_ {n}, data_ {allocate(n*(n-1)/2)}
+        {};
+
+        /*!\brief Copy the distances of a list of clusterables into one buffer.
+         * \param[in] items Clusterables providing distances() to their following items.
+         */
+        template <typename Clusterable>
+        explicit CondensedDistanceMatrix(const std::list<Clusterable> &items) :
+            CondensedDistanceMatrix(items.size())
+        {
+            auto destination = data_.get();
+            for (const auto &item : items)
+            {
+                destination = std::copy(std::begin(item.distances()), std::end(item.distances()), destination);
+            }
+        };
+
+        /*!\brief Wrap memory that is owned elsewhere, e.g. a mapped file.
+         * \param[in] n The number of elements.
+         * \param[in] data Pointer to n*(n-1)/2 distances.
+         * \param[in] release Called with data when the matrix is destroyed.
+         */
+        CondensedDistanceMatrix(std::size_t n, DistanceType * data, std::function<void(DistanceType*)> release) :
+            n_ {n}, data_ {data, std::move(release)}
+        {};
+
+        CondensedDistanceMatrix(CondensedDistanceMatrix &&other)            = default;
+        CondensedDistanceMatrix &operator=(CondensedDistanceMatrix &&other) = default;
+
+        /*!\brief The number of elements, i.e. rows of the full matrix. */
+        std::size_t size() const { return n_; };
+
+        /*!\brief The number of stored distances, n*(n-1)/2. */
+        std::size_t length() const { return n_ < 2 ? 0 : n_*(n_-1)/2; };
+
+        /*!\brief Distance between elements i and j, i != j, in any order. */
+        DistanceType &operator()(std::size_t i, std::size_t j)
+        {
+            return i < j ? data_.get()[index(i, j)] : data_.get()[index(j, i)];
+        };
+
+        /*!\brief Distance between elements i and j, i != j, in any order. */
+        const DistanceType &operator()(std::size_t i, std::size_t j) const
+        {
+            return i < j ? data_.get()[index(i, j)] : data_.get()[index(j, i)];
+        };
+
+        /*!\brief Pointer to the distances from i to i+1, ..., n-1. */
+        DistanceType * row(std::size_t i) { return data_.get() + index(i, i+1); };
+
+        /*!\brief Pointer to the distances from i to i+1, ..., n-1. */
+        const DistanceType * row(std::size_t i) const { return data_.get() + index(i, i+1); };
+
+        /*!\brief The first stored distance. */
+        DistanceType * data() { return data_.get(); };
+
+        /*!\brief The first stored distance. */
+        const DistanceType * data() const { return data_.get(); };
+
+        /*!\brief Position of the distance between i < j in the buffer. */
+        std::size_t index(std::size_t i, std::size_t j) const
+        {
+            return i*(2*n_-i-1)/2 + j-i-1;
+        };
+
+    private:
+        typedef std::unique_ptr < DistanceType, std::function < void(DistanceType*)>> Storage;
+
+        /*!\brief Cache-line aligned allocation, freed with std::free. */
+        static Storage allocate(std::size_t length)
+        {
+            const auto bytes  = std::max<std::size_t>(length, 1)*sizeof(DistanceType);
+            void     * memory = nullptr;
+            if (allocation_hook != nullptr)
+            {
+                allocation_hook(bytes);
+            }
+            if (posix_memalign(&memory, alignment, bytes) != 0)
+            {
+                throw std::bad_alloc();
+            }
+            return Storage(static_cast<DistanceType*>(memory), [](DistanceType * p){ std::free(p); });
+        }
+
+        std::size_t n_;    //< number of elements
+        Storage     data_; //< n*(n-1)/2 distances, row after row
+};
+
+template <typename DistanceType>
+void (*CondensedDistanceMatrix<DistanceType>::allocation_hook)(std::size_t) = nullptr;
+
+#endif /* end of include guard: CONDENSED_DISTANCE_MATRIX_H_ */
@@ -0,0 +1,657 @@
+/*
+ * dendrogramio.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef DENDROGRAM_IO_H_
+#define DENDROGRAM_IO_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compactdistance.h"
+#include "distancematrixfile.h"
+#include "flatclusters.h"
+#include "leafordering.h"
+#include "linkage.h"
+
+/*! \brief Output buffer in front of a file descriptor or a std::ostream.
+ *
+ * Numbers are formatted into the buffer itself, so writing a dendrogram allocates nothing per node.
+ */
+class DendrogramOutput
+{
+    public:
+        /*!\brief Write to an open file descriptor, which stays open. */
+        explicit DendrogramOutput(int file, std::size_t capacity = 1 << 16) :
+            file_ {file}, stream_ {nullptr}, buffer_(capacity < minimum_capacity ? minimum_capacity : capacity), used_ {0}
+        {};
+
+        /*!\brief Write to a stream. */
+        explicit DendrogramOutput(std::ostream &stream, std::size_t capacity = 1 << 16) :
+            file_ {-1}, stream_ {&stream}, buffer_(capacity < minimum_capacity ? minimum_capacity : capacity), used_ {0}
+        {};
+
+        DendrogramOutput(const DendrogramOutput &)            = delete;
+        DendrogramOutput &operator=(const DendrogramOutput &) = delete;
+
+        /*!\brief Writes what is left in the buffer; call flush() to learn about errors. */
+        ~DendrogramOutput()
+        {
+            try
+            {
+                flush();
+            }
+            catch (const std::runtime_error &)
+            {
+            }
+        };
+
+        void put(char c)
+        {
+            reserve(1);
+            buffer_[used_++] = c;
+        };
+
+        void write(const char * text)
+        {
+            write(text, std::strlen(text));
+        };
+
+        void write(const void * data, std::size_t bytes)
+        {
+            auto next = static_cast<const char*>(data);
+            while (bytes > 0)
+            {
+                if (used_ == buffer_.size())
+                {
+                    flush();
+                }
+                const auto chunk = std::min(bytes, buffer_.size() - used_);
+                std::memcpy(buffer_.data() + used_, next, chunk);
+                used_ += chunk;
+                next  += chunk;
+                bytes -= chunk;
+            }
+        };
+
+        /*!\brief Write an unsigned integer in decimal. */
+        void number(std::uint64_t value)
+        {
+            char        digits[20];
+            std::size_t count = 0;
+            do
+            {
+                digits[count++] = static_cast<char>('0' + value % 10);
+                value          /= 10;
+            }
+            while (value > 0);
+            reserve(count);
+            while (count > 0)
+            {
+                buffer_[used_++] = digits[--count];
+            }
+        };
+
+        /*!\brief Write a floating point number with enough digits to read it back exactly.
+         * \param[in] digits Significant digits, max_digits10 of the type the value came from.
+         */
+        void number(double value, int digits)
+        {
+            reserve(number_capacity);
+            const auto count = std::snprintf(buffer_.data() + used_, number_capacity, "%.*g", digits, value);
+            used_ += static_cast<std::size_t>(count);
+        };
+
+        /*!\brief Hand the buffered bytes to the file descriptor or stream.
+         * \throws std::runtime_error if they cannot be written.
+         */
+        void flush()
+        {
+            std::size_t done = 0;
+            if (stream_ != nullptr)
+            {
+                if (used_ > 0 && !stream_->write(buffer_.data(), used_))
+                {
+                    used_ = 0;
+                    throw std::runtime_error("Cannot write dendrogram to stream.");
+                }
+                done = used_;
+            }
+            while (done < used_)
+            {
+                const auto written = ::write(file_, buffer_.data() + done, used_ - done);
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (written <= 0)
+                {
+                    used_ = 0;
+                    throw std::runtime_error("Cannot write dendrogram to file descriptor " + std::to_string(file_));
+                }
+                done += static_cast<std::size_t>(written);
+            }
+            used_ = 0;
+        };
+
+    private:
+        static constexpr std::size_t number_capacity  = 32; //< room for any formatted number
+        static constexpr std::size_t minimum_capacity = 64; //< so that a number always fits after a flush
+
+        void reserve(std::size_t bytes)
+        {
+            if (used_ + bytes > buffer_.size())
+            {
+                flush();
+            }
+        };
+
+        int                file_;   //< file descriptor, if not writing to a stream
+        std::ostream     * stream_; //< stream, if any
+        std::vector<char>  buffer_; //< bytes not yet written
+        std::size_t        used_;   //< number of bytes in the buffer
+};
+
+/*! \brief Binary file format for linkages, readable without parsing by MappedLinkage.
+ *
+ * All numbers are stored in the byte order of the writing machine, in columns:
+ *  - this header,
+ *  - left branch, right branch and size of every merge, each column as merges uint64,
+ *  - the leaves in dendrogram order (see LeafOrdering) as leaves uint64,
+ *  - the distance of every merge in the stored precision.
+ */
+struct LinkageFileHeader
+{
+    char          magic[8];  //< "CLUSTLK" and a terminating zero
+    std::uint32_t version;   //< format version, currently 1
+    std::uint32_t precision; //< a DistancePrecision
+    std::uint64_t leaves;    //< number of leaves
+    std::uint64_t merges;    //< number of merges
+};
+
+/*! \brief Header of a linkage file. */
+template <typename DistanceType>
+LinkageFileHeader linkage_file_header(std::uint64_t leaves, std::uint64_t merges)
+{
+    LinkageFileHeader header {};
+    std::strncpy(header.magic, "CLUSTLK", sizeof(header.magic));
+    header.version   = 1;
+    header.precision = static_cast<std::uint32_t>(distance_precision<DistanceType>::value);
+    header.leaves    = leaves;
+    header.merges    = merges;
+    return header;
+}
+
+/*! \brief Write a linkage in the binary format of LinkageFileHeader. */
+template <typename DistanceType>
+void write_linkage(const Linkage<DistanceType> &linkage, DendrogramOutput &out)
+{
+    const auto header = linkage_file_header<DistanceType>(linkage.leaves(), linkage.size());
+    out.write(&header, sizeof(header));
+    for (const auto &step : linkage)
+    {
+        const std::uint64_t left = step.left;
+        out.write(&left, sizeof(left));
+    }
+    for (const auto &step : linkage)
+    {
+        const std::uint64_t right = step.right;
+        out.write(&right, sizeof(right));
+    }
+    for (const auto &step : linkage)
+    {
+        const std::uint64_t size = step.size;
+        out.write(&size, sizeof(size));
+    }
+    const LeafOrdering ordering {linkage};
+    for (auto leaf : ordering.order())
+    {
+        const std::uint64_t stored = leaf;
+        out.write(&stored, sizeof(stored));
+    }
+    for (const auto &step : linkage)
+    {
+        out.write(&step.distance, sizeof(step.distance));
+    }
+}
+
+/*! \brief Write a linkage to a file in the binary format of LinkageFileHeader.
+ * \throws std::runtime_error if the file cannot be written.
+ */
+template <typename DistanceType>
+void write_linkage(const Linkage<DistanceType> &linkage, const std::string &filename)
+{
+    auto file = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+    {
+        throw std::runtime_error("Cannot open linkage file " + filename + " for writing.");
+    }
+    try
+    {
+        DendrogramOutput out {file};
+        write_linkage(linkage, out);
+        out.flush();
+    }
+    catch (const std::runtime_error &)
+    {
+        close(file);
+        throw std::runtime_error("Cannot write linkage file " + filename);
+    }
+    if (close(file) != 0)
+    {
+        throw std::runtime_error("Cannot write linkage file " + filename);
+    }
+}
+
+namespace detail
+{
+
+/*! \brief Number of digits that make a written distance read back exactly. */
+template <typename DistanceType>
+int distance_digits()
+{
+    return std::numeric_limits<typename distance_arithmetic<DistanceType>::type>::max_digits10;
+}
+
+/*! \brief Write a leaf name as a Newick label, quoted if it contains characters with a meaning in Newick. */
+inline void write_newick_label(const std::string &name, DendrogramOutput &out)
+{
+    if (name.find_first_of(" \t\r\n()[]':;,_") == std::string::npos && !name.empty())
+    {
+        out.write(name.data(), name.size());
+        return;
+    }
+    out.put('\'');
+    for (auto c : name)
+    {
+        if (c == '\'')
+        {
+            out.put('\'');
+        }
+        out.put(c);
+    }
+    out.put('\'');
+}
+
+/*! \brief Write a string as a JSON string literal. */
+inline void write_json_string(const std::string &text, DendrogramOutput &out)
+{
+    static const char hex[] = "0123456789abcdef";
+    out.put('"');
+    for (auto c : text)
+    {
+        const auto code = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\')
+        {
+            out.put('\\');
+            out.put(c);
+        }
+        else if (code < 0x20)
+        {
+            out.write("\\u00", 4);
+            out.put(hex[code >> 4]);
+            out.put(hex[code & 15]);
+        }
+        else
+        {
+            out.put(c);
+        }
+    }
+    out.put('"');
+}
+
+/*! \brief Clusters that are not merged any further, in id order. */
+template <typename DistanceType>
+std::vector<std::size_t> linkage_roots(const Linkage<DistanceType> &linkage)
+{
+    std::vector<char> is_root(linkage.leaves() + linkage.size(), 1);
+    for (const auto &step : linkage)
+    {
+        is_root[step.left]  = 0;
+        is_root[step.right] = 0;
+    }
+    std::vector<std::size_t> roots {};
+    for (std::size_t id = 0; id < is_root.size(); ++id)
+    {
+        if (is_root[id])
+        {
+            roots.push_back(id);
+        }
+    }
+    return roots;
+}
+
+/*! \brief What remains to be written of a dendrogram, kept on an explicit stack instead of recursing. */
+struct DendrogramTask
+{
+    enum Kind { open, separate, close } kind; //< write a cluster, a separator between branches, or the end of a cluster
+    std::size_t id;                           //< the cluster
+};
+
+} // namespace detail
+
+/*! \brief Write the dendrogram in Newick format, one tree per line ending in a semicolon.
+ *
+ * Branch lengths are differences of Linkage::heights, so they are never negative, also for centroid and median.
+ * Branches into a merge at an infinite distance, as condensed_linkage makes of disconnected input, have no length,
+ * which Newick allows. An incomplete linkage gives one tree per cluster that is left.
+ *
+ * \param[in] linkage The merges of the clustering.
+ * \param[in] out Where to write to.
+ * \param[in] names If not null, the label of each leaf; leaves are labelled by their id otherwise.
+ */
+template <typename DistanceType>
+void write_newick(const Linkage<DistanceType> &linkage, DendrogramOutput &out, const std::vector<std::string> * names = nullptr)
+{
+    typedef detail::DendrogramTask Task;
+    const auto n       = linkage.leaves();
+    const auto heights = linkage.heights();
+    const auto digits  = detail::distance_digits<DistanceType>();
+    auto       height  = [n, &heights](std::size_t id){ return id < n ? 0.0 : static_cast<double>(heights[id-n]); };
+
+    std::vector<std::size_t> parent(n + linkage.size(), n + linkage.size());
+    for (std::size_t k = 0; k < linkage.size(); ++k)
+    {
+        parent[linkage[k].left]  = n + k;
+        parent[linkage[k].right] = n + k;
+    }
+
+    std::vector<Task> tasks {};
+    tasks.reserve(n + 2*linkage.size());
+    for (auto root : detail::linkage_roots(linkage))
+    {
+        tasks.push_back({Task::open, root});
+        while (!tasks.empty())
+        {
+            const auto task = tasks.back();
+            tasks.pop_back();
+            if (task.kind == Task::separate)
+            {
+                out.put(',');
+                continue;
+            }
+            if (task.kind == Task::open && task.id >= n)
+            {
+                const auto &step = linkage[task.id-n];
+                out.put('(');
+                tasks.push_back({Task::close, task.id});
+                tasks.push_back({Task::open, step.right});
+                tasks.push_back({Task::separate, task.id});
+                tasks.push_back({Task::open, step.left});
+                continue;
+            }
+            if (task.kind == Task::open)
+            {
+                if (names != nullptr)
+                {
+                    detail::write_newick_label((*names)[task.id], out);
+                }
+                else
+                {
+                    out.number(task.id);
+                }
+            }
+            else
+            {
+                out.put(')');
+            }
+            const auto length = task.id != root ? height(parent[task.id]) - height(task.id) : 0.0;
+            if (task.id != root && std::isfinite(length))
+            {
+                out.put(':');
+                out.number(length, digits);
+            }
+        }
+        out.write(";\n", 2);
+    }
+}
+
+/*! \brief Write the dendrogram as nested JSON objects.
+ *
+ * The result is an object with the number of leaves and the list of trees, a single one for a complete linkage.
+ * Merged clusters have their merge distance, null if it is not finite, their size and two children;
+ * leaves have their id, their size of one and, if given, their name:
+ *
+ *     {"leaves": 3, "trees": [{"merge-distance": 2, "size": 3, "children": [{"id": 2, "size": 1}, {...}]}]}
+ *
+ * \param[in] linkage The merges of the clustering.
+ * \param[in] out Where to write to.
+ * \param[in] names If not null, the name of each leaf.
+ */
+template <typename DistanceType>
+void write_json(const Linkage<DistanceType> &linkage, DendrogramOutput &out, const std::vector<std::string> * names = nullptr)
+{
+    typedef detail::DendrogramTask Task;
+    const auto n      = linkage.leaves();
+    const auto digits = detail::distance_digits<DistanceType>();
+
+    out.write("{\"leaves\": ");
+    out.number(n);
+    out.write(", \"trees\": [");
+    std::vector<Task> tasks {};
+    tasks.reserve(n + 2*linkage.size() + 1);
+    const auto roots = detail::linkage_roots(linkage);
+    for (auto root = roots.rbegin(); root != roots.rend(); ++root)
+    {
+        tasks.push_back({Task::open, *root});
+        if (root + 1 != roots.rend())
+        {
+            tasks.push_back({Task::separate, *root});
+        }
+    }
+    while (!tasks.empty())
+    {
+        const auto task = tasks.back();
+        tasks.pop_back();
+        if (task.kind == Task::separate)
+        {
+            out.write(", ", 2);
+        }
+        else if (task.kind == Task::close)
+        {
+            out.write("]}", 2);
+        }
+        else if (task.id < n)
+        {
+            out.write("{\"id\": ");
+            out.number(task.id);
+            out.write(", \"size\": 1");
+            if (names != nullptr)
+            {
+                out.write(", \"name\": ");
+                detail::write_json_string((*names)[task.id], out);
+            }
+            out.put('}');
+        }
+        else
+        {
+            const auto &step = linkage[task.id-n];
+            out.write("{\"merge-distance\": ");
+            if (std::isfinite(static_cast<double>(step.distance)))
+            {
+                out.number(static_cast<double>(step.distance), digits);
+            }
+            else
+            {
+                out.write("null");
+            }
+            out.write(", \"size\": ");
+            out.number(step.size);
+            out.write(", \"children\": [");
+            tasks.push_back({Task::close, task.id});
+            tasks.push_back({Task::open, step.right});
+            tasks.push_back({Task::separate, task.id});
+            tasks.push_back({Task::open, step.left});
+        }
+    }
+    out.write("]}\n", 3);
+}
+
+/*! \brief A linkage file mapped into memory, read in place without copying.
+ *
+ * Has the interface of Linkage that LinkageCut needs, so that flat clusters can be cut from a saved
+ * dendrogram straight away; linkage() copies the merges into a Linkage for everything else.
+ */
+template <typename DistanceType>
+class MappedLinkage
+{
+    public:
+        /*!\brief Map a file written by write_linkage.
+         * \throws std::runtime_error if the file cannot be mapped or does not hold a linkage of DistanceType.
+         */
+        explicit MappedLinkage(const std::string &filename) : mapping_ {nullptr}, length_ {0}
+        {
+            auto file = open(filename.c_str(), O_RDONLY);
+            if (file < 0)
+            {
+                throw std::runtime_error("Cannot open linkage file " + filename);
+            }
+            struct stat status;
+            if (fstat(file, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(LinkageFileHeader))
+            {
+                close(file);
+                throw std::runtime_error("Linkage file " + filename + " is too short.");
+            }
+            length_  = status.st_size;
+            mapping_ = mmap(nullptr, length_, PROT_READ, MAP_SHARED, file, 0);
+            close(file);
+            if (mapping_ == MAP_FAILED)
+            {
+                mapping_ = nullptr;
+                throw std::runtime_error("Cannot map linkage file " + filename);
+            }
+
+            std::memcpy(&header_, mapping_, sizeof(header_));
+            const auto expected = linkage_file_header<DistanceType>(header_.leaves, header_.merges);
+            if (std::strncmp(header_.magic, expected.magic, sizeof(header_.magic)) != 0 || header_.version != expected.version
+                || header_.precision != expected.precision || (header_.merges > 0 && header_.merges >= header_.leaves)
+                || length_ < sizeof(header_) + (3*header_.merges + header_.leaves)*sizeof(std::uint64_t) + header_.merges*sizeof(DistanceType))
+            {
+                munmap(mapping_, length_);
+                throw std::runtime_error("File " + filename + " does not hold a linkage of the requested precision.");
+            }
+            const auto columns = reinterpret_cast<const std::uint64_t*>(static_cast<const char*>(mapping_) + sizeof(header_));
+            left_      = columns;
+            right_     = left_ + header_.merges;
+            size_      = right_ + header_.merges;
+            order_     = size_ + header_.merges;
+            distances_ = reinterpret_cast<const DistanceType*>(order_ + header_.leaves);
+            for (std::size_t k = 0; k < size(); ++k)
+            {
+                if (left_[k] >= leaves() + k || right_[k] >= leaves() + k)
+                {
+                    munmap(mapping_, length_);
+                    throw std::runtime_error("Linkage file " + filename + " merges clusters before they exist.");
+                }
+            }
+        };
+
+        MappedLinkage(MappedLinkage &&other) noexcept : header_ (other.header_), mapping_ {other.mapping_}, length_ {other.length_},
+            left_ {other.left_}, right_ {other.right_}, size_ {other.size_}, order_ {other.order_}, distances_ {other.distances_}
+        {
+            other.mapping_ = nullptr;
+        };
+
+        MappedLinkage(const MappedLinkage &)            = delete;
+        MappedLinkage &operator=(const MappedLinkage &) = delete;
+        MappedLinkage &operator=(MappedLinkage &&)      = delete;
+
+        ~MappedLinkage()
+        {
+            if (mapping_ != nullptr)
+            {
+                munmap(mapping_, length_);
+            }
+        };
+
+        /*!\brief The number of leaves. */
+        std::size_t leaves() const { return header_.leaves; };
+
+        /*!\brief The number of merges. */
+        std::size_t size() const { return header_.merges; };
+
+        /*!\brief The k-th merge. */
+        LinkageStep<DistanceType> operator[](std::size_t k) const
+        {
+            return {static_cast<std::size_t>(left_[k]), static_cast<std::size_t>(right_[k]), distances_[k], static_cast<std::size_t>(size_[k])};
+        };
+
+        /*!\brief The merge distances in place. */
+        const DistanceType * distances() const { return distances_; };
+
+        /*!\brief The leaves in dendrogram order in place, as LeafOrdering::order. */
+        const std::uint64_t * order() const { return order_; };
+
+        /*!\brief As Linkage::heights. */
+        std::vector<DistanceType> heights() const
+        {
+            std::vector<DistanceType> height(size());
+            for (std::size_t k = 0; k < size(); ++k)
+            {
+                height[k] = distances_[k];
+                for (auto branch : {left_[k], right_[k]})
+                {
+                    if (branch >= leaves() && height[k] < height[branch-leaves()])
+                    {
+                        height[k] = height[branch-leaves()];
+                    }
+                }
+            }
+            return height;
+        };
+
+        /*!\brief Copy the merges into a Linkage. */
+        Linkage<DistanceType> linkage() const
+        {
+            Linkage<DistanceType> result {leaves()};
+            for (std::size_t k = 0; k < size(); ++k)
+            {
+                result.push_back((*this)[k]);
+            }
+            return result;
+        };
+
+    private:
+        LinkageFileHeader     header_;    //< the header of the file
+        void                * mapping_;   //< the mapped file
+        std::size_t           length_;    //< length of the mapping
+        const std::uint64_t * left_;      //< left branch column
+        const std::uint64_t * right_;     //< right branch column
+        const std::uint64_t * size_;      //< merged size column
+        const std::uint64_t * order_;     //< leaf order
+        const DistanceType  * distances_; //< merge distance column
+};
+
+/*! \brief Flat clusters from cutting a mapped dendrogram at a distance, as cut_at_distance for a Linkage. */
+template <typename DistanceType>
+std::vector<std::size_t> cut_at_distance(const MappedLinkage<DistanceType> &linkage, DistanceType distance)
+{
+    LinkageCut < DistanceType, MappedLinkage < DistanceType>> cut {linkage};
+    cut.merge_to_distance(distance);
+    return cut.labels();
+}
+
+/*! \brief Flat clusters from cutting a mapped dendrogram into count clusters, as cut_into for a Linkage. */
+template <typename DistanceType>
+std::vector<std::size_t> cut_into(const MappedLinkage<DistanceType> &linkage, std::size_t count)
+{
+    LinkageCut < DistanceType, MappedLinkage < DistanceType>> cut {linkage};
+    cut.merge_to_count(count);
+    return cut.labels();
+}
+
+#endif /* end of include guard: DENDROGRAM_IO_H_ */
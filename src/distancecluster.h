@@ -6,26 +6,30 @@
 #include <algorithm>
 #include <memory>
 
-class DistanceCluster
+/*! \brief Cluster elements with the distances to the following clusters.
+ * \tparam Distance Type in which distances are stored, float or a 16 bit type from compactdistance.h.
+ */
+template <typename Distance>
+class BasicDistanceCluster
 {
 
 	public:
 		/*!\brief Type that describes the mutual distance between clusters.*/
-		typedef float DistanceType;
+		typedef Distance DistanceType;
 
 		/*!\brief Constructor that copies the elements for clustering.
 		 * \param[in] dist_to_following provides distances to the following clusters to be copied.
 		 * \param[in] elements provides cluster elements to be copied.
 		 * \param[in] merge_d If the cluster is created from a merger, the merge distance at which the cluster was created.
 		 */
-		DistanceCluster(const std::vector<DistanceType> & dist_to_following, const std::vector<size_t> & elements, DistanceType merge_d=0);
+		BasicDistanceCluster(const std::vector<DistanceType> & dist_to_following, const std::vector<size_t> & elements, DistanceType merge_d=DistanceType(0));
 
 		/*!\brief Constructor that copies the elements for clustering.
 		 * \param[in] dist_to_following provides distances to the following clusters to be copied.
 		 * \param[in] elements provides cluster elements to be copied.
 		 * \param[in] merge_d If the cluster is created from a merger, the merge distance at which the cluster was created.
 		 */
-		DistanceCluster(std::vector<DistanceType> && dist_to_following, std::vector<size_t> && elements, DistanceType merge_d=0);
+		BasicDistanceCluster(std::vector<DistanceType> && dist_to_following, std::vector<size_t> && elements, DistanceType merge_d=DistanceType(0));
 
 		/*!\brief The number of elements in the cluster. */
 		std::size_t size() const;
@@ -38,7 +42,9 @@ class DistanceCluster
 		 *
 		 * \result The caller owns the merged clusters via a unique_ptr.
 		 */
-		std::unique_ptr<DistanceCluster> merger(const DistanceCluster & other, std::vector<DistanceType> dist_to_following, DistanceType merge_d);
+		std::unique_ptr<BasicDistanceCluster> merger(const BasicDistanceCluster & other, std::vector<DistanceType> dist_to_following, DistanceType merge_d);
+		/*!\brief The distance at which this cluster was merged, zero for a leaf. */
+		DistanceType merge_distance() const;
 		/*!\brief Observe the distances to following clusters via a const ref. */
 		const std::vector<DistanceType> & distances() const;
 		/*!\brief Delete a distances to a following cluster */
@@ -55,4 +61,85 @@ class DistanceCluster
 		std::vector<DistanceType> dist_to_following_; //< distance to the follow up elements in the cluster
 		DistanceType merge_d_; //< distance at which this cluster was created
 };
+
+template <typename Distance>
+BasicDistanceCluster<Distance>::BasicDistanceCluster(const std::vector<DistanceType> &dist_to_following, const std::vector<size_t> &elements, DistanceType merge_d)
+    : elements_(elements), dist_to_following_(dist_to_following), merge_d_(merge_d)
+{}
+
+template <typename Distance>
+BasicDistanceCluster<Distance>::
+    BasicDistanceCluster(std::vector<DistanceType> &&dist_to_following, std::vector<size_t> &&elements, DistanceType merge_d)
+    : elements_ {std::move(elements)}, dist_to_following_ {
+    std::move(dist_to_following)
+}, merge_d_(merge_d)
+{
+}
+
+template <typename Distance>
+std::size_t
+BasicDistanceCluster<Distance>::size() const
+{
+    return elements_.size();
+}
+
+template <typename Distance>
+std::unique_ptr < BasicDistanceCluster < Distance>>
+BasicDistanceCluster<Distance>::merger(const BasicDistanceCluster &other, std::vector<DistanceType> dist_to_following, DistanceType merge_d)
+{
+    std::vector<size_t> elements(elements_);
+    elements.insert(elements.end(), other.elements_.begin(), other.elements_.end());
+    return std::unique_ptr<BasicDistanceCluster>(new BasicDistanceCluster(dist_to_following, elements, merge_d));
+}
+
+template <typename Distance>
+Distance BasicDistanceCluster<Distance>::merge_distance() const
+{
+    return merge_d_;
+}
+
+template <typename Distance>
+const std::vector<Distance> &BasicDistanceCluster<Distance>::distances() const
+{
+    return dist_to_following_;
+}
+
+template <typename Distance>
+void BasicDistanceCluster<Distance>::deleteDistance(size_t index)
+{
+    dist_to_following_.erase(dist_to_following_.begin()+index);
+}
+
+template <typename Distance>
+const std::vector<size_t> &
+BasicDistanceCluster<Distance>::elements() const
+{
+    return elements_;
+}
+
+template <typename Distance>
+std::string BasicDistanceCluster<Distance>::print() const
+{
+    std::string result = "{\n\t \"merge-distance\": " + std::to_string(static_cast<float>(merge_d_)) + ",\n"
+        "\t \"size\" : " + std::to_string(elements_.size()) + ",\n" +
+        "\t \"elements\" :[";
+    /* append in place, instead of building ever longer strings, to stay linear in the number of elements */
+    result.reserve(result.size() + 8*elements_.size() + 4);
+    for (auto element = begin(elements_); element != end(elements_); ++element)
+    {
+        if (element != begin(elements_))
+        {
+            result += ',';
+        }
+        result += std::to_string(*element);
+    }
+    result += "]\n}\n";
+    return result;
+}
+
+/*! \brief Clusters with single precision distances, compiled once in distancecluster.cpp. */
+typedef BasicDistanceCluster<float> DistanceCluster;
+
+extern template class BasicDistanceCluster<float>;
+
 #endif /* end of include guard: DISTANCE_CLUSTER_DATA_H_ */
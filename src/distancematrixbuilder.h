@@ -0,0 +1,533 @@
+/*
+ * distancematrixbuilder.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef DISTANCE_MATRIX_BUILDER_H_
+#define DISTANCE_MATRIX_BUILDER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "condenseddistancematrix.h"
+#include "distancematrixfile.h"
+#include "threadpool.h"
+
+/*! \brief n points with d coordinates each, stored point after point.
+ *
+ * Either a view of coordinates owned elsewhere, an owned vector, or a mapped file.
+ */
+template <typename CoordinateType>
+class Coordinates
+{
+    public:
+        /*!\brief View of n*d coordinates, released by release when this is destroyed. */
+        Coordinates(std::size_t n, std::size_t d, const CoordinateType * data, std::function<void(const CoordinateType*)> release = [](const CoordinateType*){}) :
+            n_ {n}, d_ {d}, data_ {data, std::move(release)}
+        {};
+
+        /*!\brief Take over n points of d coordinates; values.size() must be a multiple of d. */
+        Coordinates(std::vector<CoordinateType> values, std::size_t d) :
+            n_ {d > 0 ? values.size()/d : 0}, d_ {d}, owned_ {std::move(values)}, data_ {owned_.data(), [](const CoordinateType*){}}
+        {};
+
+        Coordinates(Coordinates &&other)            = default;
+        Coordinates &operator=(Coordinates &&other) = default;
+
+        /*!\brief The number of points. */
+        std::size_t size() const { return n_; };
+
+        /*!\brief The number of coordinates per point. */
+        std::size_t dimension() const { return d_; };
+
+        /*!\brief The coordinates of point i. */
+        const CoordinateType * point(std::size_t i) const { return data_.get() + i*d_; };
+
+    private:
+        std::size_t                 n_;     //< number of points
+        std::size_t                 d_;     //< coordinates per point
+        std::vector<CoordinateType> owned_; //< the coordinates, if owned
+        std::unique_ptr<const CoordinateType, std::function<void(const CoordinateType*)>> data_; //< n*d coordinates
+};
+
+/*! \brief Map a file of raw coordinates into memory without reading it.
+ *
+ * The file holds n*d values of CoordinateType in the byte order of the machine, point after point,
+ * as written by numpy.ndarray.tofile; n follows from the file size.
+ *
+ * \param[in] filename The coordinate file.
+ * \param[in] dimension The number of coordinates per point.
+ * \throws std::runtime_error if the file cannot be mapped or its size is no multiple of a point.
+ */
+template <typename CoordinateType>
+Coordinates<CoordinateType> map_coordinates(const std::string &filename, std::size_t dimension)
+{
+    auto file = open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        throw std::runtime_error("Cannot open coordinate file " + filename);
+    }
+    struct stat status;
+    const auto  point_bytes = dimension*sizeof(CoordinateType);
+    if (fstat(file, &status) != 0 || point_bytes == 0 || status.st_size == 0 || status.st_size % point_bytes != 0)
+    {
+        close(file);
+        throw std::runtime_error("Coordinate file " + filename + " does not hold points of dimension " + std::to_string(dimension));
+    }
+    const std::size_t length  = status.st_size;
+    auto              mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Cannot map coordinate file " + filename);
+    }
+    return Coordinates<CoordinateType>(length/point_bytes, dimension, static_cast<const CoordinateType*>(mapping), [mapping, length](const CoordinateType*){ munmap(mapping, length); });
+}
+
+/*! \brief Squared Euclidean distance of two vectors. */
+template <typename CoordinateType>
+CoordinateType squared_distance(const CoordinateType * a, const CoordinateType * b, std::size_t length)
+{
+    CoordinateType result = 0;
+    for (std::size_t k = 0; k < length; ++k)
+    {
+        const auto difference = a[k] - b[k];
+        result += difference*difference;
+    }
+    return result;
+}
+
+/*! \brief Inner product of two vectors. */
+template <typename CoordinateType>
+CoordinateType dot_product(const CoordinateType * a, const CoordinateType * b, std::size_t length)
+{
+    CoordinateType result = 0;
+    for (std::size_t k = 0; k < length; ++k)
+    {
+        result += a[k]*b[k];
+    }
+    return result;
+}
+
+#if defined(__AVX__) || defined(__SSE__)
+/* Single precision kernels with AVX or SSE; the remainder of a vector is handled by the generic kernels. */
+
+inline float horizontal_sum(__m128 sums)
+{
+    sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+    sums = _mm_add_ss(sums, _mm_shuffle_ps(sums, sums, 1));
+    return _mm_cvtss_f32(sums);
+}
+
+inline float squared_distance(const float * a, const float * b, std::size_t length)
+{
+    std::size_t k    = 0;
+    auto        sums = _mm_setzero_ps();
+#if defined(__AVX__)
+    if (length >= 8)
+    {
+        auto wide_sums = _mm256_setzero_ps();
+        for (; k + 8 <= length; k += 8)
+        {
+            const auto difference = _mm256_sub_ps(_mm256_loadu_ps(a + k), _mm256_loadu_ps(b + k));
+            wide_sums = _mm256_add_ps(wide_sums, _mm256_mul_ps(difference, difference));
+        }
+        sums = _mm_add_ps(_mm256_castps256_ps128(wide_sums), _mm256_extractf128_ps(wide_sums, 1));
+    }
+#endif
+    for (; k + 4 <= length; k += 4)
+    {
+        const auto difference = _mm_sub_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k));
+        sums = _mm_add_ps(sums, _mm_mul_ps(difference, difference));
+    }
+    return horizontal_sum(sums) + squared_distance<float>(a + k, b + k, length - k);
+}
+
+inline float dot_product(const float * a, const float * b, std::size_t length)
+{
+    std::size_t k    = 0;
+    auto        sums = _mm_setzero_ps();
+#if defined(__AVX__)
+    if (length >= 8)
+    {
+        auto wide_sums = _mm256_setzero_ps();
+        for (; k + 8 <= length; k += 8)
+        {
+            wide_sums = _mm256_add_ps(wide_sums, _mm256_mul_ps(_mm256_loadu_ps(a + k), _mm256_loadu_ps(b + k)));
+        }
+        sums = _mm_add_ps(_mm256_castps256_ps128(wide_sums), _mm256_extractf128_ps(wide_sums, 1));
+    }
+#endif
+    for (; k + 4 <= length; k += 4)
+    {
+        sums = _mm_add_ps(sums, _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+    }
+    return horizontal_sum(sums) + dot_product<float>(a + k, b + k, length - k);
+}
+#endif
+
+/*! \brief Euclidean distance between points i and j. */
+template <typename CoordinateType>
+class EuclideanDistance
+{
+    public:
+        explicit EuclideanDistance(const Coordinates<CoordinateType> &points) : points_ (points)
+        {};
+
+        CoordinateType operator()(std::size_t i, std::size_t j) const
+        {
+            return std::sqrt(squared_distance(points_.point(i), points_.point(j), points_.dimension()));
+        };
+
+    private:
+        const Coordinates<CoordinateType> &points_;
+};
+
+/*! \brief Squared Euclidean distance between points i and j, as Ward's method on centroids expects. */
+template <typename CoordinateType>
+class SquaredEuclideanDistance
+{
+    public:
+        explicit SquaredEuclideanDistance(const Coordinates<CoordinateType> &points) : points_ (points)
+        {};
+
+        CoordinateType operator()(std::size_t i, std::size_t j) const
+        {
+            return squared_distance(points_.point(i), points_.point(j), points_.dimension());
+        };
+
+    private:
+        const Coordinates<CoordinateType> &points_;
+};
+
+/*! \brief One minus the cosine of the angle between points i and j; one if either is zero. */
+template <typename CoordinateType>
+class CosineDistance
+{
+    public:
+        /*!\brief Computes the norms of all points once. */
+        explicit CosineDistance(const Coordinates<CoordinateType> &points) : points_ (points), inverse_norms_(points.size())
+        {
+            for (std::size_t i = 0; i < points.size(); ++i)
+            {
+                const auto norm = std::sqrt(dot_product(points.point(i), points.point(i), points.dimension()));
+                inverse_norms_[i] = norm > 0 ? 1/norm : 0;
+            }
+        };
+
+        CoordinateType operator()(std::size_t i, std::size_t j) const
+        {
+            const auto cosine = dot_product(points_.point(i), points_.point(j), points_.dimension()) * inverse_norms_[i] * inverse_norms_[j];
+            return 1 - std::max(CoordinateType(-1), std::min(CoordinateType(1), cosine));
+        };
+
+    private:
+        const Coordinates<CoordinateType> &points_;
+        std::vector<CoordinateType>        inverse_norms_; //< one over the norm of each point, zero for zero
+};
+
+/*! \brief Root mean square deviation of structures i and j after optimal superposition.
+ *
+ * Every point is a structure of d/3 atoms with coordinates x, y, z after each other.
+ * The centers of the structures are found once and subtracted while reading the coordinates,
+ * so mapped coordinates are never copied; the optimal rotation is never computed, the RMSD follows from
+ * the largest eigenvalue of the 4x4 quaternion key matrix, found by Newton's method on its
+ * characteristic polynomial (Theobald's quaternion characteristic polynomial method).
+ * Computed in double precision.
+ */
+template <typename CoordinateType>
+class RmsdDistance
+{
+    public:
+        /*!\brief Find the center of all structures once.
+         * \throws std::invalid_argument if the dimension is no multiple of three.
+         */
+        explicit RmsdDistance(const Coordinates<CoordinateType> &points) :
+            points_ (points), atoms_ {points.dimension()/3}, centers_(3*points.size()), inner_products_(points.size())
+        {
+            if (points.dimension() % 3 != 0)
+            {
+                throw std::invalid_argument("RMSD needs three coordinates per atom.");
+            }
+            for (std::size_t i = 0; i < points.size(); ++i)
+            {
+                const auto structure = points.point(i);
+                double     center[3] = {0, 0, 0};
+                for (std::size_t atom = 0; atom < atoms_; ++atom)
+                {
+                    for (std::size_t x = 0; x < 3; ++x)
+                    {
+                        center[x] += structure[3*atom + x];
+                    }
+                }
+                for (std::size_t x = 0; x < 3; ++x)
+                {
+                    centers_[3*i + x] = center[x]/atoms_;
+                }
+                inner_products_[i] = 0;
+                for (std::size_t atom = 0; atom < atoms_; ++atom)
+                {
+                    for (std::size_t x = 0; x < 3; ++x)
+                    {
+                        const auto centered = structure[3*atom + x] - centers_[3*i + x];
+                        inner_products_[i] += centered*centered;
+                    }
+                }
+            }
+        };
+
+        CoordinateType operator()(std::size_t i, std::size_t j) const
+        {
+            if (atoms_ == 0)
+            {
+                return 0;
+            }
+            const auto structure_a = points_.point(i);
+            const auto structure_b = points_.point(j);
+            const auto center_a    = &centers_[3*i];
+            const auto center_b    = &centers_[3*j];
+
+            /* Correlation matrix of the two structures, centered atom by atom */
+            double s[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+            for (std::size_t atom = 0; atom < atoms_; ++atom)
+            {
+                double a[3], b[3];
+                for (std::size_t x = 0; x < 3; ++x)
+                {
+                    a[x] = structure_a[3*atom + x] - center_a[x];
+                    b[x] = structure_b[3*atom + x] - center_b[x];
+                }
+                for (std::size_t x = 0; x < 3; ++x)
+                {
+                    for (std::size_t y = 0; y < 3; ++y)
+                    {
+                        s[x][y] += a[x]*b[y];
+                    }
+                }
+            }
+            const auto sxx = s[0][0], sxy = s[0][1], sxz = s[0][2];
+            const auto syx = s[1][0], syy = s[1][1], syz = s[1][2];
+            const auto szx = s[2][0], szy = s[2][1], szz = s[2][2];
+
+            /* Coefficients of the characteristic polynomial x^4 + c2 x^2 + c1 x + c0 of the key matrix */
+            const auto sxx2 = sxx*sxx, syy2 = syy*syy, szz2 = szz*szz;
+            const auto sxy2 = sxy*sxy, syz2 = syz*syz, sxz2 = sxz*sxz;
+            const auto syx2 = syx*syx, szy2 = szy*szy, szx2 = szx*szx;
+
+            const auto syz_szy_minus_syy_szz2  = 2*(syz*szy - syy*szz);
+            const auto sxx2_syy2_szz2_syz2_szy2 = syy2 + szz2 - sxx2 + syz2 + szy2;
+            const auto sxy2_sxz2_syx2_szx2      = sxy2 + sxz2 - syx2 - szx2;
+
+            const auto sxz_plus_szx  = sxz + szx, syz_plus_szy = syz + szy, sxy_plus_syx = sxy + syx;
+            const auto syz_minus_szy = syz - szy, sxz_minus_szx = sxz - szx, sxy_minus_syx = sxy - syx;
+            const auto sxx_plus_syy  = sxx + syy, sxx_minus_syy = sxx - syy;
+
+            const auto c2 = -2*(sxx2 + syy2 + szz2 + sxy2 + syx2 + sxz2 + szx2 + syz2 + szy2);
+            const auto c1 = 8*(sxx*syz*szy + syy*szx*sxz + szz*sxy*syx - sxx*syy*szz - syz*szx*sxy - szy*syx*sxz);
+            const auto c0 = sxy2_sxz2_syx2_szx2*sxy2_sxz2_syx2_szx2
+                + (sxx2_syy2_szz2_syz2_szy2 + syz_szy_minus_syy_szz2)*(sxx2_syy2_szz2_syz2_szy2 - syz_szy_minus_syy_szz2)
+                + (-sxz_plus_szx*syz_minus_szy + sxy_minus_syx*(sxx_minus_syy - szz))*(-sxz_minus_szx*syz_plus_szy + sxy_minus_syx*(sxx_minus_syy + szz))
+                + (-sxz_plus_szx*syz_plus_szy - sxy_plus_syx*(sxx_plus_syy - szz))*(-sxz_minus_szx*syz_minus_szy - sxy_plus_syx*(sxx_plus_syy + szz))
+                + (sxy_plus_syx*syz_plus_szy + sxz_plus_szx*(sxx_minus_syy + szz))*(-sxy_minus_syx*syz_minus_szy + sxz_plus_szx*(sxx_plus_syy + szz))
+                + (sxy_plus_syx*syz_minus_szy + sxz_minus_szx*(sxx_minus_syy - szz))*(-sxy_minus_syx*syz_plus_szy + sxz_minus_szx*(sxx_plus_syy - szz));
+
+            /* The largest eigenvalue is at most (G_a + G_b)/2; Newton's method converges to it from above */
+            const auto e0         = (inner_products_[i] + inner_products_[j])/2;
+            auto       eigenvalue = e0;
+            for (int iteration = 0; iteration < 50; ++iteration)
+            {
+                const auto previous = eigenvalue;
+                const auto x2       = eigenvalue*eigenvalue;
+                const auto b2       = (x2 + c2)*eigenvalue;
+                const auto a2       = b2 + c1;
+                const auto slope    = 2*x2*eigenvalue + b2 + a2;
+                if (slope == 0)
+                {
+                    break;
+                }
+                eigenvalue -= (a2*eigenvalue + c0)/slope;
+                if (std::abs(eigenvalue - previous) <= std::abs(1e-11*eigenvalue))
+                {
+                    break;
+                }
+            }
+            return static_cast<CoordinateType>(std::sqrt(std::abs(2*(e0 - eigenvalue)/atoms_)));
+        };
+
+    private:
+        const Coordinates<CoordinateType> &points_;
+        std::size_t                        atoms_;          //< atoms per structure
+        std::vector<double>                centers_;        //< mean x, y, z of each structure
+        std::vector<double>                inner_products_; //< sum of squared centered coordinates of each structure
+};
+
+/*! \brief The built-in metrics of distance_matrix. */
+enum class Metric
+{
+    euclidean,
+    squared_euclidean,
+    cosine,
+    rmsd
+};
+
+/*! \brief Points per side of a tile, such that the points of two tiles stay in the first level cache. */
+template <typename CoordinateType>
+std::size_t tile_size(std::size_t dimension)
+{
+    const std::size_t cache_bytes = 16384;
+    return std::min<std::size_t>(256, std::max<std::size_t>(8, cache_bytes/(2*std::max<std::size_t>(dimension, 1)*sizeof(CoordinateType))));
+}
+
+/*! \brief The condensed distance matrix of n points under any metric.
+ *
+ * The upper triangle is split into square tiles of rows and columns whose points fit into cache together;
+ * tiles are dealt to the threads in turn, which balances the short rows at the bottom against the long ones at the top.
+ *
+ * \param[in] n The number of points.
+ * \param[in] metric Returns the distance of points i and j, called from several threads at once.
+ * \param[in] tile Points per side of a tile.
+ * \param[in] pool Threads that compute the distances.
+ */
+template <typename DistanceType, typename PairDistance>
+CondensedDistanceMatrix<DistanceType> distance_matrix(std::size_t n, const PairDistance &metric, std::size_t tile, ThreadPool &pool)
+{
+    CondensedDistanceMatrix<DistanceType> distances {n};
+    const auto tiles_per_side = (n + tile-1)/tile;
+    pool.run([&](std::size_t thread){
+                 std::size_t number = 0;
+                 for (std::size_t row_tile = 0; row_tile < tiles_per_side; ++row_tile)
+                 {
+                     for (auto column_tile = row_tile; column_tile < tiles_per_side; ++column_tile, ++number)
+                     {
+                         if (number % pool.size() != thread)
+                         {
+                             continue;
+                         }
+                         const auto row_end    = std::min(n, (row_tile+1)*tile);
+                         const auto column_end = std::min(n, (column_tile+1)*tile);
+                         for (auto i = row_tile*tile; i < row_end; ++i)
+                         {
+                             auto row = distances.row(i);
+                             for (auto j = std::max(i+1, column_tile*tile); j < column_end; ++j)
+                             {
+                                 row[j-i-1] = metric(i, j);
+                             }
+                         }
+                     }
+                 }
+             });
+    return distances;
+}
+
+/*! \brief Write the distance matrix of n points under any metric to a file without holding it in memory.
+ *
+ * Computes the rows in blocks of at most tile rows and 64 MB, each block split into tiles as in distance_matrix.
+ *
+ * \param[in] n The number of points.
+ * \param[in] metric Returns the distance of points i and j, called from several threads at once.
+ * \param[in] tile Points per side of a tile.
+ * \param[in] writer Receives the n rows; closing it is left to the caller.
+ * \param[in] pool Threads that compute the distances.
+ */
+template <typename DistanceType, typename PairDistance>
+void write_distance_matrix(std::size_t n, const PairDistance &metric, std::size_t tile, DistanceMatrixWriter<DistanceType> &writer, ThreadPool &pool)
+{
+    const std::size_t block_bytes = 64 << 20;
+    const auto        block_rows  = std::max<std::size_t>(1, std::min(tile, block_bytes/(std::max<std::size_t>(n, 1)*sizeof(DistanceType))));
+    std::vector<DistanceType> block(block_rows*n);
+    for (std::size_t first = 0; first < n; first += block_rows)
+    {
+        const auto last         = std::min(n, first + block_rows);
+        const auto column_tiles = (n - first + tile-1)/tile;
+        pool.run([&](std::size_t thread){
+                     for (auto column_tile = thread; column_tile < column_tiles; column_tile += pool.size())
+                     {
+                         const auto column_begin = first + column_tile*tile;
+                         const auto column_end   = std::min(n, column_begin + tile);
+                         for (auto i = first; i < last; ++i)
+                         {
+                             auto row = &block[(i-first)*n];
+                             for (auto j = std::max(i+1, column_begin); j < column_end; ++j)
+                             {
+                                 row[j] = metric(i, j);
+                             }
+                         }
+                     }
+                 });
+        for (auto i = first; i < last; ++i)
+        {
+            writer.write_row(&block[(i-first)*n + i+1], n-i-1);
+        }
+    }
+}
+
+/*! \brief The condensed distance matrix of points under a built-in metric.
+ *
+ * Goes straight into the clustering engines, e.g. condensed_linkage or nn_chain_linkage.
+ *
+ * \param[in] points The points, in memory or mapped by map_coordinates.
+ * \param[in] metric How to measure distance; rmsd takes every point as a structure of d/3 atoms.
+ * \param[in] pool Threads that compute the distances.
+ */
+template <typename CoordinateType>
+CondensedDistanceMatrix<CoordinateType> distance_matrix(const Coordinates<CoordinateType> &points, Metric metric, ThreadPool &pool)
+{
+    const auto n    = points.size();
+    const auto tile = tile_size<CoordinateType>(points.dimension());
+    switch (metric)
+    {
+        case Metric::squared_euclidean:
+            return distance_matrix<CoordinateType>(n, SquaredEuclideanDistance<CoordinateType>(points), tile, pool);
+        case Metric::cosine:
+            return distance_matrix<CoordinateType>(n, CosineDistance<CoordinateType>(points), tile, pool);
+        case Metric::rmsd:
+            return distance_matrix<CoordinateType>(n, RmsdDistance<CoordinateType>(points), tile_size<double>(points.dimension()), pool);
+        case Metric::euclidean:
+        default:
+            return distance_matrix<CoordinateType>(n, EuclideanDistance<CoordinateType>(points), tile, pool);
+    }
+}
+
+/*! \brief Write the distance matrix of points under a built-in metric to a file, for map_distance_matrix.
+ * \param[in] points The points, in memory or mapped by map_coordinates.
+ * \param[in] metric How to measure distance; rmsd takes every point as a structure of d/3 atoms.
+ * \param[in] writer Receives the rows; closing it is left to the caller.
+ * \param[in] pool Threads that compute the distances.
+ */
+template <typename CoordinateType>
+void write_distance_matrix(const Coordinates<CoordinateType> &points, Metric metric, DistanceMatrixWriter<CoordinateType> &writer, ThreadPool &pool)
+{
+    const auto n    = points.size();
+    const auto tile = tile_size<CoordinateType>(points.dimension());
+    switch (metric)
+    {
+        case Metric::squared_euclidean:
+            write_distance_matrix(n, SquaredEuclideanDistance<CoordinateType>(points), tile, writer, pool);
+            break;
+        case Metric::cosine:
+            write_distance_matrix(n, CosineDistance<CoordinateType>(points), tile, writer, pool);
+            break;
+        case Metric::rmsd:
+            write_distance_matrix(n, RmsdDistance<CoordinateType>(points), tile_size<double>(points.dimension()), writer, pool);
+            break;
+        case Metric::euclidean:
+        default:
+            write_distance_matrix(n, EuclideanDistance<CoordinateType>(points), tile, writer, pool);
+            break;
+    }
+}
+
+#endif /* end of include guard: DISTANCE_MATRIX_BUILDER_H_ */
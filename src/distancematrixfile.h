@@ -0,0 +1,237 @@
+/*
+ * distancematrixfile.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef DISTANCE_MATRIX_FILE_H_
+#define DISTANCE_MATRIX_FILE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compactdistance.h"
+#include "condenseddistancematrix.h"
+
+/*! \brief Binary file format for condensed distance matrices.
+ *
+ * All numbers are stored in the byte order of the writing machine:
+ *  - this header,
+ *  - n element ids as uint64,
+ *  - zero padding up to distances_offset, a multiple of CondensedDistanceMatrix::alignment,
+ *  - the n*(n-1)/2 distances, row after row as in CondensedDistanceMatrix.
+ */
+struct DistanceMatrixFileHeader
+{
+    char          magic[8];         //< "CLUSTDM" and a terminating zero
+    std::uint32_t version;          //< format version, currently 1
+    std::uint32_t precision;        //< a DistancePrecision
+    std::uint64_t n;                //< number of elements
+    std::uint64_t distances_offset; //< position of the first distance in the file
+};
+
+/*! \brief Type of the stored distances. */
+enum class DistancePrecision : std::uint32_t
+{
+    single_precision = 1, //< float
+    double_precision = 2, //< double
+    half_precision   = 3, //< HalfDistance
+    bfloat16         = 4  //< BFloat16Distance
+};
+
+/*! \brief The precision code of a distance type. */
+template <typename DistanceType>
+struct distance_precision;
+
+template <>
+struct distance_precision<float>
+{
+    static const DistancePrecision value = DistancePrecision::single_precision;
+};
+
+template <>
+struct distance_precision<double>
+{
+    static const DistancePrecision value = DistancePrecision::double_precision;
+};
+
+template <>
+struct distance_precision<HalfDistance>
+{
+    static const DistancePrecision value = DistancePrecision::half_precision;
+};
+
+template <>
+struct distance_precision<BFloat16Distance>
+{
+    static const DistancePrecision value = DistancePrecision::bfloat16;
+};
+
+/*! \brief Header of a distance matrix file for n elements, the distances aligned to the matrix alignment. */
+template <typename DistanceType>
+DistanceMatrixFileHeader distance_matrix_file_header(std::uint64_t n)
+{
+    DistanceMatrixFileHeader header {};
+    std::strncpy(header.magic, "CLUSTDM", sizeof(header.magic));
+    header.version   = 1;
+    header.precision = static_cast<std::uint32_t>(distance_precision<DistanceType>::value);
+    header.n         = n;
+    const std::uint64_t alignment = CondensedDistanceMatrix<DistanceType>::alignment;
+    header.distances_offset = (sizeof(header) + n*sizeof(std::uint64_t) + alignment-1)/alignment*alignment;
+    return header;
+}
+
+/*! \brief Map a distance matrix file into memory without reading it.
+ *
+ * The distances are read from the page cache when the clustering touches them.
+ * The mapping is private: engines that update distances in place get private copies
+ * of the pages they write to, the file itself is never changed.
+ *
+ * \param[in] filename File written by DistanceMatrixWriter.
+ * \param[out] ids If not null, receives the element ids of the rows.
+ * \param[in] sequential Advise the kernel that rows will be read in order, so that it reads ahead.
+ * \throws std::runtime_error if the file cannot be mapped or does not hold DistanceType distances.
+ */
+template <typename DistanceType>
+CondensedDistanceMatrix<DistanceType> map_distance_matrix(const std::string &filename, std::vector<std::size_t> * ids = nullptr, bool sequential = true)
+{
+    auto file = open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        throw std::runtime_error("Cannot open distance matrix file " + filename);
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(DistanceMatrixFileHeader))
+    {
+        close(file);
+        throw std::runtime_error("Distance matrix file " + filename + " is too short.");
+    }
+    const std::size_t length  = status.st_size;
+    auto              mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Cannot map distance matrix file " + filename);
+    }
+
+    DistanceMatrixFileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+    /* Each element has an id in the file, which bounds n before any size is computed from it */
+    const auto plausible = header.n <= length/sizeof(std::uint64_t);
+    const auto expected  = distance_matrix_file_header<DistanceType>(plausible ? header.n : 0);
+    /* Room for the n*(n-1)/2 distances, none for fewer than two elements, compared as n-1 <= 2*room/n so that nothing overflows */
+    const auto room      = plausible && length >= expected.distances_offset ? (length - expected.distances_offset)/sizeof(DistanceType) : 0;
+    const auto complete  = plausible && length >= expected.distances_offset && (header.n < 2 || header.n-1 <= 2*room/header.n);
+    if (std::strncmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version
+        || header.precision != expected.precision || header.distances_offset != expected.distances_offset || !complete)
+    {
+        munmap(mapping, length);
+        throw std::runtime_error("File " + filename + " does not hold a distance matrix of the requested precision.");
+    }
+
+    if (ids != nullptr)
+    {
+        const auto stored_ids = reinterpret_cast<const std::uint64_t*>(static_cast<const char*>(mapping) + sizeof(header));
+        ids->assign(stored_ids, stored_ids + header.n);
+    }
+    if (sequential)
+    {
+        madvise(mapping, length, MADV_SEQUENTIAL);
+    }
+
+    const auto data = reinterpret_cast<DistanceType*>(static_cast<char*>(mapping) + header.distances_offset);
+    return CondensedDistanceMatrix<DistanceType>(header.n, data, [mapping, length](DistanceType*){ munmap(mapping, length); });
+}
+
+/*! \brief Write a distance matrix file row by row, without holding the matrix in memory.
+ *
+ * Row i holds the distances of element i to the elements i+1 .. n-1.
+ * The destructor closes the file if close() was not called; call close() to learn about errors.
+ */
+template <typename DistanceType>
+class DistanceMatrixWriter
+{
+    public:
+        /*!\brief Create the file and write its header.
+         * \param[in] filename The file to be written.
+         * \param[in] ids The element id of each row.
+         * \throws std::runtime_error if the file cannot be written.
+         */
+        DistanceMatrixWriter(const std::string &filename, const std::vector<std::size_t> &ids) :
+            filename_ {filename}, file_ {std::fopen(filename.c_str(), "wb"), &std::fclose}, n_ {ids.size()}, rows_written_ {0}
+        {
+            if (file_ == nullptr)
+            {
+                throw std::runtime_error("Cannot open distance matrix file " + filename + " for writing.");
+            }
+            const auto                 header = distance_matrix_file_header<DistanceType>(n_);
+            std::vector<std::uint64_t> stored_ids(std::begin(ids), std::end(ids));
+            std::vector<char>          padding(header.distances_offset - sizeof(header) - n_*sizeof(std::uint64_t), 0);
+            write(&header, sizeof(header));
+            write(stored_ids.data(), stored_ids.size()*sizeof(std::uint64_t));
+            write(padding.data(), padding.size());
+        };
+
+        DistanceMatrixWriter(const DistanceMatrixWriter &)            = delete;
+        DistanceMatrixWriter &operator=(const DistanceMatrixWriter &) = delete;
+
+        /*!\brief Append the next row.
+         * \param[in] distances The distances of the next element to all following elements.
+         * \param[in] length Must be n-1 for the first row, n-2 for the second, and so on.
+         */
+        void write_row(const DistanceType * distances, std::size_t length)
+        {
+            if (rows_written_ >= n_ || length != n_-rows_written_-1)
+            {
+                throw std::runtime_error("Row " + std::to_string(rows_written_) + " of " + filename_ + " has the wrong length.");
+            }
+            write(distances, length*sizeof(DistanceType));
+            ++rows_written_;
+        };
+
+        /*!\brief Append the next row. */
+        void write_row(const std::vector<DistanceType> &distances)
+        {
+            write_row(distances.data(), distances.size());
+        };
+
+        /*!\brief Flush and close the file, closing it again has no effect.
+         * \throws std::runtime_error if rows are missing or the file could not be written completely.
+         */
+        void close()
+        {
+            if (file_ == nullptr)
+            {
+                return;
+            }
+            const auto status = std::fclose(file_.release());
+            if (status != 0 || rows_written_ != n_)
+            {
+                throw std::runtime_error("Distance matrix file " + filename_ + " is incomplete.");
+            }
+        };
+
+    private:
+        void write(const void * data, std::size_t bytes)
+        {
+            if (bytes > 0 && std::fwrite(data, 1, bytes, file_.get()) != bytes)
+            {
+                throw std::runtime_error("Cannot write to distance matrix file " + filename_);
+            }
+        };
+
+        std::string                                    filename_;     //< for error messages
+        std::unique_ptr<std::FILE, int(*)(std::FILE*)> file_;         //< the file being written, closed on destruction
+        std::size_t                                    n_;            //< number of elements
+        std::size_t                                    rows_written_; //< rows that have been written
+};
+
+#endif /* end of include guard: DISTANCE_MATRIX_FILE_H_ */
@@ -0,0 +1,213 @@
+/*
+ * flatclusters.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef FLAT_CLUSTERS_H_
+#define FLAT_CLUSTERS_H_
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "linkage.h"
+
+/*! \brief Sweeps through the merges of a linkage from the bottom up, to read off flat clusterings on the way.
+ *
+ * Merges are applied in order of increasing height (see Linkage::heights), with a union-find over the leaves.
+ * Each flat clustering costs O(n) to read off, applying all merges costs O(n) in total,
+ * so many thresholds are handled in one pass when they are visited in ascending order.
+ *
+ * \tparam LinkageType Anything with leaves(), size(), operator[] and heights() like Linkage, e.g. a MappedLinkage.
+ */
+template <typename DistanceType, typename LinkageType = Linkage<DistanceType>>
+class LinkageCut
+{
+    public:
+        /*!\brief Start with every leaf in a cluster of its own. */
+        explicit LinkageCut(const LinkageType &linkage) :
+            linkage_ (linkage), heights_ {linkage.heights()}, order_(linkage.size()), parent_(linkage.leaves()),
+            leaf_of_(linkage.leaves() + linkage.size()), applied_ {0}
+        {
+            for (std::size_t k = 0; k < order_.size(); ++k)
+            {
+                order_[k] = k;
+            }
+            /* Linkages from the engines are sorted already; only centroid and median from generic_linkage are not */
+            if (!std::is_sorted(std::begin(heights_), std::end(heights_)))
+            {
+                std::stable_sort(std::begin(order_), std::end(order_), [this](std::size_t a, std::size_t b){ return heights_[a] < heights_[b]; });
+            }
+            for (std::size_t i = 0; i < parent_.size(); ++i)
+            {
+                parent_[i]  = i;
+                leaf_of_[i] = i;
+            }
+        };
+
+        /*!\brief The number of clusters after the merges applied so far. */
+        std::size_t clusters() const { return linkage_.leaves() - applied_; };
+
+        /*!\brief Apply all merges with a height of at most distance. */
+        void merge_to_distance(DistanceType distance)
+        {
+            while (applied_ < order_.size() && heights_[order_[applied_]] <= distance)
+            {
+                apply_next();
+            }
+        };
+
+        /*!\brief Apply merges until only count clusters are left, or all merges are applied. */
+        void merge_to_count(std::size_t count)
+        {
+            while (applied_ < order_.size() && clusters() > count)
+            {
+                apply_next();
+            }
+        };
+
+        /*!\brief The cluster of each leaf, numbered 0, 1, ... in order of their lowest leaf. */
+        std::vector<std::size_t> labels()
+        {
+            const auto               n     = linkage_.leaves();
+            const auto               unset = std::numeric_limits<std::size_t>::max();
+            std::vector<std::size_t> label_of_root(n, unset);
+            std::vector<std::size_t> labels(n);
+            std::size_t              next_label = 0;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                auto &label = label_of_root[find(i)];
+                if (label == unset)
+                {
+                    label = next_label++;
+                }
+                labels[i] = label;
+            }
+            return labels;
+        };
+
+    private:
+        void apply_next()
+        {
+            const auto  k    = order_[applied_++];
+            const auto &step = linkage_[k];
+            const auto  a    = find(leaf_of_[step.left]);
+            const auto  b    = find(leaf_of_[step.right]);
+            parent_[std::max(a, b)]          = std::min(a, b);
+            leaf_of_[linkage_.leaves() + k] = std::min(a, b);
+        };
+
+        std::size_t find(std::size_t i)
+        {
+            while (parent_[i] != i)
+            {
+                parent_[i] = parent_[parent_[i]];
+                i          = parent_[i];
+            }
+            return i;
+        };
+
+        const LinkageType        &linkage_; //< the merges to sweep through
+        std::vector<DistanceType> heights_; //< height of each merge
+        std::vector<std::size_t>  order_;   //< merges by increasing height
+        std::vector<std::size_t>  parent_;  //< union-find over the leaves
+        std::vector<std::size_t>  leaf_of_; //< some leaf of each cluster id
+        std::size_t               applied_; //< number of merges applied
+};
+
+/*! \brief Flat clusters from cutting the dendrogram at a distance.
+ *
+ * Leaves end up in the same cluster if they are joined by merges no higher than distance,
+ * like the "distance" criterion of SciPy's fcluster.
+ *
+ * \returns The cluster of each leaf, numbered 0, 1, ... in order of their lowest leaf.
+ */
+template <typename DistanceType>
+std::vector<std::size_t> cut_at_distance(const Linkage<DistanceType> &linkage, DistanceType distance)
+{
+    LinkageCut<DistanceType> cut {linkage};
+    cut.merge_to_distance(distance);
+    return cut.labels();
+}
+
+/*! \brief Flat clusters from cutting the dendrogram into count clusters.
+ *
+ * Undoes the count-1 highest merges. An incomplete linkage may leave more clusters.
+ *
+ * \returns The cluster of each leaf, numbered 0, 1, ... in order of their lowest leaf.
+ */
+template <typename DistanceType>
+std::vector<std::size_t> cut_into(const Linkage<DistanceType> &linkage, std::size_t count)
+{
+    LinkageCut<DistanceType> cut {linkage};
+    cut.merge_to_count(count);
+    return cut.labels();
+}
+
+/*! \brief Flat clusters from all merges of a linkage, one per tree of an incomplete linkage.
+ *
+ * Reads off the clusters of a linkage that stopped early, see MergeStop, without cutting it again.
+ *
+ * \returns The cluster of each leaf, numbered 0, 1, ... in order of their lowest leaf.
+ */
+template <typename DistanceType>
+std::vector<std::size_t> forest_labels(const Linkage<DistanceType> &linkage)
+{
+    LinkageCut<DistanceType> cut {linkage};
+    cut.merge_to_count(0);
+    return cut.labels();
+}
+
+/*! \brief Flat clusters for many cut distances with a single sweep through the merges.
+ *
+ * \param[in] linkage The merges of the clustering.
+ * \param[in] distances The cut distances, in any order.
+ * \returns One labelling as in cut_at_distance per distance, in the order of distances.
+ */
+template <typename DistanceType>
+std::vector < std::vector < std::size_t>> cut_at_distances(const Linkage<DistanceType> &linkage, const std::vector<DistanceType> &distances)
+{
+    std::vector<std::size_t> order(distances.size());
+    for (std::size_t t = 0; t < order.size(); ++t)
+    {
+        order[t] = t;
+    }
+    std::sort(std::begin(order), std::end(order), [&distances](std::size_t a, std::size_t b){ return distances[a] < distances[b]; });
+
+    LinkageCut<DistanceType> cut {linkage};
+    std::vector < std::vector < std::size_t>> result(distances.size());
+    for (auto t : order)
+    {
+        cut.merge_to_distance(distances[t]);
+        result[t] = cut.labels();
+    }
+    return result;
+}
+
+/*! \brief Flat clusters for many cluster counts with a single sweep through the merges.
+ *
+ * \param[in] linkage The merges of the clustering.
+ * \param[in] counts The numbers of clusters, in any order.
+ * \returns One labelling as in cut_into per count, in the order of counts.
+ */
+template <typename DistanceType>
+std::vector < std::vector < std::size_t>> cut_into(const Linkage<DistanceType> &linkage, const std::vector<std::size_t> &counts)
+{
+    std::vector<std::size_t> order(counts.size());
+    for (std::size_t t = 0; t < order.size(); ++t)
+    {
+        order[t] = t;
+    }
+    /* Fewer clusters need more merges, so visit the largest counts first */
+    std::sort(std::begin(order), std::end(order), [&counts](std::size_t a, std::size_t b){ return counts[a] > counts[b]; });
+
+    LinkageCut<DistanceType> cut {linkage};
+    std::vector < std::vector < std::size_t>> result(counts.size());
+    for (auto t : order)
+    {
+        cut.merge_to_count(counts[t]);
+        result[t] = cut.labels();
+    }
+    return result;
+}
+
+#endif /* end of include guard: FLAT_CLUSTERS_H_ */
@@ -0,0 +1,162 @@
+/*
+ * genericlinkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef GENERIC_LINKAGE_H_
+#define GENERIC_LINKAGE_H_
+
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "binarytree.h"
+#include "condenseddistancematrix.h"
+#include "indexedminheap.h"
+#include "linkage.h"
+
+/*! \brief Hierarchical clustering with cached nearest neighbours, valid for any linkage.
+ *
+ * Müllner's "generic" algorithm: every cluster caches its nearest following neighbour and a lower
+ * bound of that distance in a priority queue. After a merge, only lowered distances are pushed
+ * to the queue right away; cached neighbours that have become farther away are recomputed only when
+ * they reach the top of the queue. Typically O(n^2 log n), worst case O(n^3) like hierarchical_merge_condensed.
+ * Meant for centroid and median, which are not reducible; use hierarchical_merge_nn_chain for the others.
+ *
+ * The merged cluster takes the higher of the two rows; the lower row is retired.
+ * Merges are found in order of increasing distance, equal distances in order of lowest row.
+ *
+ * \tparam MergeFunction A LanceWilliamsUpdate function or equivalent.
+ * \param[in] distances Mutual distances of the leaves, overwritten during merging.
+ * \param[in] merge_distance A function defining how to calculate the new distances to the merged cluster.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Merging ends before the first merge that is too far, or when few enough clusters are left.
+ */
+template <typename DistanceType, typename MergeFunction>
+Linkage<DistanceType> generic_linkage(CondensedDistanceMatrix<DistanceType> &distances, MergeFunction merge_distance, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                      const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    const auto n = distances.size();
+
+    LinkageBuilder<DistanceType> builder {n, std::move(leaf_sizes)};
+    const auto &cluster_sizes = builder.sizes();
+    if (n < 2)
+    {
+        return builder.release();
+    }
+
+    std::vector<char>         active(n, 1);
+    std::vector<std::size_t>  nearest(n-1);
+    std::vector<DistanceType> minimum_distances(n-1);
+
+    /* The nearest active neighbour among the following rows */
+    auto find_nearest = [&](std::size_t i){
+            const auto row = distances.row(i);
+            nearest[i] = n;
+            for (std::size_t j = i+1; j < n; ++j)
+            {
+                if (active[j] && (nearest[i] == n || row[j-i-1] < minimum_distances[i]))
+                {
+                    minimum_distances[i] = row[j-i-1];
+                    nearest[i]           = j;
+                }
+            }
+        };
+
+    for (std::size_t i = 0; i < n-1; ++i)
+    {
+        find_nearest(i);
+    }
+    IndexedMinHeap<DistanceType> queue {minimum_distances};
+
+    /* The merge at which each cached neighbour was last recomputed */
+    std::vector<std::size_t> refreshed(n-1, n);
+    for (std::size_t merge = 0; merge < n-1 && n-merge > stop.clusters; ++merge)
+    {
+        /* Refresh cached neighbours at the top of the queue until one is up to date; each is refreshed
+         * at most once per merge, since it is up to date afterwards even if a NaN compares unequal to itself */
+        auto left = queue.top();
+        while (refreshed[left] != merge && distances(left, nearest[left]) != minimum_distances[left])
+        {
+            find_nearest(left);
+            refreshed[left] = merge;
+            queue.update(left, minimum_distances[left]);
+            left = queue.top();
+        }
+        const auto right            = nearest[left];
+        const auto minimum_distance = minimum_distances[left];
+        if (stop.too_far(minimum_distance))
+        {
+            break;
+        }
+
+        queue.remove(left);
+        active[left] = 0;
+
+        /* Update the distances of the merged cluster in place, in the row and column of right */
+        for (std::size_t k = 0; k < n; ++k)
+        {
+            if (active[k] && k != right)
+            {
+                auto &d_to_right = distances(k, right);
+                d_to_right = DistanceType(merge_distance(minimum_distance, cluster_sizes[k], cluster_sizes[left], cluster_sizes[right], distances(k, left), d_to_right));
+            }
+        }
+        builder.merge(left, right, minimum_distance, right);
+
+        /* Redirect cached neighbours of the retired cluster, keep lower bounds for increased distances
+         * and push decreased distances to the queue right away */
+        for (std::size_t k = 0; k < right; ++k)
+        {
+            if (active[k])
+            {
+                if (nearest[k] == left)
+                {
+                    nearest[k] = right;
+                }
+                if (distances(k, right) < minimum_distances[k])
+                {
+                    minimum_distances[k] = distances(k, right);
+                    nearest[k]           = right;
+                    queue.update(k, minimum_distances[k]);
+                }
+            }
+        }
+        if (right < n-1 && queue.contains(right))
+        {
+            /* Row n-1 is never retired, so right always has a following neighbour */
+            find_nearest(right);
+            queue.update(right, minimum_distances[right]);
+        }
+    }
+
+    return builder.release();
+}
+
+/*! \brief Cached nearest-neighbour clustering of items whose distances are stored in a condensed matrix.
+ *
+ * \tparam Clusterable The items to be clustered must provide DistanceType, merger and size.
+ * \param[in] distances Mutual distances of the items, overwritten during merging.
+ * \param[in] leaves One clusterable per row of the distance matrix.
+ * \param[in] merge_distance A LanceWilliamsUpdate function or equivalent.
+ *
+ * The tree is built from generic_linkage.
+ */
+template <typename Clusterable, typename MergeFunction>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_generic(CondensedDistanceMatrix<typename Clusterable::DistanceType> &distances, std::vector<Clusterable> leaves, MergeFunction merge_distance)
+{
+    auto linkage = generic_linkage(distances, merge_distance, leaf_sizes(leaves));
+    return linkage.tree(std::move(leaves));
+}
+
+/*! \brief Cached nearest-neighbour clustering of list items, copying their distances into one condensed matrix first.
+ *
+ * Drop-in replacement for hierarchical_merge_into_tree.
+ */
+template <typename Clusterable, typename MergeFunction>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_generic(std::list<Clusterable> &items_to_cluster, MergeFunction merge_distance)
+{
+    CondensedDistanceMatrix<typename Clusterable::DistanceType> distances {items_to_cluster};
+    return hierarchical_merge_generic(distances, leaves_without_distances(items_to_cluster), merge_distance);
+}
+
+#endif /* end of include guard: GENERIC_LINKAGE_H_ */
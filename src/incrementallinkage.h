@@ -0,0 +1,436 @@
+/*
+ * incrementallinkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef INCREMENTAL_LINKAGE_H_
+#define INCREMENTAL_LINKAGE_H_
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "condenseddistancematrix.h"
+#include "linkage.h"
+#include "mergestop.h"
+#include "mstlinkage.h"
+#include "threadpool.h"
+
+/*! \brief Single linkage clustering that grows one item at a time.
+ *
+ * Keeps only the minimum spanning tree of the items inserted so far, sorted by edge length.
+ * The spanning tree after adding an item x is contained in the old spanning tree plus the n edges of x.
+ * Following the old tree from its leaves to its root, every tree edge closes one cycle with the edges of x;
+ * dropping the longest edge of each cycle leaves the new spanning tree (Chin and Houck). Only the longest
+ * edge on the path from each item to x needs to be remembered, so inserting an item takes O(n) time
+ * plus sorting the few edges of x that are kept, instead of O(n^2) for clustering from scratch.
+ * linkage() yields the same dendrogram as mst_linkage on all items, up to the order of tied merges.
+ */
+template <typename DistanceType>
+class IncrementalSingleLinkage
+{
+    public:
+        /*!\brief Start without items. */
+        IncrementalSingleLinkage() : n_ {0}
+        {};
+
+        /*!\brief Start with the items of a distance matrix.
+         * \param[in] distances Mutual distances of the first items, left untouched.
+         * \param[in] pool Threads that build the first spanning tree.
+         */
+        IncrementalSingleLinkage(const CondensedDistanceMatrix<DistanceType> &distances, ThreadPool &pool) :
+            n_ {distances.size()}, edges_ (minimum_spanning_tree(distances, pool))
+        {
+            std::stable_sort(std::begin(edges_), std::end(edges_), shorter);
+        };
+
+        /*!\brief The number of items inserted so far. */
+        std::size_t size() const { return n_; };
+
+        /*!\brief The edges of the minimum spanning tree, sorted by length. */
+        const std::vector < SpanningTreeEdge < DistanceType>> &edges() const { return edges_; };
+
+        /*!\brief Add an item.
+         * \param[in] distances The distances of the new item to all items so far, in insertion order; size() of them.
+         */
+        void insert(const DistanceType * distances)
+        {
+            const auto n = n_++;
+            if (n == 0)
+            {
+                return;
+            }
+            distances_ = distances;
+
+            /* Adjacency of the old tree, neighbours of item i at offset_[i] .. offset_[i+1] */
+            offset_.assign(n+1, 0);
+            for (const auto &edge : edges_)
+            {
+                ++offset_[edge.from+1];
+                ++offset_[edge.to+1];
+            }
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                offset_[i+1] += offset_[i];
+            }
+            neighbour_.resize(2*edges_.size());
+            position_.assign(std::begin(offset_), std::end(offset_)-1);
+            for (std::size_t e = 0; e < edges_.size(); ++e)
+            {
+                neighbour_[position_[edges_[e].from]++] = {edges_[e].to, e};
+                neighbour_[position_[edges_[e].to]++]   = {edges_[e].from, e};
+            }
+
+            /* Items in pre-order from item 0, with the tree edge to their parent */
+            order_.clear();
+            order_.push_back(0);
+            parent_edge_.assign(n, none);
+            for (std::size_t k = 0; k < order_.size(); ++k)
+            {
+                const auto i = order_[k];
+                for (auto a = offset_[i]; a < offset_[i+1]; ++a)
+                {
+                    if (neighbour_[a].edge != parent_edge_[i])
+                    {
+                        parent_edge_[neighbour_[a].item] = neighbour_[a].edge;
+                        order_.push_back(neighbour_[a].item);
+                    }
+                }
+            }
+
+            /* Edges are numbered: tree edges 0 .. n-2, then the edge of item i to x as n-1+i.
+             * longest_[i] is the longest edge on the path from i to x in the new tree of the subtree of i. */
+            dropped_.assign(2*n-1, 0);
+            longest_.resize(n);
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                longest_[i] = n-1+i;
+            }
+            for (auto k = order_.size()-1; k > 0; --k)
+            {
+                const auto child  = order_[k];
+                const auto e      = parent_edge_[child];
+                const auto parent = edges_[e].from == child ? edges_[e].to : edges_[e].from;
+                /* Joining the subtree of child closes the cycle parent - child - x - parent */
+                const auto s = longest_[child];
+                const auto t = longest_[parent];
+                const auto drop = longer(t, longer(e, s) ? e : s) ? t : (longer(e, s) ? e : s);
+                dropped_[drop] = 1;
+                if (drop == t)
+                {
+                    longest_[parent] = longer(e, s) ? e : s;
+                }
+            }
+
+            /* The kept tree edges stay sorted; merge in the kept edges of x */
+            added_.clear();
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (!dropped_[n-1+i])
+                {
+                    added_.push_back({i, n, distances[i]});
+                }
+            }
+            std::stable_sort(std::begin(added_), std::end(added_), shorter);
+            merged_.clear();
+            auto added = std::begin(added_);
+            for (std::size_t e = 0; e < edges_.size(); ++e)
+            {
+                if (dropped_[e])
+                {
+                    continue;
+                }
+                while (added != std::end(added_) && shorter(*added, edges_[e]))
+                {
+                    merged_.push_back(*added++);
+                }
+                merged_.push_back(edges_[e]);
+            }
+            merged_.insert(std::end(merged_), added, std::end(added_));
+            edges_.swap(merged_);
+        };
+
+        /*!\brief Add an item. */
+        void insert(const std::vector<DistanceType> &distances)
+        {
+            insert(distances.data());
+        };
+
+        /*!\brief The single linkage dendrogram of all items so far, in O(n) for the sorted edges.
+         * \param[in] leaf_sizes Number of elements in each item, one each if empty.
+         * \param[in] stop Where to stop merging, see spanning_tree_linkage.
+         */
+        Linkage<DistanceType> linkage(std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(), const MergeStop<DistanceType> &stop = MergeStop<DistanceType>()) const
+        {
+            return spanning_tree_linkage(edges_, n_, std::move(leaf_sizes), stop);
+        };
+
+    private:
+        static const std::size_t none = std::numeric_limits<std::size_t>::max();
+
+        /*!\brief An item next to another one in the tree, and the edge between them. */
+        struct Neighbour
+        {
+            std::size_t item;
+            std::size_t edge;
+        };
+
+        static bool shorter(const SpanningTreeEdge<DistanceType> &a, const SpanningTreeEdge<DistanceType> &b)
+        {
+            return a.distance < b.distance;
+        };
+
+        /*!\brief Strict order of the numbered edges during an insertion; among equal lengths,
+         * edges of the new item are longer than tree edges, so that ties keep the old tree. */
+        bool longer(std::size_t a, std::size_t b) const
+        {
+            const auto tree_edges = edges_.size();
+            const auto d_a        = a < tree_edges ? edges_[a].distance : distances_[a-tree_edges];
+            const auto d_b        = b < tree_edges ? edges_[b].distance : distances_[b-tree_edges];
+            return d_b < d_a || (!(d_a < d_b) && a > b);
+        };
+
+        std::size_t                                n_;           //< number of items
+        std::vector < SpanningTreeEdge < DistanceType>> edges_;  //< spanning tree, sorted by length
+        /* Workspace of insert, kept to avoid reallocation */
+        const DistanceType                       * distances_;   //< distances of the item being inserted
+        std::vector<std::size_t>                   offset_;      //< start of the neighbours of each item
+        std::vector<std::size_t>                   position_;    //< fill position while building neighbour_
+        std::vector<Neighbour>                     neighbour_;   //< neighbours of all items in the tree
+        std::vector<std::size_t>                   order_;       //< items in pre-order
+        std::vector<std::size_t>                   parent_edge_; //< tree edge towards item 0
+        std::vector<std::size_t>                   longest_;     //< longest edge on the path to the new item
+        std::vector<char>                          dropped_;     //< edges not in the new tree
+        std::vector < SpanningTreeEdge < DistanceType>> added_;  //< kept edges of the new item
+        std::vector < SpanningTreeEdge < DistanceType>> merged_; //< the new spanning tree
+};
+
+template <typename DistanceType>
+const std::size_t IncrementalSingleLinkage<DistanceType>::none;
+
+/*! \brief Approximate hierarchical clustering that grows one item at a time, for any Lance-Williams linkage.
+ *
+ * Each new item is inserted into the nearest subtree instead of reclustering:
+ * its linkage distance to every cluster of the dendrogram follows bottom-up from the Lance-Williams update,
+ * exactly as if the item had been a third cluster while the dendrogram was built.
+ * Starting from the root, the item descends into the closer branch as long as it is closer to that branch
+ * than the height at which the branch was merged, and is then merged with the cluster it stopped at.
+ * The new merge height is that distance, raised to the height of the cluster and lowered to the height above,
+ * so the dendrogram stays monotone.
+ *
+ * Existing clusters are never split or rearranged, although the new item may change which merges
+ * clustering from scratch would find, and distances above an insertion are only estimated from the
+ * merge distances recorded before it. The result drifts from clustering from scratch as more items
+ * are inserted, so recluster from time to time; for single linkage, use IncrementalSingleLinkage, which is exact.
+ * Inserting an item costs O(n) time.
+ *
+ * \tparam MergeFunction A LanceWilliamsUpdate function.
+ */
+template <typename DistanceType, typename MergeFunction>
+class IncrementalLinkage
+{
+    public:
+        /*!\brief Start from a complete clustering.
+         * \param[in] linkage The merges of all items so far, as from any engine.
+         * \param[in] merge_distance The function that linkage was built with.
+         */
+        IncrementalLinkage(const Linkage<DistanceType> &linkage, MergeFunction merge_distance) :
+            merge_distance_ (merge_distance), leaves_ {linkage.leaves()}, root_ {none}
+        {
+            nodes_.reserve(2*leaves_);
+            for (std::size_t i = 0; i < leaves_; ++i)
+            {
+                nodes_.push_back({none, none, none, DistanceType(), 1, i});
+            }
+            merge_d_.resize(leaves_);
+            const auto heights = linkage.heights();
+            for (std::size_t k = 0; k < linkage.size(); ++k)
+            {
+                const auto &step = linkage[k];
+                merge_d_[add_node(step.left, step.right, heights[k])] = step.distance;
+            }
+            root_ = nodes_.empty() ? none : nodes_.size()-1;
+            if (leaves_ > 0 && linkage.size() != leaves_-1)
+            {
+                throw std::invalid_argument("Only complete clusterings can be grown.");
+            }
+        };
+
+        /*!\brief The number of items inserted so far. */
+        std::size_t size() const { return leaves_; };
+
+        /*!\brief Add an item.
+         * \param[in] distances The distances of the new item to all items so far, in insertion order; size() of them.
+         */
+        void insert(const DistanceType * distances)
+        {
+            const auto x = add_leaf();
+            if (root_ == none)
+            {
+                root_ = x;
+                return;
+            }
+
+            /* Distance of the new item to every cluster, from the bottom up */
+            to_item_.resize(nodes_.size());
+            top_down(order_);
+            for (auto node = order_.rbegin(); node != order_.rend(); ++node)
+            {
+                const auto &cluster = nodes_[*node];
+                if (cluster.left == none)
+                {
+                    to_item_[*node] = distances[cluster.leaf];
+                }
+                else
+                {
+                    to_item_[*node] = merge_distance_(merge_d_[*node], 1, nodes_[cluster.left].size, nodes_[cluster.right].size, to_item_[cluster.left], to_item_[cluster.right]);
+                }
+            }
+
+            auto target = root_;
+            auto ceiling = std::numeric_limits<DistanceType>::infinity();
+            while (nodes_[target].left != none)
+            {
+                const auto &cluster = nodes_[target];
+                const auto  closer  = to_item_[cluster.right] < to_item_[cluster.left] ? cluster.right : cluster.left;
+                if (!(to_item_[closer] < cluster.height))
+                {
+                    break;
+                }
+                ceiling = cluster.height;
+                target  = closer;
+            }
+
+            const auto height = std::min(std::max(to_item_[target], nodes_[target].height), ceiling);
+            const auto parent = nodes_[target].parent;
+            const auto merged = add_node(target, x, height);
+            merge_d_[merged] = to_item_[target];
+            if (parent == none)
+            {
+                root_ = merged;
+            }
+            else
+            {
+                auto &branch = nodes_[parent].left == target ? nodes_[parent].left : nodes_[parent].right;
+                branch                 = merged;
+                nodes_[merged].parent  = parent;
+                for (auto ancestor = parent; ancestor != none; ancestor = nodes_[ancestor].parent)
+                {
+                    ++nodes_[ancestor].size;
+                }
+            }
+        };
+
+        /*!\brief Add an item. */
+        void insert(const std::vector<DistanceType> &distances)
+        {
+            insert(distances.data());
+        };
+
+        /*!\brief The merges of all items so far, leaves numbered in insertion order. */
+        Linkage<DistanceType> linkage() const
+        {
+            /* Order merges by height; among equal heights, merges with fewer levels below them first */
+            std::vector<std::size_t> depth(nodes_.size(), 0);
+            std::vector<std::size_t> all {};
+            top_down(all);
+            std::vector<std::size_t> order {};
+            for (auto node = all.rbegin(); node != all.rend(); ++node)
+            {
+                const auto &cluster = nodes_[*node];
+                if (cluster.left != none)
+                {
+                    depth[*node] = 1 + std::max(depth[cluster.left], depth[cluster.right]);
+                    order.push_back(*node);
+                }
+            }
+            std::sort(std::begin(order), std::end(order), [this, &depth](std::size_t a, std::size_t b){
+                          return nodes_[a].height < nodes_[b].height || (nodes_[a].height == nodes_[b].height && depth[a] < depth[b]);
+                      });
+
+            std::vector<std::size_t> id(nodes_.size());
+            for (std::size_t node = 0; node < nodes_.size(); ++node)
+            {
+                id[node] = nodes_[node].leaf;
+            }
+            Linkage<DistanceType> result {leaves_};
+            for (std::size_t k = 0; k < order.size(); ++k)
+            {
+                const auto &cluster = nodes_[order[k]];
+                id[order[k]] = leaves_ + k;
+                result.push_back({id[cluster.left], id[cluster.right], cluster.height, cluster.size});
+            }
+            return result;
+        };
+
+    private:
+        static const std::size_t none = std::numeric_limits<std::size_t>::max();
+
+        /*!\brief A cluster of the dendrogram. */
+        struct Node
+        {
+            std::size_t  left;   //< left branch, none for an item
+            std::size_t  right;  //< right branch, none for an item
+            std::size_t  parent; //< the cluster this one was merged into, none for the root
+            DistanceType height; //< merge height, zero for an item
+            std::size_t  size;   //< number of items
+            std::size_t  leaf;   //< the item number, for items
+        };
+
+        /*!\brief All clusters below the root, each before its branches.
+         * Inserted merges are created after the cluster above them, so the node index is no such order.
+         */
+        void top_down(std::vector<std::size_t> &order) const
+        {
+            order.clear();
+            if (root_ != none)
+            {
+                order.push_back(root_);
+            }
+            for (std::size_t k = 0; k < order.size(); ++k)
+            {
+                const auto &cluster = nodes_[order[k]];
+                if (cluster.left != none)
+                {
+                    order.push_back(cluster.left);
+                    order.push_back(cluster.right);
+                }
+            }
+        };
+
+        std::size_t add_leaf()
+        {
+            nodes_.push_back({none, none, none, DistanceType(), 1, leaves_++});
+            merge_d_.push_back(DistanceType());
+            return nodes_.size()-1;
+        };
+
+        std::size_t add_node(std::size_t left, std::size_t right, DistanceType height)
+        {
+            nodes_.push_back({left, right, none, height, nodes_[left].size + nodes_[right].size, none});
+            merge_d_.resize(nodes_.size(), height);
+            nodes_[left].parent  = nodes_.size()-1;
+            nodes_[right].parent = nodes_.size()-1;
+            return nodes_.size()-1;
+        };
+
+        MergeFunction             merge_distance_; //< the linkage
+        std::size_t               leaves_;         //< number of items
+        std::size_t               root_;           //< the cluster of all items
+        std::vector<Node>         nodes_;          //< items and clusters
+        std::vector<DistanceType> merge_d_;        //< distance between the branches of each cluster when they were merged
+        std::vector<DistanceType> to_item_;        //< distance of each cluster to the item being inserted
+        std::vector<std::size_t>  order_;          //< clusters top-down, reused between insertions
+};
+
+template <typename DistanceType, typename MergeFunction>
+const std::size_t IncrementalLinkage<DistanceType, MergeFunction>::none;
+
+/*! \brief Start growing a complete clustering, deducing the types. */
+template <typename DistanceType, typename MergeFunction>
+IncrementalLinkage<DistanceType, MergeFunction> incremental_linkage(const Linkage<DistanceType> &linkage, MergeFunction merge_distance)
+{
+    return IncrementalLinkage<DistanceType, MergeFunction>(linkage, merge_distance);
+}
+
+#endif /* end of include guard: INCREMENTAL_LINKAGE_H_ */
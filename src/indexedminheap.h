@@ -0,0 +1,124 @@
+/*
+ * indexedminheap.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef INDEXED_MIN_HEAP_H_
+#define INDEXED_MIN_HEAP_H_
+
+#include <limits>
+#include <vector>
+
+/*! \brief Binary min-heap over the indices 0..n-1 whose keys may change.
+ *
+ * Each index is at most once in the heap and its key can be raised or lowered in O(log n).
+ * Equal keys are ordered by index, so the top of the heap does not depend on the order of updates.
+ */
+template <typename KeyType>
+class IndexedMinHeap
+{
+    public:
+        /*!\brief Build a heap from keys in O(n).
+         * \param[in] keys Key for each index; all indices are in the heap.
+         */
+        explicit IndexedMinHeap(std::vector<KeyType> keys) :
+            keys_ {std::move(keys)}, heap_(keys_.size()), position_(keys_.size())
+        {
+            for (std::size_t i = 0; i < keys_.size(); ++i)
+            {
+                heap_[i]     = i;
+                position_[i] = i;
+            }
+            for (auto i = heap_.size()/2; i > 0; --i)
+            {
+                sift_down(i-1);
+            }
+        };
+
+        /*!\brief True if no index is in the heap. */
+        bool empty() const { return heap_.empty(); };
+
+        /*!\brief The number of indices in the heap. */
+        std::size_t size() const { return heap_.size(); };
+
+        /*!\brief True if index has not been removed from the heap. */
+        bool contains(std::size_t index) const { return position_[index] != npos; };
+
+        /*!\brief The index with the smallest key, the smallest index among equal keys. */
+        std::size_t top() const { return heap_.front(); };
+
+        /*!\brief The current key of an index. */
+        const KeyType &key(std::size_t index) const { return keys_[index]; };
+
+        /*!\brief Set a new key for an index in the heap, raising or lowering it. */
+        void update(std::size_t index, KeyType key)
+        {
+            keys_[index] = key;
+            sift_up(position_[index]);
+            sift_down(position_[index]);
+        };
+
+        /*!\brief Remove an index from the heap. */
+        void remove(std::size_t index)
+        {
+            auto position = position_[index];
+            move_to(heap_.back(), position);
+            heap_.pop_back();
+            position_[index] = npos;
+            if (position < heap_.size())
+            {
+                sift_up(position);
+                sift_down(position);
+            }
+        };
+
+    private:
+        static const std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+        bool less(std::size_t a, std::size_t b) const
+        {
+            return keys_[a] < keys_[b] || (!(keys_[b] < keys_[a]) && a < b);
+        };
+
+        void move_to(std::size_t index, std::size_t position)
+        {
+            heap_[position]  = index;
+            position_[index] = position;
+        };
+
+        void sift_up(std::size_t position)
+        {
+            auto index = heap_[position];
+            while (position > 0 && less(index, heap_[(position-1)/2]))
+            {
+                move_to(heap_[(position-1)/2], position);
+                position = (position-1)/2;
+            }
+            move_to(index, position);
+        };
+
+        void sift_down(std::size_t position)
+        {
+            auto index = heap_[position];
+            while (2*position+1 < heap_.size())
+            {
+                auto child = 2*position+1;
+                if (child+1 < heap_.size() && less(heap_[child+1], heap_[child]))
+                {
+                    ++child;
+                }
+                if (!less(heap_[child], index))
+                {
+                    break;
+                }
+                move_to(heap_[child], position);
+                position = child;
+            }
+            move_to(index, position);
+        };
+
+        std::vector<KeyType>     keys_;     //< key by index
+        std::vector<std::size_t> heap_;     //< indices in heap order
+        std::vector<std::size_t> position_; //< position in heap_ by index, npos if removed
+};
+
+#endif /* end of include guard: INDEXED_MIN_HEAP_H_ */
@@ -0,0 +1,626 @@
+/*
+ * kdtreelinkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef KD_TREE_LINKAGE_H_
+#define KD_TREE_LINKAGE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "centroidlinkage.h"
+#include "distancematrixbuilder.h"
+#include "linkage.h"
+#include "mergestop.h"
+#include "mstlinkage.h"
+#include "threadpool.h"
+
+/*! \brief A kd-tree over slots whose positions are stored one after the other, for low-dimensional data.
+ *
+ * Nodes split the slots at the median of their widest dimension until at most leaf_size are left.
+ * Slots can be removed and positions can move, as clusters merge: boxes only grow and counts only shrink,
+ * so the boxes stay valid bounds, if less tight, until the tree is rebuilt.
+ */
+template <typename DistanceType>
+class KdTree
+{
+    public:
+        static const std::size_t none = std::numeric_limits<std::size_t>::max();
+
+        /*!\brief A box of the tree; children follow their parent in the node array. */
+        struct Node
+        {
+            std::size_t  begin;        //< first slot of the node in slots()
+            std::size_t  end;          //< end of the slots of the node
+            std::size_t  left;         //< first child, none for a leaf
+            std::size_t  right;        //< second child, none for a leaf
+            std::size_t  parent;       //< none for the root
+            std::size_t  active;       //< number of slots not removed
+            DistanceType minimum_size; //< lower bound of the sizes of the slots
+        };
+
+        /*!\brief Build the tree.
+         * \param[in] positions Positions of all slots, dimension values each; must outlive the tree.
+         * \param[in] dimension Values per position.
+         * \param[in] slots The slots to put into the tree.
+         * \param[in] sizes Size of each slot, or nullptr for all one.
+         * \param[in] leaf_size Maximal number of slots in a leaf.
+         */
+        KdTree(const DistanceType * positions, std::size_t dimension, std::vector<std::size_t> slots, const DistanceType * sizes = nullptr, std::size_t leaf_size = 16) :
+            positions_ {positions}, d_ {dimension}, leaf_size_ {std::max<std::size_t>(leaf_size, 1)}, slots_ {std::move(slots)}
+        {
+            std::size_t slot_count = 0;
+            for (auto slot : slots_)
+            {
+                slot_count = std::max(slot_count, slot+1);
+            }
+            leaf_of_.assign(slot_count, none);
+            if (!slots_.empty())
+            {
+                build(0, slots_.size(), none, sizes);
+            }
+        };
+
+        /*!\brief The root node, if the tree is not empty. */
+        std::size_t root() const { return 0; };
+
+        /*!\brief Number of slots not removed. */
+        std::size_t size() const { return nodes_.empty() ? 0 : nodes_[0].active; };
+
+        /*!\brief Number of nodes. */
+        std::size_t nodes() const { return nodes_.size(); };
+
+        const Node &node(std::size_t i) const { return nodes_[i]; };
+
+        /*!\brief The slots of all nodes; node i holds slots()[begin, end). */
+        const std::vector<std::size_t> &slots() const { return slots_; };
+
+        /*!\brief True if the slot is in the tree and was not removed. */
+        bool contains(std::size_t slot) const { return slot < leaf_of_.size() && leaf_of_[slot] != none; };
+
+        /*!\brief The position of a slot. */
+        const DistanceType * position(std::size_t slot) const { return positions_ + slot*d_; };
+
+        /*!\brief Squared distance from a position to the box of a node, zero inside. */
+        DistanceType box_distance(std::size_t i, const DistanceType * x) const
+        {
+            const auto   lower = &lower_[i*d_];
+            const auto   upper = &upper_[i*d_];
+            DistanceType result = 0;
+            for (std::size_t k = 0; k < d_; ++k)
+            {
+                const auto outside = x[k] < lower[k] ? lower[k] - x[k] : (x[k] > upper[k] ? x[k] - upper[k] : 0);
+                result += outside*outside;
+            }
+            return result;
+        };
+
+        /*!\brief Take a slot out of the tree. */
+        void remove(std::size_t slot)
+        {
+            for (auto i = leaf_of_[slot]; i != none; i = nodes_[i].parent)
+            {
+                --nodes_[i].active;
+            }
+            leaf_of_[slot] = none;
+        };
+
+        /*!\brief Grow the boxes around a slot whose position has changed. */
+        void expand(std::size_t slot)
+        {
+            const auto x = position(slot);
+            for (auto i = leaf_of_[slot]; i != none; i = nodes_[i].parent)
+            {
+                for (std::size_t k = 0; k < d_; ++k)
+                {
+                    lower_[i*d_ + k] = std::min(lower_[i*d_ + k], x[k]);
+                    upper_[i*d_ + k] = std::max(upper_[i*d_ + k], x[k]);
+                }
+            }
+        };
+
+    private:
+        std::size_t build(std::size_t begin, std::size_t end, std::size_t parent, const DistanceType * sizes)
+        {
+            const auto i = nodes_.size();
+            nodes_.push_back({begin, end, none, none, parent, end - begin, DistanceType(1)});
+            lower_.insert(std::end(lower_), position(slots_[begin]), position(slots_[begin]) + d_);
+            upper_.insert(std::end(upper_), position(slots_[begin]), position(slots_[begin]) + d_);
+            auto minimum_size = sizes == nullptr ? DistanceType(1) : sizes[slots_[begin]];
+            for (auto s = begin; s < end; ++s)
+            {
+                const auto x = position(slots_[s]);
+                for (std::size_t k = 0; k < d_; ++k)
+                {
+                    lower_[i*d_ + k] = std::min(lower_[i*d_ + k], x[k]);
+                    upper_[i*d_ + k] = std::max(upper_[i*d_ + k], x[k]);
+                }
+                if (sizes != nullptr)
+                {
+                    minimum_size = std::min(minimum_size, sizes[slots_[s]]);
+                }
+            }
+            nodes_[i].minimum_size = minimum_size;
+
+            if (end - begin <= leaf_size_)
+            {
+                for (auto s = begin; s < end; ++s)
+                {
+                    leaf_of_[slots_[s]] = i;
+                }
+                return i;
+            }
+
+            std::size_t widest = 0;
+            for (std::size_t k = 1; k < d_; ++k)
+            {
+                if (upper_[i*d_ + k] - lower_[i*d_ + k] > upper_[i*d_ + widest] - lower_[i*d_ + widest])
+                {
+                    widest = k;
+                }
+            }
+            const auto middle = begin + (end - begin)/2;
+            std::nth_element(std::begin(slots_) + begin, std::begin(slots_) + middle, std::begin(slots_) + end, [this, widest](std::size_t a, std::size_t b){
+                                 return position(a)[widest] < position(b)[widest] || (position(a)[widest] == position(b)[widest] && a < b);
+                             });
+            const auto left  = build(begin, middle, i, sizes);
+            const auto right = build(middle, end, i, sizes);
+            nodes_[i].left  = left;
+            nodes_[i].right = right;
+            return i;
+        };
+
+        const DistanceType      * positions_; //< position of each slot
+        std::size_t               d_;         //< values per position
+        std::size_t               leaf_size_; //< maximal slots per leaf
+        std::vector<std::size_t>  slots_;     //< slots, ordered by node
+        std::vector<Node>         nodes_;     //< the boxes, root first
+        std::vector<DistanceType> lower_;     //< lower corner of each box
+        std::vector<DistanceType> upper_;     //< upper corner of each box
+        std::vector<std::size_t>  leaf_of_;   //< leaf holding each slot, none if removed
+};
+
+template <typename DistanceType>
+const std::size_t KdTree<DistanceType>::none;
+
+/*! \brief Factor that keeps box distance bounds below the distances they bound, despite rounding. */
+template <typename DistanceType>
+DistanceType rounding_slack(std::size_t dimension)
+{
+    return 1 - 4*(dimension+2)*std::numeric_limits<DistanceType>::epsilon();
+}
+
+/*! \brief Euclidean minimum spanning tree with Borůvka's algorithm on a kd-tree, O(n log n) for low dimensions.
+ *
+ * Each round, every component picks its shortest edge to another component. The shortest edge of each point
+ * is found in the kd-tree, skipping boxes that lie entirely within the point's own component or farther than the
+ * shortest edge its component has found so far. Every round at least halves the number of components.
+ * Edges are ordered by length, then by their lower and higher point, so the tree does not depend on the number of threads.
+ *
+ * \param[in] points The points.
+ * \param[in] pool Threads that search the shortest edges.
+ * \returns The n-1 edges, with Euclidean distances.
+ */
+template <typename DistanceType>
+std::vector < SpanningTreeEdge < DistanceType>> kd_tree_minimum_spanning_tree(const Coordinates<DistanceType> &points, ThreadPool &pool)
+{
+    const auto n    = points.size();
+    const auto d    = points.dimension();
+    const auto none = KdTree<DistanceType>::none;
+    std::vector < SpanningTreeEdge < DistanceType>> edges {};
+    if (n < 2)
+    {
+        return edges;
+    }
+    edges.reserve(n-1);
+
+    std::vector<std::size_t> all(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        all[i] = i;
+    }
+    const KdTree<DistanceType> tree {points.point(0), d, all};
+    const auto                 slack = rounding_slack<DistanceType>(d);
+
+    std::vector<std::size_t> representative(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        representative[i] = i;
+    }
+    auto find = [&representative](std::size_t i){
+            while (representative[i] != i)
+            {
+                representative[i] = representative[representative[i]];
+                i                 = representative[i];
+            }
+            return i;
+        };
+
+    /* Candidate edge with squared length; a before b in the order of edges */
+    struct Candidate
+    {
+        DistanceType d2;
+        std::size_t  from;
+        std::size_t  to;
+    };
+    auto shorter = [](const Candidate &a, const Candidate &b){
+            const auto a_low = std::min(a.from, a.to), b_low = std::min(b.from, b.to);
+            return a.d2 < b.d2 || (a.d2 == b.d2 && (a_low < b_low || (a_low == b_low && std::max(a.from, a.to) < std::max(b.from, b.to))));
+        };
+    const Candidate nothing {std::numeric_limits<DistanceType>::infinity(), none, none};
+
+    std::vector<std::size_t> component(n);
+    std::vector<std::size_t> node_component(tree.nodes());
+    std::vector<std::size_t> order(n);
+    std::vector<std::size_t> offset(n+1);
+    std::vector<Candidate>   best(n);
+    std::size_t              components = n;
+
+    /* Shortest edge of each component a thread touched; threads take consecutive points of the order, so they
+     * share at most the components at their ends, and all lists together hold fewer than components + threads entries */
+    std::vector < std::vector < std::pair < std::size_t, Candidate>>> thread_best(pool.size());
+
+    while (components > 1)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            component[i] = find(i);
+        }
+        /* The component of all points in a box, none if they differ; children follow their parents */
+        for (auto i = tree.nodes(); i-- > 0; )
+        {
+            const auto &box = tree.node(i);
+            if (box.left == none)
+            {
+                node_component[i] = component[tree.slots()[box.begin]];
+                for (auto s = box.begin; s < box.end && node_component[i] != none; ++s)
+                {
+                    if (component[tree.slots()[s]] != node_component[i])
+                    {
+                        node_component[i] = none;
+                    }
+                }
+            }
+            else
+            {
+                node_component[i] = node_component[box.left] == node_component[box.right] ? node_component[box.left] : none;
+            }
+        }
+        /* Points ordered by component */
+        std::fill(std::begin(offset), std::end(offset), 0);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            ++offset[component[i]+1];
+        }
+        std::partial_sum(std::begin(offset), std::end(offset), std::begin(offset));
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            order[offset[component[i]]++] = i;
+        }
+
+        pool.run([&](std::size_t thread){
+                     auto &touched = thread_best[thread];
+                     touched.clear();
+                     std::vector<std::size_t> stack {};
+                     const auto               range = pool.chunk(0, n, thread);
+                     for (auto k = range.first; k < range.second; ++k)
+                     {
+                         const auto q = order[k];
+                         const auto c = component[q];
+                         const auto x = points.point(q);
+                         if (touched.empty() || touched.back().first != c)
+                         {
+                             touched.emplace_back(c, nothing);
+                         }
+                         auto &bound = touched.back().second;
+                         stack.assign(1, tree.root());
+                         while (!stack.empty())
+                         {
+                             const auto i = stack.back();
+                             stack.pop_back();
+                             if (node_component[i] == c || tree.box_distance(i, x)*slack > bound.d2)
+                             {
+                                 continue;
+                             }
+                             const auto &box = tree.node(i);
+                             if (box.left == none)
+                             {
+                                 for (auto s = box.begin; s < box.end; ++s)
+                                 {
+                                     const auto p = tree.slots()[s];
+                                     if (component[p] != c)
+                                     {
+                                         const Candidate candidate {squared_distance(x, points.point(p), d), q, p};
+                                         if (shorter(candidate, bound))
+                                         {
+                                             bound = candidate;
+                                         }
+                                     }
+                                 }
+                             }
+                             else
+                             {
+                                 /* Visit the closer child first */
+                                 const auto near = tree.box_distance(box.left, x) <= tree.box_distance(box.right, x);
+                                 stack.push_back(near ? box.right : box.left);
+                                 stack.push_back(near ? box.left : box.right);
+                             }
+                         }
+                     }
+                 });
+
+        std::fill(std::begin(best), std::end(best), nothing);
+        for (const auto &touched : thread_best)
+        {
+            for (const auto &candidate : touched)
+            {
+                if (candidate.second.from != none && shorter(candidate.second, best[candidate.first]))
+                {
+                    best[candidate.first] = candidate.second;
+                }
+            }
+        }
+        for (std::size_t c = 0; c < n; ++c)
+        {
+            if (component[c] != c)
+            {
+                continue;
+            }
+            const auto a = find(best[c].from);
+            const auto b = find(best[c].to);
+            if (a != b)
+            {
+                representative[std::max(a, b)] = std::min(a, b);
+                edges.push_back({best[c].from, best[c].to, std::sqrt(best[c].d2)});
+                --components;
+            }
+        }
+    }
+    return edges;
+}
+
+/*! \brief Single linkage clustering of points with Euclidean distances via a kd-tree, without a distance matrix.
+ *
+ * Same dendrogram as mst_linkage on the Euclidean distance matrix, in O(n*d) memory and typically O(n log n) time
+ * for low dimensions; in many dimensions, the tree prunes little and mst_linkage is faster.
+ *
+ * \param[in] points The points to be clustered.
+ * \param[in] pool Threads that search the shortest edges.
+ * \param[in] leaf_sizes Number of elements in each point, one each if empty.
+ * \param[in] stop Where to stop merging, see spanning_tree_linkage.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> kd_tree_single_linkage(const Coordinates<DistanceType> &points, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                             const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    return spanning_tree_linkage(kd_tree_minimum_spanning_tree(points, pool), points.size(), std::move(leaf_sizes), stop);
+}
+
+/*! \brief Ward clustering of points with a kd-tree over the cluster centroids, without a distance matrix.
+ *
+ * Follows ward_linkage, but finds nearest neighbours in a kd-tree instead of scanning all clusters.
+ * A box is skipped if even its smallest cluster at the closest corner of the box would be farther away than the
+ * best neighbour so far. Merged clusters stay in the tree at their new centroid and the tree is rebuilt
+ * whenever the number of clusters has halved, so the boxes stay tight.
+ *
+ * As Ward linkage is reducible, clusters that are each other's nearest neighbours can be merged right away,
+ * and the nearest neighbour of a cluster only changes when that neighbour is merged. So the threads first search
+ * the neighbours of all clusters and all such pairs are merged in rounds, searching again only for the merged
+ * clusters and those that pointed at them. Once a round merges fewer than one in sixteen clusters, the remaining
+ * clusters are merged one pair at a time with the nearest-neighbour chain.
+ * Same dendrogram as ward_linkage, up to ties, typically in O(n log n) time for low dimensions.
+ *
+ * \param[in] points The points to be clustered.
+ * \param[in] pool Threads that search the nearest neighbours.
+ * \param[in] leaf_sizes Number of elements in each point, one each if empty.
+ * \param[in] stop Where to stop merging, as in nn_chain_linkage: clusters whose nearest neighbour is too far
+ *            are taken out of the tree, in the rounds as well as on the chain.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> kd_tree_ward_linkage(const Coordinates<DistanceType> &points, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                           const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    const auto n    = points.size();
+    const auto none = KdTree<DistanceType>::none;
+
+    LinkageBuilder<DistanceType>   builder {n, std::move(leaf_sizes)};
+    ClusterCentroids<DistanceType> clusters {points, LinkageMethod::ward_minimum_distance, builder.sizes(), 1};
+    if (n < 2)
+    {
+        return builder.release();
+    }
+    const auto slack = rounding_slack<DistanceType>(points.dimension());
+
+    std::vector<std::size_t> active(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        active[i] = i;
+    }
+    std::vector<DistanceType> sizes(std::begin(builder.weights()), std::end(builder.weights()));
+    KdTree<DistanceType>      tree {clusters.centroids(), points.dimension(), active, sizes.data()};
+    auto                      built_with = n;
+
+    /* The nearest cluster to slot a, the lowest slot among equal distances */
+    auto nearest = [&](std::size_t a, std::vector<std::size_t> &stack){
+            std::pair<std::size_t, DistanceType> best {none, std::numeric_limits<DistanceType>::infinity()};
+            const auto x      = clusters.centroid(a);
+            const auto size_a = clusters.size(a);
+            stack.assign(1, tree.root());
+            while (!stack.empty())
+            {
+                const auto i = stack.back();
+                stack.pop_back();
+                const auto &box = tree.node(i);
+                if (box.active == 0)
+                {
+                    continue;
+                }
+                const auto weight = 2*size_a*box.minimum_size/(size_a + box.minimum_size);
+                if (weight*tree.box_distance(i, x)*slack > best.second)
+                {
+                    continue;
+                }
+                if (box.left == none)
+                {
+                    for (auto s = box.begin; s < box.end; ++s)
+                    {
+                        const auto b = tree.slots()[s];
+                        if (b != a && tree.contains(b))
+                        {
+                            const auto d = clusters.distance(a, b);
+                            if (d < best.second || (d == best.second && b < best.first))
+                            {
+                                best = {b, d};
+                            }
+                        }
+                    }
+                }
+                else
+                {
+                    const auto near = tree.box_distance(box.left, x) <= tree.box_distance(box.right, x);
+                    stack.push_back(near ? box.right : box.left);
+                    stack.push_back(near ? box.left : box.right);
+                }
+            }
+            return best;
+        };
+
+    /* Merge the clusters in slots left < right, keeping the tree up to date */
+    auto merge = [&](std::size_t left, std::size_t right, DistanceType distance){
+            clusters.merge(left, right, left);
+            builder.merge(left, right, distance);
+            tree.remove(right);
+            tree.expand(left);
+        };
+    auto rebuild_if_halved = [&](){
+            if (2*active.size() <= built_with)
+            {
+                for (auto slot : active)
+                {
+                    sizes[slot] = clusters.size(slot);
+                }
+                tree       = KdTree<DistanceType>(clusters.centroids(), points.dimension(), active, sizes.data());
+                built_with = active.size();
+            }
+        };
+
+    std::vector < std::vector < std::size_t>>             stacks(pool.size());
+    std::vector < std::pair < std::size_t, DistanceType>> neighbour(n);
+    std::vector<char>                                     merged(n, 0);
+    std::vector<std::size_t>                              search(active);
+    while (active.size() > 1)
+    {
+        pool.run([&](std::size_t thread){
+                     const auto range = pool.chunk(0, search.size(), thread);
+                     for (auto k = range.first; k < range.second; ++k)
+                     {
+                         neighbour[search[k]] = nearest(search[k], stacks[thread]);
+                     }
+                 });
+
+        /* Clusters pointing at a cluster that is too far are too far themselves, so none of them searches again */
+        std::size_t pairs = 0;
+        for (auto a : active)
+        {
+            const auto b = neighbour[a].first;
+            if (stop.too_far(neighbour[a].second))
+            {
+                tree.remove(a);
+                ++pairs;
+            }
+            else if (a < b && b != none && neighbour[b].first == a)
+            {
+                merge(a, b, neighbour[a].second);
+                merged[a] = merged[b] = 1;
+                ++pairs;
+            }
+        }
+        if (16*pairs < active.size())
+        {
+            std::fill(std::begin(merged), std::end(merged), 0);
+            active.erase(std::remove_if(std::begin(active), std::end(active), [&](std::size_t slot){ return !tree.contains(slot); }), std::end(active));
+            rebuild_if_halved();
+            break;
+        }
+
+        search.clear();
+        for (auto slot : active)
+        {
+            if (tree.contains(slot) && (merged[slot] || (neighbour[slot].first != none && merged[neighbour[slot].first])))
+            {
+                search.push_back(slot);
+            }
+        }
+        for (auto slot : active)
+        {
+            merged[slot] = 0;
+        }
+        active.erase(std::remove_if(std::begin(active), std::end(active), [&](std::size_t slot){ return !tree.contains(slot); }), std::end(active));
+        rebuild_if_halved();
+    }
+
+    std::vector<std::size_t> chain {};
+    chain.reserve(active.size());
+    while (active.size() > 1)
+    {
+        if (chain.empty())
+        {
+            chain.push_back(active.front());
+        }
+
+        /* Grow the chain until its last two clusters are mutual nearest neighbours; the predecessor wins ties */
+        std::size_t  a, b;
+        DistanceType minimum_distance;
+        bool         isolated = false;
+        while (true)
+        {
+            a = chain.back();
+            const auto closest = nearest(a, stacks.front());
+            b                = closest.first;
+            minimum_distance = closest.second;
+            if (chain.size() > 1)
+            {
+                const auto predecessor = chain[chain.size()-2];
+                const auto d           = clusters.distance(a, predecessor);
+                if (!(minimum_distance < d))
+                {
+                    b                = predecessor;
+                    minimum_distance = d;
+                    break;
+                }
+            }
+            if (stop.too_far(minimum_distance))
+            {
+                isolated = true;
+                break;
+            }
+            chain.push_back(b);
+        }
+        if (isolated)
+        {
+            chain.pop_back();
+            tree.remove(a);
+            active.erase(std::lower_bound(std::begin(active), std::end(active), a));
+            continue;
+        }
+        chain.pop_back();
+        chain.pop_back();
+
+        const auto left  = std::min(a, b);
+        const auto right = std::max(a, b);
+        merge(left, right, minimum_distance);
+        active.erase(std::lower_bound(std::begin(active), std::end(active), right));
+        rebuild_if_halved();
+    }
+
+    auto linkage = builder.release();
+    linkage.sort();
+    linkage.truncate(stop);
+    return linkage;
+}
+
+#endif /* end of include guard: KD_TREE_LINKAGE_H_ */
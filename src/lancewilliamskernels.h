@@ -0,0 +1,331 @@
+/*
+ * lancewilliamskernels.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef LANCE_WILLIAMS_KERNELS_H_
+#define LANCE_WILLIAMS_KERNELS_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+
+#include "compactdistance.h"
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+/*! \brief The linkages of LanceWilliamsUpdate, for kernels that update a whole row at once. */
+enum class LinkageMethod
+{
+    single_linkage,
+    complete_linkage,
+    simple_average,
+    centroid,
+    median,
+    group_average,
+    ward_minimum_distance
+};
+
+/*! \brief Lance-Williams parameters of a merge.
+ *
+ * The distance of a cluster to the merger of left and right is
+ *  a_left * d_to_left + a_right * d_to_right + b * d_left_right + g * |d_to_left - d_to_right|
+ */
+template <typename DistanceType>
+struct LanceWilliamsCoefficients
+{
+    DistanceType a_left;
+    DistanceType a_right;
+    DistanceType b;
+    DistanceType g;
+};
+
+/*! \brief Lance-Williams parameters of a linkage, as documented in LanceWilliamsUpdate.
+ * \param[in] method The linkage.
+ * \param[in] size_current Size of the cluster whose distance is updated, only used by Ward.
+ * \param[in] size_left Size of the "left" or first cluster to be merged.
+ * \param[in] size_right Size of the "right" or second cluster to be merged.
+ */
+template <typename DistanceType>
+LanceWilliamsCoefficients<DistanceType> lance_williams_coefficients(LinkageMethod method, DistanceType size_current, DistanceType size_left, DistanceType size_right)
+{
+    switch (method)
+    {
+        case LinkageMethod::single_linkage:
+            return {0.5, 0.5, 0, -0.5};
+        case LinkageMethod::complete_linkage:
+            return {0.5, 0.5, 0, 0.5};
+        case LinkageMethod::simple_average:
+            return {0.5, 0.5, 0, 0};
+        case LinkageMethod::centroid:
+        {
+            DistanceType a_left  = size_left/(size_left+size_right);
+            DistanceType a_right = size_right/(size_left+size_right);
+            return {a_left, a_right, -a_left*a_right, 0};
+        }
+        case LinkageMethod::median:
+            return {0.5, 0.5, -0.25, 0};
+        case LinkageMethod::group_average:
+            return {size_left/(size_left+size_right), size_right/(size_left+size_right), 0, 0};
+        case LinkageMethod::ward_minimum_distance:
+        {
+            DistanceType total_size = size_current + size_left + size_right;
+            return {(size_current + size_left)/total_size, (size_current + size_right)/total_size, -size_current/total_size, 0};
+        }
+    }
+    return {0, 0, 0, 0};
+}
+
+/*! \brief result = min(d_to_left, d_to_right), element-wise. */
+template <typename DistanceType>
+void minimum_row(const DistanceType * d_to_left, const DistanceType * d_to_right, DistanceType * result, std::size_t length)
+{
+    for (std::size_t k = 0; k < length; ++k)
+    {
+        result[k] = d_to_right[k] < d_to_left[k] ? d_to_right[k] : d_to_left[k];
+    }
+}
+
+/*! \brief result = max(d_to_left, d_to_right), element-wise. */
+template <typename DistanceType>
+void maximum_row(const DistanceType * d_to_left, const DistanceType * d_to_right, DistanceType * result, std::size_t length)
+{
+    for (std::size_t k = 0; k < length; ++k)
+    {
+        result[k] = d_to_left[k] < d_to_right[k] ? d_to_right[k] : d_to_left[k];
+    }
+}
+
+/*! \brief result = a_left * d_to_left + a_right * d_to_right + offset, element-wise, computed in Arithmetic. */
+template <typename DistanceType, typename Arithmetic>
+void affine_row(Arithmetic a_left, Arithmetic a_right, Arithmetic offset, const DistanceType * d_to_left, const DistanceType * d_to_right, DistanceType * result, std::size_t length)
+{
+    for (std::size_t k = 0; k < length; ++k)
+    {
+        result[k] = DistanceType(a_left * d_to_left[k] + a_right * d_to_right[k] + offset);
+    }
+}
+
+/*! \brief Ward update with the size of each current cluster, element-wise, computed in Arithmetic. */
+template <typename DistanceType, typename Arithmetic>
+void ward_row(DistanceType d_left_right, Arithmetic size_left, Arithmetic size_right, const Arithmetic * sizes_current, const DistanceType * d_to_left, const DistanceType * d_to_right, DistanceType * result, std::size_t length)
+{
+    for (std::size_t k = 0; k < length; ++k)
+    {
+        const Arithmetic total_size = sizes_current[k] + size_left + size_right;
+        result[k] = DistanceType((sizes_current[k] + size_left)/total_size * d_to_left[k] + (sizes_current[k] + size_right)/total_size * d_to_right[k] - sizes_current[k]/total_size * d_left_right);
+    }
+}
+
+/*! \brief The first position of the smallest distance in a row and that distance.
+ *
+ * NaN distances are skipped; only a row of nothing but NaN yields one.
+ *
+ * \param[in] row The distances, length must be larger than zero.
+ */
+template <typename DistanceType>
+std::pair<std::size_t, DistanceType> row_minimum(const DistanceType * row, std::size_t length)
+{
+    std::size_t position = 0;
+    for (std::size_t k = 1; k < length; ++k)
+    {
+        if (row[k] < row[position] || row[position] != row[position])
+        {
+            position = k;
+        }
+    }
+    return {position, row[position]};
+}
+
+#if defined(__AVX__) || defined(__SSE__)
+/* Single precision kernels with AVX or SSE; the remainder of a row is handled by the generic kernels. */
+
+inline std::pair<std::size_t, float> row_minimum(const float * row, std::size_t length)
+{
+    /* Find the minimal value with vector instructions first, then its first position.
+     * The minima start at infinity and min_ps returns its second operand if either is NaN, so NaN is skipped. */
+    std::size_t k       = 0;
+    float       minimum = std::numeric_limits<float>::infinity();
+    if (length >= 4)
+    {
+        auto minima = _mm_set1_ps(minimum);
+#if defined(__AVX__)
+        if (length >= 16)
+        {
+            auto wide_minima = _mm256_set1_ps(minimum);
+            for (; k + 8 <= length; k += 8)
+            {
+                wide_minima = _mm256_min_ps(_mm256_loadu_ps(row + k), wide_minima);
+            }
+            minima = _mm_min_ps(_mm256_castps256_ps128(wide_minima), _mm256_extractf128_ps(wide_minima, 1));
+        }
+#endif
+        for (; k + 4 <= length; k += 4)
+        {
+            minima = _mm_min_ps(_mm_loadu_ps(row + k), minima);
+        }
+        minima  = _mm_min_ps(minima, _mm_movehl_ps(minima, minima));
+        minima  = _mm_min_ss(minima, _mm_shuffle_ps(minima, minima, 1));
+        minimum = _mm_cvtss_f32(minima);
+    }
+    for (; k < length; ++k)
+    {
+        minimum = row[k] < minimum ? row[k] : minimum;
+    }
+    const auto position = static_cast<std::size_t>(std::find(row, row + length, minimum) - row);
+    if (position == length)
+    {
+        /* nothing but NaN and no infinity */
+        return row_minimum<float>(row, length);
+    }
+    return {position, minimum};
+}
+
+inline void minimum_row(const float * d_to_left, const float * d_to_right, float * result, std::size_t length)
+{
+    std::size_t k = 0;
+#if defined(__AVX__)
+    for (; k + 8 <= length; k += 8)
+    {
+        _mm256_storeu_ps(result + k, _mm256_min_ps(_mm256_loadu_ps(d_to_right + k), _mm256_loadu_ps(d_to_left + k)));
+    }
+#endif
+    for (; k + 4 <= length; k += 4)
+    {
+        _mm_storeu_ps(result + k, _mm_min_ps(_mm_loadu_ps(d_to_right + k), _mm_loadu_ps(d_to_left + k)));
+    }
+    minimum_row<float>(d_to_left + k, d_to_right + k, result + k, length - k);
+}
+
+inline void maximum_row(const float * d_to_left, const float * d_to_right, float * result, std::size_t length)
+{
+    std::size_t k = 0;
+#if defined(__AVX__)
+    for (; k + 8 <= length; k += 8)
+    {
+        _mm256_storeu_ps(result + k, _mm256_max_ps(_mm256_loadu_ps(d_to_right + k), _mm256_loadu_ps(d_to_left + k)));
+    }
+#endif
+    for (; k + 4 <= length; k += 4)
+    {
+        _mm_storeu_ps(result + k, _mm_max_ps(_mm_loadu_ps(d_to_right + k), _mm_loadu_ps(d_to_left + k)));
+    }
+    maximum_row<float>(d_to_left + k, d_to_right + k, result + k, length - k);
+}
+
+inline void affine_row(float a_left, float a_right, float offset, const float * d_to_left, const float * d_to_right, float * result, std::size_t length)
+{
+    std::size_t k = 0;
+#if defined(__AVX__)
+    {
+        const auto a_l = _mm256_set1_ps(a_left);
+        const auto a_r = _mm256_set1_ps(a_right);
+        const auto c   = _mm256_set1_ps(offset);
+        for (; k + 8 <= length; k += 8)
+        {
+            const auto l = _mm256_mul_ps(a_l, _mm256_loadu_ps(d_to_left + k));
+            const auto r = _mm256_mul_ps(a_r, _mm256_loadu_ps(d_to_right + k));
+            _mm256_storeu_ps(result + k, _mm256_add_ps(_mm256_add_ps(l, r), c));
+        }
+    }
+#endif
+    {
+        const auto a_l = _mm_set1_ps(a_left);
+        const auto a_r = _mm_set1_ps(a_right);
+        const auto c   = _mm_set1_ps(offset);
+        for (; k + 4 <= length; k += 4)
+        {
+            const auto l = _mm_mul_ps(a_l, _mm_loadu_ps(d_to_left + k));
+            const auto r = _mm_mul_ps(a_r, _mm_loadu_ps(d_to_right + k));
+            _mm_storeu_ps(result + k, _mm_add_ps(_mm_add_ps(l, r), c));
+        }
+    }
+    affine_row<float>(a_left, a_right, offset, d_to_left + k, d_to_right + k, result + k, length - k);
+}
+
+inline void ward_row(float d_left_right, float size_left, float size_right, const float * sizes_current, const float * d_to_left, const float * d_to_right, float * result, std::size_t length)
+{
+    std::size_t k = 0;
+#if defined(__AVX__)
+    {
+        const auto s_l  = _mm256_set1_ps(size_left);
+        const auto s_r  = _mm256_set1_ps(size_right);
+        const auto d_lr = _mm256_set1_ps(d_left_right);
+        for (; k + 8 <= length; k += 8)
+        {
+            const auto s     = _mm256_loadu_ps(sizes_current + k);
+            const auto total = _mm256_add_ps(_mm256_add_ps(s, s_l), s_r);
+            const auto l     = _mm256_mul_ps(_mm256_div_ps(_mm256_add_ps(s, s_l), total), _mm256_loadu_ps(d_to_left + k));
+            const auto r     = _mm256_mul_ps(_mm256_div_ps(_mm256_add_ps(s, s_r), total), _mm256_loadu_ps(d_to_right + k));
+            const auto b     = _mm256_mul_ps(_mm256_div_ps(s, total), d_lr);
+            _mm256_storeu_ps(result + k, _mm256_sub_ps(_mm256_add_ps(l, r), b));
+        }
+    }
+#endif
+    {
+        const auto s_l  = _mm_set1_ps(size_left);
+        const auto s_r  = _mm_set1_ps(size_right);
+        const auto d_lr = _mm_set1_ps(d_left_right);
+        for (; k + 4 <= length; k += 4)
+        {
+            const auto s     = _mm_loadu_ps(sizes_current + k);
+            const auto total = _mm_add_ps(_mm_add_ps(s, s_l), s_r);
+            const auto l     = _mm_mul_ps(_mm_div_ps(_mm_add_ps(s, s_l), total), _mm_loadu_ps(d_to_left + k));
+            const auto r     = _mm_mul_ps(_mm_div_ps(_mm_add_ps(s, s_r), total), _mm_loadu_ps(d_to_right + k));
+            const auto b     = _mm_mul_ps(_mm_div_ps(s, total), d_lr);
+            _mm_storeu_ps(result + k, _mm_sub_ps(_mm_add_ps(l, r), b));
+        }
+    }
+    ward_row<float>(d_left_right, size_left, size_right, sizes_current + k, d_to_left + k, d_to_right + k, result + k, length - k);
+}
+#endif
+
+/*! \brief Distances of a row of clusters to the merger of left and right.
+ *
+ * Single and complete linkage reduce to minimum and maximum, Ward needs the size of every
+ * current cluster, all other linkages apply the same coefficients to the whole row.
+ * Infinite distances to both left and right stay infinite.
+ * result may be the same array as d_to_left or d_to_right.
+ *
+ * Sizes and coefficients are in the arithmetic type of DistanceType, see distance_arithmetic, and 16 bit distances
+ * are rounded when stored.
+ *
+ * \param[in] method The linkage.
+ * \param[in] d_left_right Distance between the two clusters to be merged.
+ * \param[in] size_left Size of the "left" or first cluster to be merged.
+ * \param[in] size_right Size of the "right" or second cluster to be merged.
+ * \param[in] sizes_current Sizes of the clusters in the row.
+ * \param[in] d_to_left Distances of the clusters in the row to "left".
+ * \param[in] d_to_right Distances of the clusters in the row to "right".
+ * \param[out] result Distances of the clusters in the row to the merged cluster.
+ * \param[in] length Number of clusters in the row.
+ */
+template <typename DistanceType>
+void lance_williams_update_row(LinkageMethod method, DistanceType d_left_right, typename distance_arithmetic<DistanceType>::type size_left, typename distance_arithmetic<DistanceType>::type size_right,
+                               const typename distance_arithmetic<DistanceType>::type * sizes_current, const DistanceType * d_to_left, const DistanceType * d_to_right, DistanceType * result, std::size_t length)
+{
+    typedef typename distance_arithmetic<DistanceType>::type Arithmetic;
+
+    switch (method)
+    {
+        case LinkageMethod::single_linkage:
+            minimum_row(d_to_left, d_to_right, result, length);
+            break;
+        case LinkageMethod::complete_linkage:
+            maximum_row(d_to_left, d_to_right, result, length);
+            break;
+        case LinkageMethod::ward_minimum_distance:
+            ward_row(d_left_right, size_left, size_right, sizes_current, d_to_left, d_to_right, result, length);
+            break;
+        default:
+        {
+            /* Linkages without b ignore d_left_right like LanceWilliamsUpdate does, which keeps an infinite one from making 0*inf = NaN */
+            const auto c = lance_williams_coefficients(method, Arithmetic(), size_left, size_right);
+            affine_row(c.a_left, c.a_right, c.b == 0 ? Arithmetic(0) : c.b * d_left_right, d_to_left, d_to_right, result, length);
+        }
+    }
+}
+
+#endif /* end of include guard: LANCE_WILLIAMS_KERNELS_H_ */
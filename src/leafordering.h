@@ -0,0 +1,134 @@
+/*
+ * leafordering.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef LEAF_ORDERING_H_
+#define LEAF_ORDERING_H_
+
+#include <vector>
+
+/*! \brief A contiguous, read-only run of elements in a LeafOrdering. */
+class LeafRange
+{
+    public:
+        typedef const std::size_t * const_iterator;
+
+        LeafRange(const std::size_t * first, const std::size_t * last) : first_ {first}, last_ {last}
+        {};
+
+        const_iterator begin() const { return first_; };
+        const_iterator end() const { return last_; };
+        std::size_t size() const { return last_ - first_; };
+        bool empty() const { return first_ == last_; };
+        std::size_t operator[](std::size_t i) const { return first_[i]; };
+
+    private:
+        const std::size_t * first_; //< first element
+        const std::size_t * last_;  //< one past the last element
+};
+
+/*! \brief The leaves in dendrogram order, with every cluster a range [offset, offset+size) of that order.
+ *
+ * Left branches come before right branches; the trees of an incomplete linkage follow each other
+ * in the order of their root ids. Built once in O(n) without recursion, since ranges are handed down
+ * from the roots, which are merged last. Afterwards the members, size and membership tests of any
+ * cluster cost O(1) and copy nothing, unlike the elements that DistanceCluster copies at every merge.
+ *
+ * Clusters are numbered as in Linkage: 0..n-1 are the leaves, n+k is made by the k-th merge.
+ * All queries are const, so any number of threads may query one ordering at the same time.
+ */
+class LeafOrdering
+{
+    public:
+        /*!\brief Order the leaves of a linkage.
+         * \param[in] linkage A Linkage, or anything with leaves(), size() and operator[] like it, e.g. a MappedLinkage.
+         * \param[in] ids If not empty, the element id of each leaf, as reported by elements().
+         */
+        template <typename LinkageType>
+        explicit LeafOrdering(const LinkageType &linkage, const std::vector<std::size_t> &ids = std::vector<std::size_t>()) :
+            leaves_ {linkage.leaves()}, offset_(linkage.leaves() + linkage.size()), size_(linkage.leaves() + linkage.size(), 1),
+            order_(linkage.leaves())
+        {
+            const auto        n = leaves_;
+            std::vector<char> is_root(offset_.size(), 1);
+            for (std::size_t k = 0; k < linkage.size(); ++k)
+            {
+                const auto step = linkage[k];
+                size_[n + k]       = size_[step.left] + size_[step.right];
+                is_root[step.left]  = 0;
+                is_root[step.right] = 0;
+            }
+
+            std::size_t next = 0;
+            for (std::size_t id = 0; id < offset_.size(); ++id)
+            {
+                if (is_root[id])
+                {
+                    offset_[id] = next;
+                    next       += size_[id];
+                }
+            }
+            for (std::size_t k = linkage.size(); k-- > 0; )
+            {
+                const auto step = linkage[k];
+                offset_[step.left]  = offset_[n + k];
+                offset_[step.right] = offset_[n + k] + size_[step.left];
+            }
+
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                order_[offset_[i]] = i;
+            }
+            if (!ids.empty())
+            {
+                elements_.resize(n);
+                for (std::size_t position = 0; position < n; ++position)
+                {
+                    elements_[position] = ids[order_[position]];
+                }
+            }
+        };
+
+        /*!\brief The number of leaves. */
+        std::size_t leaves() const { return leaves_; };
+
+        /*!\brief The number of clusters, leaves included. */
+        std::size_t clusters() const { return offset_.size(); };
+
+        /*!\brief All leaves in dendrogram order. */
+        const std::vector<std::size_t> &order() const { return order_; };
+
+        /*!\brief Position of the first leaf of a cluster in order(); for a leaf, its own position. */
+        std::size_t offset(std::size_t id) const { return offset_[id]; };
+
+        /*!\brief The number of leaves in a cluster. */
+        std::size_t size(std::size_t id) const { return size_[id]; };
+
+        /*!\brief The leaves of a cluster, in dendrogram order. */
+        LeafRange members(std::size_t id) const
+        {
+            return {order_.data() + offset_[id], order_.data() + offset_[id] + size_[id]};
+        };
+
+        /*!\brief The element ids of a cluster, in dendrogram order; its leaves if no ids were given. */
+        LeafRange elements(std::size_t id) const
+        {
+            const auto &elements = elements_.empty() ? order_ : elements_;
+            return {elements.data() + offset_[id], elements.data() + offset_[id] + size_[id]};
+        };
+
+        /*!\brief Whether a leaf or cluster is part of another cluster; every cluster contains itself. */
+        bool contains(std::size_t cluster, std::size_t id) const
+        {
+            return offset_[cluster] <= offset_[id] && offset_[id] + size_[id] <= offset_[cluster] + size_[cluster];
+        };
+
+    private:
+        std::size_t              leaves_;   //< number of leaves
+        std::vector<std::size_t> offset_;   //< first position of each cluster in order_
+        std::vector<std::size_t> size_;     //< number of leaves of each cluster
+        std::vector<std::size_t> order_;    //< the leaves in dendrogram order
+        std::vector<std::size_t> elements_; //< element ids in dendrogram order, if given
+};
+
+#endif /* end of include guard: LEAF_ORDERING_H_ */
@@ -0,0 +1,358 @@
+/*
+ * linkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef LINKAGE_H_
+#define LINKAGE_H_
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "arenabinarytree.h"
+#include "binarytree.h"
+#include "compactdistance.h"
+#include "mergestop.h"
+
+/*! \brief One merge of a hierarchical clustering.
+ *
+ * Clusters are numbered as in SciPy: ids 0..n-1 are the leaves,
+ * id n+k is the cluster created by the k-th merge.
+ */
+template <typename DistanceType>
+struct LinkageStep
+{
+    std::size_t  left;     //< id of the left branch
+    std::size_t  right;    //< id of the right branch
+    DistanceType distance; //< distance at which left and right were merged
+    std::size_t  size;     //< number of elements in the merged cluster
+};
+
+/*! \brief The merges of a hierarchical clustering in a flat array, one row per merge.
+ *
+ * Takes O(n) memory, unlike a BinaryTree of clusters that copy their elements at every merge.
+ * The tree is built from the linkage on demand.
+ */
+template <typename DistanceType>
+class Linkage
+{
+    public:
+        typedef typename std::vector < LinkageStep < DistanceType>>::const_iterator const_iterator;
+
+        /*!\brief An empty linkage of n leaves. */
+        explicit Linkage(std::size_t n = 0) : n_ {n}
+        {
+            steps_.reserve(n > 0 ? n-1 : 0);
+        };
+
+        /*!\brief The number of leaves. */
+        std::size_t leaves() const { return n_; };
+
+        /*!\brief The number of merges, n-1 for a complete clustering. */
+        std::size_t size() const { return steps_.size(); };
+
+        /*!\brief The k-th merge. */
+        const LinkageStep<DistanceType> &operator[](std::size_t k) const { return steps_[k]; };
+
+        const_iterator begin() const { return steps_.begin(); };
+        const_iterator end() const { return steps_.end(); };
+
+        /*!\brief Drop all merges and start over with n leaves, keeping the memory for the merges. */
+        void clear(std::size_t n)
+        {
+            n_ = n;
+            steps_.clear();
+            steps_.reserve(n > 0 ? n-1 : 0);
+        };
+
+        /*!\brief Append a merge of two existing clusters; the merged cluster has id leaves()+size()-1. */
+        void push_back(const LinkageStep<DistanceType> &step) { steps_.push_back(step); };
+
+        /*!\brief The largest distance among each merge and the merges below it.
+         *
+         * Equals the merge distances for monotone linkages; for centroid and median, a merge may be
+         * closer than one of its branches, and its height is that of the branch instead.
+         */
+        std::vector<DistanceType> heights() const
+        {
+            std::vector<DistanceType> height(steps_.size());
+            for (std::size_t k = 0; k < steps_.size(); ++k)
+            {
+                height[k] = steps_[k].distance;
+                for (auto branch : {steps_[k].left, steps_[k].right})
+                {
+                    if (branch >= n_ && height[k] < height[branch-n_])
+                    {
+                        height[k] = height[branch-n_];
+                    }
+                }
+            }
+            return height;
+        };
+
+        /*!\brief Reorder the merges by increasing distance and renumber the clusters.
+         *
+         * For engines that do not find merges in order of distance. A merge never moves before the merges
+         * of its branches, even if rounding made it slightly closer; ties keep their previous order.
+         */
+        void sort()
+        {
+            const auto height = heights();
+            std::vector<std::size_t> order(steps_.size());
+            for (std::size_t k = 0; k < order.size(); ++k)
+            {
+                order[k] = k;
+            }
+            std::stable_sort(std::begin(order), std::end(order), [&height](std::size_t a, std::size_t b){ return height[a] < height[b]; });
+
+            std::vector<std::size_t> new_id(steps_.size());
+            for (std::size_t k = 0; k < order.size(); ++k)
+            {
+                new_id[order[k]] = n_ + k;
+            }
+            auto renumber = [this, &new_id](std::size_t id){ return id < n_ ? id : new_id[id-n_]; };
+            std::vector < LinkageStep < DistanceType>> sorted {};
+            sorted.reserve(steps_.size());
+            for (auto k : order)
+            {
+                sorted.push_back({renumber(steps_[k].left), renumber(steps_[k].right), steps_[k].distance, steps_[k].size});
+            }
+            steps_.swap(sorted);
+        };
+
+        /*!\brief Build the binary tree of clusters.
+         * \param[in] leaves One clusterable per leaf, in id order.
+         * \returns The root of the tree, nullptr if there are no leaves.
+         * \throws std::logic_error if the linkage is incomplete, whose trees forest returns.
+         */
+        template <typename Clusterable>
+        std::unique_ptr < BinaryTree < Clusterable>> tree(std::vector<Clusterable> leaves) const
+        {
+            if (n_ > 0 && steps_.size() != n_-1)
+            {
+                throw std::logic_error("An incomplete linkage has one tree per cluster left, use Linkage::forest.");
+            }
+            auto roots = forest(std::move(leaves));
+            return roots.empty() ? nullptr : std::move(roots.front());
+        };
+
+        /*!\brief Drop the merges beyond a stop, for linkages sorted by increasing distance.
+         *
+         * Keeps the merges up to the first one that is too far or would leave fewer than stop.clusters clusters;
+         * the merges kept never refer to merges dropped, so the result is the forest that stopping early would have built.
+         */
+        void truncate(const MergeStop<DistanceType> &stop)
+        {
+            std::size_t kept = 0;
+            while (kept < steps_.size() && !stop.reached(steps_[kept].distance, n_ - kept))
+            {
+                ++kept;
+            }
+            steps_.resize(kept);
+        };
+
+        /*!\brief Build the binary trees of an incomplete linkage, one per cluster that is left.
+         * \param[in] leaves One clusterable per leaf, in id order.
+         * \returns The roots in order of their cluster ids.
+         */
+        template <typename Clusterable>
+        std::list < std::unique_ptr < BinaryTree < Clusterable>> > forest(std::vector<Clusterable> leaves) const
+        {
+            std::vector < std::unique_ptr < BinaryTree < Clusterable>> > nodes {};
+            nodes.reserve(n_ + steps_.size());
+            for (auto &leaf : leaves)
+            {
+                nodes.emplace_back(new BinaryTree<Clusterable>{std::move(leaf)});
+            }
+            for (const auto &step : steps_)
+            {
+                std::unique_ptr<Clusterable> merged {(**nodes[step.left]).merger(**nodes[step.right], std::vector<DistanceType>(), step.distance)};
+                nodes.emplace_back(new BinaryTree<Clusterable>(std::move(nodes[step.left]), std::move(nodes[step.right]), std::move(*merged)));
+            }
+            std::list < std::unique_ptr < BinaryTree < Clusterable>> > roots {};
+            for (auto &node : nodes)
+            {
+                if (node)
+                {
+                    roots.push_back(std::move(node));
+                }
+            }
+            return roots;
+        };
+
+        /*!\brief Build the binary tree of clusters in a single array.
+         * \param[in] leaves One clusterable per leaf, in id order.
+         * \returns A tree whose node indices are the cluster ids.
+         */
+        template <typename Clusterable>
+        ArenaBinaryTree<Clusterable> arena_tree(std::vector<Clusterable> leaves) const
+        {
+            ArenaBinaryTree<Clusterable> nodes {n_ + steps_.size()};
+            for (auto &leaf : leaves)
+            {
+                nodes.add_leaf(std::move(leaf));
+            }
+            for (const auto &step : steps_)
+            {
+                std::unique_ptr<Clusterable> merged {nodes[step.left].merger(nodes[step.right], std::vector<DistanceType>(), step.distance)};
+                nodes.add(step.left, step.right, std::move(*merged));
+            }
+            return nodes;
+        };
+
+        /*!\brief The shape of the clustering as a tree of merge distances, without copying any elements.
+         * Leaves hold zero distance, the node of merge k holds its distance at index leaves()+k.
+         */
+        ArenaBinaryTree<DistanceType> arena_tree() const
+        {
+            ArenaBinaryTree<DistanceType> nodes {n_ + steps_.size()};
+            for (std::size_t i = 0; i < n_; ++i)
+            {
+                nodes.add_leaf(DistanceType());
+            }
+            for (const auto &step : steps_)
+            {
+                nodes.add(step.left, step.right, step.distance);
+            }
+            return nodes;
+        };
+
+    private:
+        std::size_t n_;                                 //< number of leaves
+        std::vector < LinkageStep < DistanceType>> steps_; //< the merges in the order they happened
+};
+
+/*! \brief Records the merges of a clustering engine that refers to clusters by the distance matrix row they occupy.
+ *
+ * Merging two clusters stores the merged cluster in the row ("slot") of one of them and retires the other.
+ */
+template <typename DistanceType>
+class LinkageBuilder
+{
+    public:
+        /*!\brief Type of the weights, float for the 16 bit distances, which cannot hold sizes. */
+        typedef typename distance_arithmetic<DistanceType>::type Weight;
+
+        /*!\brief Start with one cluster per slot.
+         * \param[in] n The number of leaves.
+         * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+         */
+        explicit LinkageBuilder(std::size_t n, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>()) :
+            linkage_ {n}, ids_(n), sizes_ {std::move(leaf_sizes)}
+        {
+            if (sizes_.empty())
+            {
+                sizes_.assign(n, 1);
+            }
+            weights_.assign(std::begin(sizes_), std::end(sizes_));
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                ids_[i] = i;
+            }
+        };
+
+        /*!\brief The number of slots. */
+        std::size_t size() const { return ids_.size(); };
+
+        /*!\brief Cluster sizes by slot; the entries of retired slots are meaningless. */
+        const std::vector<std::size_t> &sizes() const { return sizes_; };
+
+        /*!\brief Cluster sizes by slot in the arithmetic type of DistanceType, for kernels that update many distances at once. */
+        const std::vector<Weight> &weights() const { return weights_; };
+
+        /*!\brief Merge the cluster in slot right into the cluster in slot left. */
+        void merge(std::size_t left, std::size_t right, DistanceType merge_d)
+        {
+            merge(left, right, merge_d, left);
+        };
+
+        /*!\brief Merge the clusters in slots left and right and store the merged cluster in slot into.
+         * \param[in] left Slot of the left branch.
+         * \param[in] right Slot of the right branch.
+         * \param[in] merge_d The distance at which the clusters are merged.
+         * \param[in] into Either left or right; the other slot is retired.
+         */
+        void merge(std::size_t left, std::size_t right, DistanceType merge_d, std::size_t into)
+        {
+            const auto size = sizes_[left] + sizes_[right];
+            linkage_.push_back({ids_[left], ids_[right], merge_d, size});
+            ids_[into]     = linkage_.leaves() + linkage_.size() - 1;
+            sizes_[into]   = size;
+            weights_[into] = size;
+        };
+
+        /*!\brief Start over with n slots of one element each, reusing the memory of the previous clustering. */
+        void reset(std::size_t n)
+        {
+            linkage_.clear(n);
+            ids_.resize(n);
+            sizes_.assign(n, 1);
+            weights_.assign(n, Weight(1));
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                ids_[i] = i;
+            }
+        };
+
+        /*!\brief The merges recorded so far. */
+        const Linkage<DistanceType> &linkage() const { return linkage_; };
+
+        /*!\brief Hand the recorded merges over to the caller. */
+        Linkage<DistanceType> release() { return std::move(linkage_); };
+
+    private:
+        Linkage<DistanceType>     linkage_; //< merges so far
+        std::vector<std::size_t>  ids_;     //< cluster id by slot
+        std::vector<std::size_t>  sizes_;   //< number of elements by slot
+        std::vector<Weight>       weights_; //< sizes_ in the arithmetic type
+};
+
+/*! \brief The number of elements of each leaf. */
+template <typename Clusterable>
+std::vector<std::size_t> leaf_sizes(const std::vector<Clusterable> &leaves)
+{
+    std::vector<std::size_t> sizes {};
+    sizes.reserve(leaves.size());
+    for (const auto &leaf : leaves)
+    {
+        sizes.push_back(leaf.size());
+    }
+    return sizes;
+}
+
+/*! \brief Move list items into leaves, dropping their distances.
+ *
+ * Erasing distances from the back does not move any of them.
+ */
+template <typename Clusterable>
+std::vector<Clusterable> leaves_without_distances(std::list<Clusterable> &items)
+{
+    std::vector<Clusterable> leaves {};
+    leaves.reserve(items.size());
+    for (auto &item : items)
+    {
+        while (!item.distances().empty())
+        {
+            item.deleteDistance(item.distances().size()-1);
+        }
+        leaves.push_back(std::move(item));
+    }
+    return leaves;
+}
+
+/*! \brief One leaf with a single element per id, e.g. for the rows of a mapped distance matrix. */
+template <typename Clusterable>
+std::vector<Clusterable> leaves_from_ids(const std::vector<std::size_t> &ids)
+{
+    std::vector<Clusterable> leaves {};
+    leaves.reserve(ids.size());
+    for (auto id : ids)
+    {
+        leaves.emplace_back(std::vector<typename Clusterable::DistanceType>(), std::vector<std::size_t> {id});
+    }
+    return leaves;
+}
+
+#endif /* end of include guard: LINKAGE_H_ */
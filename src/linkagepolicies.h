@@ -0,0 +1,305 @@
+/*
+ * linkagepolicies.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef LINKAGE_POLICIES_H_
+#define LINKAGE_POLICIES_H_
+
+#include <list>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "binarytree.h"
+#include "cluster.h"
+#include "compactdistance.h"
+#include "condensedcluster.h"
+#include "condenseddistancematrix.h"
+#include "genericlinkage.h"
+#include "lancewilliamskernels.h"
+#include "linkage.h"
+#include "mstlinkage.h"
+#include "nnchain.h"
+#include "threadpool.h"
+
+/*! \brief Linkages as policy types, whose properties are known at compile time.
+ *
+ * Each policy provides
+ *  - method: the LinkageMethod, for the vector kernels,
+ *  - reducible: a merged cluster is never closer to a third cluster than both its parts were, so NN-chain applies,
+ *  - monotone: merge distances never decrease, so the linkage comes out sorted,
+ *  - needs_sizes: the update depends on the cluster sizes,
+ *  - coefficients(size_current, size_left, size_right): the Lance-Williams parameters, constexpr,
+ *  - operator(): the update with the signature of a LanceWilliamsUpdate function, which engines inline;
+ *    distances stored in 16 bits are updated in float, see distance_arithmetic.
+ *
+ * A policy object can be passed wherever a LanceWilliamsUpdate function is accepted and gives the same distances.
+ */
+struct SingleLinkage
+{
+    static constexpr LinkageMethod method      = LinkageMethod::single_linkage;
+    static constexpr bool          reducible   = true;
+    static constexpr bool          monotone    = true;
+    static constexpr bool          needs_sizes = false;
+
+    template <typename DistanceType>
+    static constexpr LanceWilliamsCoefficients<DistanceType> coefficients(DistanceType /*size_current*/, DistanceType /*size_left*/, DistanceType /*size_right*/)
+    {
+        return {0.5, 0.5, 0, -0.5};
+    }
+
+    template <typename DistanceType>
+    typename distance_arithmetic<DistanceType>::type operator()(DistanceType d_left_right, std::size_t size_current, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right) const
+    {
+        return LanceWilliamsUpdate<typename distance_arithmetic<DistanceType>::type>::single_linkage(d_left_right, size_current, size_left, size_right, d_to_left, d_to_right);
+    }
+};
+
+struct CompleteLinkage
+{
+    static constexpr LinkageMethod method      = LinkageMethod::complete_linkage;
+    static constexpr bool          reducible   = true;
+    static constexpr bool          monotone    = true;
+    static constexpr bool          needs_sizes = false;
+
+    template <typename DistanceType>
+    static constexpr LanceWilliamsCoefficients<DistanceType> coefficients(DistanceType /*size_current*/, DistanceType /*size_left*/, DistanceType /*size_right*/)
+    {
+        return {0.5, 0.5, 0, 0.5};
+    }
+
+    template <typename DistanceType>
+    typename distance_arithmetic<DistanceType>::type operator()(DistanceType d_left_right, std::size_t size_current, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right) const
+    {
+        return LanceWilliamsUpdate<typename distance_arithmetic<DistanceType>::type>::complete_linkage(d_left_right, size_current, size_left, size_right, d_to_left, d_to_right);
+    }
+};
+
+struct SimpleAverageLinkage
+{
+    static constexpr LinkageMethod method      = LinkageMethod::simple_average;
+    static constexpr bool          reducible   = true;
+    static constexpr bool          monotone    = true;
+    static constexpr bool          needs_sizes = false;
+
+    template <typename DistanceType>
+    static constexpr LanceWilliamsCoefficients<DistanceType> coefficients(DistanceType /*size_current*/, DistanceType /*size_left*/, DistanceType /*size_right*/)
+    {
+        return {0.5, 0.5, 0, 0};
+    }
+
+    template <typename DistanceType>
+    typename distance_arithmetic<DistanceType>::type operator()(DistanceType d_left_right, std::size_t size_current, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right) const
+    {
+        return LanceWilliamsUpdate<typename distance_arithmetic<DistanceType>::type>::simple_average(d_left_right, size_current, size_left, size_right, d_to_left, d_to_right);
+    }
+};
+
+struct CentroidLinkage
+{
+    static constexpr LinkageMethod method      = LinkageMethod::centroid;
+    static constexpr bool          reducible   = false;
+    static constexpr bool          monotone    = false;
+    static constexpr bool          needs_sizes = true;
+
+    template <typename DistanceType>
+    static constexpr LanceWilliamsCoefficients<DistanceType> coefficients(DistanceType /*size_current*/, DistanceType size_left, DistanceType size_right)
+    {
+        return {size_left/(size_left+size_right), size_right/(size_left+size_right), -size_left*size_right/((size_left+size_right)*(size_left+size_right)), 0};
+    }
+
+    template <typename DistanceType>
+    typename distance_arithmetic<DistanceType>::type operator()(DistanceType d_left_right, std::size_t size_current, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right) const
+    {
+        return LanceWilliamsUpdate<typename distance_arithmetic<DistanceType>::type>::centroid(d_left_right, size_current, size_left, size_right, d_to_left, d_to_right);
+    }
+};
+
+struct MedianLinkage
+{
+    static constexpr LinkageMethod method      = LinkageMethod::median;
+    static constexpr bool          reducible   = false;
+    static constexpr bool          monotone    = false;
+    static constexpr bool          needs_sizes = false;
+
+    template <typename DistanceType>
+    static constexpr LanceWilliamsCoefficients<DistanceType> coefficients(DistanceType /*size_current*/, DistanceType /*size_left*/, DistanceType /*size_right*/)
+    {
+        return {0.5, 0.5, -0.25, 0};
+    }
+
+    template <typename DistanceType>
+    typename distance_arithmetic<DistanceType>::type operator()(DistanceType d_left_right, std::size_t size_current, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right) const
+    {
+        return LanceWilliamsUpdate<typename distance_arithmetic<DistanceType>::type>::median(d_left_right, size_current, size_left, size_right, d_to_left, d_to_right);
+    }
+};
+
+struct GroupAverageLinkage
+{
+    static constexpr LinkageMethod method      = LinkageMethod::group_average;
+    static constexpr bool          reducible   = true;
+    static constexpr bool          monotone    = true;
+    static constexpr bool          needs_sizes = true;
+
+    template <typename DistanceType>
+    static constexpr LanceWilliamsCoefficients<DistanceType> coefficients(DistanceType /*size_current*/, DistanceType size_left, DistanceType size_right)
+    {
+        return {size_left/(size_left+size_right), size_right/(size_left+size_right), 0, 0};
+    }
+
+    template <typename DistanceType>
+    typename distance_arithmetic<DistanceType>::type operator()(DistanceType d_left_right, std::size_t size_current, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right) const
+    {
+        return LanceWilliamsUpdate<typename distance_arithmetic<DistanceType>::type>::group_average(d_left_right, size_current, size_left, size_right, d_to_left, d_to_right);
+    }
+};
+
+struct WardLinkage
+{
+    static constexpr LinkageMethod method      = LinkageMethod::ward_minimum_distance;
+    static constexpr bool          reducible   = true;
+    static constexpr bool          monotone    = true;
+    static constexpr bool          needs_sizes = true;
+
+    template <typename DistanceType>
+    static constexpr LanceWilliamsCoefficients<DistanceType> coefficients(DistanceType size_current, DistanceType size_left, DistanceType size_right)
+    {
+        return {(size_current + size_left)/(size_current + size_left + size_right), (size_current + size_right)/(size_current + size_left + size_right),
+                -size_current/(size_current + size_left + size_right), 0};
+    }
+
+    template <typename DistanceType>
+    typename distance_arithmetic<DistanceType>::type operator()(DistanceType d_left_right, std::size_t size_current, std::size_t size_left, std::size_t size_right, DistanceType d_to_left, DistanceType d_to_right) const
+    {
+        return LanceWilliamsUpdate<typename distance_arithmetic<DistanceType>::type>::ward_minimum_distance(d_left_right, size_current, size_left, size_right, d_to_left, d_to_right);
+    }
+};
+
+/*! \brief The engines that cluster a condensed distance matrix. */
+enum class LinkageEngine
+{
+    minimum_spanning_tree, //< mst_linkage, single linkage only
+    nn_chain,              //< nn_chain_linkage, reducible linkages only
+    generic,               //< generic_linkage, any linkage
+    naive                  //< condensed_linkage with the vector kernels, any linkage
+};
+
+/*! \brief The fastest valid engine for a linkage policy. */
+template <typename Policy>
+struct default_linkage_engine
+{
+    static constexpr LinkageEngine value = Policy::method == LinkageMethod::single_linkage ? LinkageEngine::minimum_spanning_tree
+                                           : Policy::reducible ? LinkageEngine::nn_chain : LinkageEngine::generic;
+};
+
+/*! \brief Tag for overload selection by engine. */
+template <LinkageEngine Engine>
+using linkage_engine_tag = std::integral_constant<LinkageEngine, Engine>;
+
+template <typename Policy, typename DistanceType>
+Linkage<DistanceType> hierarchical_linkage(CondensedDistanceMatrix<DistanceType> &distances, ThreadPool &pool, std::vector<std::size_t> leaf_sizes,
+                                           const MergeStop<DistanceType> &stop, linkage_engine_tag<LinkageEngine::minimum_spanning_tree>)
+{
+    static_assert(Policy::method == LinkageMethod::single_linkage, "The minimum spanning tree engine only computes single linkage.");
+    return mst_linkage(distances, pool, std::move(leaf_sizes), stop);
+}
+
+template <typename Policy, typename DistanceType>
+Linkage<DistanceType> hierarchical_linkage(CondensedDistanceMatrix<DistanceType> &distances, ThreadPool & /*pool*/, std::vector<std::size_t> leaf_sizes,
+                                           const MergeStop<DistanceType> &stop, linkage_engine_tag<LinkageEngine::nn_chain>)
+{
+    static_assert(Policy::reducible, "The NN-chain engine needs a reducible linkage.");
+    return nn_chain_linkage(distances, Policy(), std::move(leaf_sizes), stop);
+}
+
+template <typename Policy, typename DistanceType>
+Linkage<DistanceType> hierarchical_linkage(CondensedDistanceMatrix<DistanceType> &distances, ThreadPool & /*pool*/, std::vector<std::size_t> leaf_sizes,
+                                           const MergeStop<DistanceType> &stop, linkage_engine_tag<LinkageEngine::generic>)
+{
+    return generic_linkage(distances, Policy(), std::move(leaf_sizes), stop);
+}
+
+template <typename Policy, typename DistanceType>
+Linkage<DistanceType> hierarchical_linkage(CondensedDistanceMatrix<DistanceType> &distances, ThreadPool &pool, std::vector<std::size_t> leaf_sizes,
+                                           const MergeStop<DistanceType> &stop, linkage_engine_tag<LinkageEngine::naive>)
+{
+    return condensed_linkage(distances, Policy::method, pool, std::move(leaf_sizes), stop);
+}
+
+/*! \brief Hierarchical clustering of a condensed distance matrix with the engine chosen at compile time.
+ *
+ * \tparam Policy A linkage policy such as SingleLinkage or WardLinkage.
+ * \tparam Engine The engine, by default the fastest valid one: minimum spanning tree for single linkage,
+ *  NN-chain for the other reducible linkages and cached nearest neighbours (generic) for centroid and median.
+ *  Choosing an engine that cannot compute the linkage is a compile error.
+ * \param[in] distances Mutual distances of the leaves, overwritten by all engines but the minimum spanning tree.
+ * \param[in] pool Threads for the engines that use them.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Where to stop merging, which leaves an incomplete linkage with one tree per cluster left.
+ *  The engines that find merges in order of distance stop right there; NN-chain sets aside clusters that are
+ *  too far from all others and drops the merges beyond the number of clusters after sorting.
+ *
+ * Linkages of non-monotone policies are not sorted by distance, see Linkage::heights.
+ */
+template <typename Policy, LinkageEngine Engine = default_linkage_engine<Policy>::value, typename DistanceType>
+Linkage<DistanceType> hierarchical_linkage(CondensedDistanceMatrix<DistanceType> &distances, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                           const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    return hierarchical_linkage<Policy>(distances, pool, std::move(leaf_sizes), stop, linkage_engine_tag<Engine>());
+}
+
+/*! \brief Hierarchical clustering of a condensed distance matrix with the engine chosen at compile time, on a single thread. */
+template <typename Policy, LinkageEngine Engine = default_linkage_engine<Policy>::value, typename DistanceType>
+Linkage<DistanceType> hierarchical_linkage(CondensedDistanceMatrix<DistanceType> &distances)
+{
+    ThreadPool pool {1};
+    return hierarchical_linkage<Policy, Engine>(distances, pool);
+}
+
+/*! \brief Hierarchically merge items whose distances are stored in a condensed matrix, with the engine chosen at compile time.
+ *
+ * \tparam Policy A linkage policy such as SingleLinkage or WardLinkage.
+ * \tparam Clusterable The items to be clustered must provide DistanceType, merger and size.
+ * \param[in] distances Mutual distances of the items, may be overwritten during merging.
+ * \param[in] leaves One clusterable per row of the distance matrix.
+ * \param[in] pool Threads for the engines that use them.
+ */
+template <typename Policy, LinkageEngine Engine = default_linkage_engine<Policy>::value, typename Clusterable>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge(CondensedDistanceMatrix<typename Clusterable::DistanceType> &distances, std::vector<Clusterable> leaves, ThreadPool &pool)
+{
+    auto linkage = hierarchical_linkage<Policy, Engine>(distances, pool, leaf_sizes(leaves));
+    return linkage.tree(std::move(leaves));
+}
+
+/*! \brief Hierarchically merge items until a stop is reached, with the engine chosen at compile time.
+ *
+ * \tparam Policy A linkage policy such as SingleLinkage or WardLinkage.
+ * \tparam Clusterable The items to be clustered must provide DistanceType, merger and size.
+ * \param[in] distances Mutual distances of the items, may be overwritten during merging.
+ * \param[in] leaves One clusterable per row of the distance matrix.
+ * \param[in] pool Threads for the engines that use them.
+ * \param[in] stop Where to stop merging, see hierarchical_linkage.
+ * \returns One tree per cluster that is left, in the order of their cluster ids.
+ */
+template <typename Policy, LinkageEngine Engine = default_linkage_engine<Policy>::value, typename Clusterable>
+std::list < std::unique_ptr < BinaryTree < Clusterable>> > hierarchical_merge_forest(CondensedDistanceMatrix<typename Clusterable::DistanceType> &distances, std::vector<Clusterable> leaves, ThreadPool &pool,
+                                                                                 const MergeStop<typename Clusterable::DistanceType> &stop)
+{
+    auto linkage = hierarchical_linkage<Policy, Engine>(distances, pool, leaf_sizes(leaves), stop);
+    return linkage.forest(std::move(leaves));
+}
+
+/*! \brief Hierarchically merge list items with the engine chosen at compile time, copying their distances into one condensed matrix first.
+ *
+ * Drop-in replacement for hierarchical_merge_into_tree(items, LanceWilliamsUpdate<...>::xxx) as hierarchical_merge<XxxLinkage>(items).
+ */
+template <typename Policy, LinkageEngine Engine = default_linkage_engine<Policy>::value, typename Clusterable>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge(std::list<Clusterable> &items_to_cluster)
+{
+    CondensedDistanceMatrix<typename Clusterable::DistanceType> distances {items_to_cluster};
+    ThreadPool pool {1};
+    return hierarchical_merge<Policy, Engine>(distances, leaves_without_distances(items_to_cluster), pool);
+}
+
+#endif /* end of include guard: LINKAGE_POLICIES_H_ */
@@ -0,0 +1,1643 @@
+/*
+ * linkagetest.cpp
+ *      Author: cblau@gwdg.de
+ *
+ * Checks the engines and tools built on Linkage against dense reference clusterings.
+ * Returns non-zero if any check fails.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batchlinkage.h"
+#include "centroidlinkage.h"
+#include "cluster.h"
+#include "clusterobserver.h"
+#include "clustersummary.h"
+#include "compactdistance.h"
+#include "condensedcluster.h"
+#include "dendrogramio.h"
+#include "distancecluster.h"
+#include "distancematrixbuilder.h"
+#include "distancematrixfile.h"
+#include "flatclusters.h"
+#include "incrementallinkage.h"
+#include "kdtreelinkage.h"
+#include "leafordering.h"
+#include "linkagepolicies.h"
+#include "shardedlinkage.h"
+#include "sparselinkage.h"
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool condition, const std::string &what)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+/* Uniformly random distances; each is kept with probability keep, the others are infinite */
+CondensedDistanceMatrix<double> random_matrix(std::size_t n, unsigned seed, double keep = 1)
+{
+    std::mt19937                           generator {seed};
+    std::uniform_real_distribution<double> distance {0, 10}, coin {0, 1};
+    CondensedDistanceMatrix<double>        matrix {n};
+    for (std::size_t k = 0; k < matrix.length(); ++k)
+    {
+        const auto d = distance(generator);
+        matrix.data()[k] = coin(generator) < keep ? d : std::numeric_limits<double>::infinity();
+    }
+    return matrix;
+}
+
+CondensedDistanceMatrix<double> copy_matrix(const CondensedDistanceMatrix<double> &matrix)
+{
+    CondensedDistanceMatrix<double> copy {matrix.size()};
+    std::copy(matrix.data(), matrix.data() + matrix.length(), copy.data());
+    return copy;
+}
+
+/* The finite distances of a matrix as a sparse list */
+std::vector < SparseDistance < double>> finite_distances(const CondensedDistanceMatrix<double> &matrix)
+{
+    std::vector < SparseDistance < double>> distances {};
+    for (std::size_t i = 0; i < matrix.size(); ++i)
+    {
+        for (auto j = i+1; j < matrix.size(); ++j)
+        {
+            if (std::isfinite(matrix(i, j)))
+            {
+                distances.push_back({i, j, matrix(i, j)});
+            }
+        }
+    }
+    return distances;
+}
+
+bool same_merges(const Linkage<double> &a, const Linkage<double> &b, double tolerance = 0)
+{
+    if (a.leaves() != b.leaves() || a.size() != b.size())
+    {
+        return false;
+    }
+    for (std::size_t k = 0; k < a.size(); ++k)
+    {
+        if (a[k].left != b[k].left || a[k].right != b[k].right || a[k].size != b[k].size || std::abs(a[k].distance - b[k].distance) > tolerance)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Same merge distances and sizes, whatever the order of the two parts of a merge */
+bool same_distances(const Linkage<double> &a, const Linkage<double> &b, double tolerance)
+{
+    if (a.leaves() != b.leaves() || a.size() != b.size())
+    {
+        return false;
+    }
+    for (std::size_t k = 0; k < a.size(); ++k)
+    {
+        if (a[k].size != b[k].size || std::abs(a[k].distance - b[k].distance) > tolerance)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The merges of a dense linkage below infinity, which is what sparse input yields */
+Linkage<double> finite_merges(const Linkage<double> &linkage)
+{
+    Linkage<double> finite {linkage.leaves()};
+    for (const auto &step : linkage)
+    {
+        if (std::isfinite(step.distance))
+        {
+            finite.push_back(step);
+        }
+    }
+    return finite;
+}
+
+/* The members of each cluster a linkage forms, with the distance of the merge that formed it */
+std::map < std::vector < std::size_t>, double> linkage_clusters(const Linkage<double> &linkage)
+{
+    std::vector < std::vector < std::size_t>> members(linkage.leaves() + linkage.size());
+    for (std::size_t i = 0; i < linkage.leaves(); ++i)
+    {
+        members[i] = {i};
+    }
+    std::map < std::vector < std::size_t>, double> clusters {};
+    for (std::size_t k = 0; k < linkage.size(); ++k)
+    {
+        auto &merged = members[linkage.leaves() + k];
+        std::merge(std::begin(members[linkage[k].left]), std::end(members[linkage[k].left]), std::begin(members[linkage[k].right]), std::end(members[linkage[k].right]),
+                   std::back_inserter(merged));
+        clusters[merged] = linkage[k].distance;
+    }
+    return clusters;
+}
+
+/* The clusters of the original list engine, hierarchical_merge_into_tree, in the form of linkage_clusters */
+template <typename MergeFunction>
+std::map < std::vector < std::size_t>, double> list_clusters(const CondensedDistanceMatrix<double> &matrix, MergeFunction merge)
+{
+    std::list < BasicDistanceCluster < double>> items {};
+    for (std::size_t i = 0; i < matrix.size(); ++i)
+    {
+        items.emplace_back(std::vector<double>(matrix.row(i), matrix.row(i) + matrix.size()-i-1), std::vector<std::size_t> {i});
+    }
+    auto tree = hierarchical_merge_into_tree(items, merge);
+    std::map < std::vector < std::size_t>, double> clusters {};
+    for (auto &branch : *tree)
+    {
+        if ((*branch).size() > 1)
+        {
+            auto elements = (*branch).elements();
+            std::sort(std::begin(elements), std::end(elements));
+            clusters[elements] = (*branch).merge_distance();
+        }
+    }
+    return clusters;
+}
+
+bool same_clusters(const std::map < std::vector < std::size_t>, double> &a, const std::map < std::vector < std::size_t>, double> &b, double tolerance)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (auto x = std::begin(a), y = std::begin(b); x != std::end(a); ++x, ++y)
+    {
+        if (x->first != y->first || std::abs(x->second - y->second) > tolerance*std::max(1.0, std::abs(x->second)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Each engine against the list engine, for every linkage it supports */
+void test_list_reference()
+{
+    typedef LanceWilliamsUpdate<double> LW;
+    const struct
+    {
+        const char * name;
+        double       (*merge)(double, std::size_t, std::size_t, std::size_t, double, double);
+        LinkageMethod method;
+    } linkages[] = {
+        {"single", LW::single_linkage, LinkageMethod::single_linkage},
+        {"complete", LW::complete_linkage, LinkageMethod::complete_linkage},
+        {"simple average", LW::simple_average, LinkageMethod::simple_average},
+        {"centroid", LW::centroid, LinkageMethod::centroid},
+        {"median", LW::median, LinkageMethod::median},
+        {"group average", LW::group_average, LinkageMethod::group_average},
+        {"ward", LW::ward_minimum_distance, LinkageMethod::ward_minimum_distance}
+    };
+    ThreadPool pool {2};
+    for (const auto &linkage : linkages)
+    {
+        for (unsigned seed = 0; seed < 3; ++seed)
+        {
+            const auto matrix    = random_matrix(60, 100 + seed);
+            const auto reference = list_clusters(matrix, linkage.merge);
+            const auto name      = std::string(linkage.name);
+
+            auto distances = copy_matrix(matrix);
+            check(same_clusters(linkage_clusters(condensed_linkage(distances, linkage.method, pool)), reference, 1e-9), "condensed_linkage matches the list engine for " + name);
+            if (linkage.method != LinkageMethod::centroid && linkage.method != LinkageMethod::median)
+            {
+                distances = copy_matrix(matrix);
+                check(same_clusters(linkage_clusters(nn_chain_linkage(distances, linkage.merge)), reference, 1e-9), "nn_chain_linkage matches the list engine for " + name);
+            }
+            distances = copy_matrix(matrix);
+            check(same_clusters(linkage_clusters(generic_linkage(distances, linkage.merge)), reference, 1e-9), "generic_linkage matches the list engine for " + name);
+            if (linkage.method == LinkageMethod::single_linkage)
+            {
+                check(same_clusters(linkage_clusters(mst_linkage(matrix, pool)), reference, 1e-9), "mst_linkage matches the list engine for " + name);
+            }
+        }
+    }
+}
+
+void test_thread_pool()
+{
+    ThreadPool               pool {4};
+    std::vector<std::size_t> finished(pool.size(), 0);
+    bool                     thrown = false;
+    try
+    {
+        pool.run([&](std::size_t thread){
+                     if (thread == 2)
+                     {
+                         throw std::runtime_error("Task failed.");
+                     }
+                     std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                     finished[thread] = 1;
+                 });
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    check(thrown, "ThreadPool::run rethrows the exception of a task");
+    check(finished[0] == 1 && finished[1] == 1 && finished[3] == 1, "ThreadPool::run waits for all threads before it rethrows");
+    std::size_t runs = 0;
+    pool.run([&](std::size_t thread){
+                 if (thread == 0)
+                 {
+                     ++runs;
+                 }
+             });
+    check(runs == 1, "ThreadPool runs tasks after a task failed");
+}
+
+/* The same merges, exactly, whatever the number of threads */
+void test_thread_counts()
+{
+    const LinkageMethod methods[] = {LinkageMethod::single_linkage, LinkageMethod::complete_linkage, LinkageMethod::simple_average, LinkageMethod::centroid,
+                                     LinkageMethod::median, LinkageMethod::group_average, LinkageMethod::ward_minimum_distance};
+    const auto matrix = random_matrix(150, 21);
+    for (auto method : methods)
+    {
+        ThreadPool single {1};
+        auto       distances = copy_matrix(matrix);
+        const auto reference = condensed_linkage(distances, method, single);
+        for (std::size_t threads : {2, 3, 7})
+        {
+            ThreadPool pool {threads};
+            distances = copy_matrix(matrix);
+            check(same_merges(condensed_linkage(distances, method, pool), reference), "condensed_linkage gives the same merges on " + std::to_string(threads) + " threads as on one");
+        }
+    }
+    ThreadPool single {1};
+    const auto reference = mst_linkage(matrix, single);
+    for (std::size_t threads : {2, 3, 7})
+    {
+        ThreadPool pool {threads};
+        check(same_merges(mst_linkage(matrix, pool), reference), "mst_linkage gives the same merges on " + std::to_string(threads) + " threads as on one");
+    }
+}
+
+/* The float kernels, vectorized where SSE or AVX is available, against the generic ones */
+void test_kernels()
+{
+    std::mt19937                          generator {5};
+    std::uniform_real_distribution<float> distance {0, 10}, coin {0, 1};
+    const auto                            infinity = std::numeric_limits<float>::infinity();
+    for (std::size_t length = 1; length < 70; ++length)
+    {
+        std::vector<float> left(length), right(length), sizes(length);
+        for (std::size_t k = 0; k < length; ++k)
+        {
+            left[k]  = coin(generator) < 0.1 ? infinity : distance(generator);
+            right[k] = coin(generator) < 0.1 ? infinity : distance(generator);
+            sizes[k] = 1 + static_cast<float>(generator() % 5);
+        }
+        check(row_minimum(left.data(), length) == row_minimum<float>(left.data(), length), "row_minimum matches the generic kernel");
+
+        std::vector<float> vectorized(length), generic(length);
+        minimum_row(left.data(), right.data(), vectorized.data(), length);
+        minimum_row<float>(left.data(), right.data(), generic.data(), length);
+        check(vectorized == generic, "minimum_row matches the generic kernel");
+        maximum_row(left.data(), right.data(), vectorized.data(), length);
+        maximum_row<float>(left.data(), right.data(), generic.data(), length);
+        check(vectorized == generic, "maximum_row matches the generic kernel");
+
+        auto close = [&](){
+                for (std::size_t k = 0; k < length; ++k)
+                {
+                    if (!(vectorized[k] == generic[k] || std::abs(vectorized[k] - generic[k]) <= 1e-5f*std::abs(generic[k])))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            };
+        affine_row(0.3f, 0.7f, -0.5f, left.data(), right.data(), vectorized.data(), length);
+        affine_row<float>(0.3f, 0.7f, -0.5f, left.data(), right.data(), generic.data(), length);
+        check(close(), "affine_row matches the generic kernel");
+        ward_row(4.0f, 2.0f, 3.0f, sizes.data(), left.data(), right.data(), vectorized.data(), length);
+        ward_row<float>(4.0f, 2.0f, 3.0f, sizes.data(), left.data(), right.data(), generic.data(), length);
+        check(close(), "ward_row matches the generic kernel");
+
+        /* NaN is skipped wherever it is */
+        auto with_nan = left;
+        with_nan[generator() % length] = std::numeric_limits<float>::quiet_NaN();
+        const auto minimum = row_minimum(with_nan.data(), length);
+        check(minimum.first == row_minimum<float>(with_nan.data(), length).first && minimum.first < length, "row_minimum skips NaN like the generic kernel");
+        std::vector<float> nan_only(length, std::numeric_limits<float>::quiet_NaN());
+        check(row_minimum(nan_only.data(), length).first < length, "row_minimum stays inside a row of NaN");
+
+        /* Merging two clusters at infinite distance keeps the averages finite where they were */
+        for (auto method : {LinkageMethod::simple_average, LinkageMethod::group_average})
+        {
+            lance_williams_update_row(method, infinity, 2.0f, 3.0f, sizes.data(), left.data(), right.data(), vectorized.data(), length);
+            bool defined = true;
+            for (auto d : vectorized)
+            {
+                defined = defined && !std::isnan(d);
+            }
+            check(defined, "lance_williams_update_row of an infinitely distant pair has no NaN");
+        }
+    }
+}
+
+/* The distances among the first m elements of a matrix */
+CondensedDistanceMatrix<double> leading_matrix(const CondensedDistanceMatrix<double> &matrix, std::size_t m)
+{
+    CondensedDistanceMatrix<double> leading {m};
+    for (std::size_t i = 0; i < m; ++i)
+    {
+        std::copy(matrix.row(i), matrix.row(i) + m-i-1, leading.row(i));
+    }
+    return leading;
+}
+
+void test_incremental()
+{
+    const auto matrix = random_matrix(70, 31);
+    ThreadPool pool {2};
+
+    /* Grown one item at a time, from nothing and from a batch of 30 */
+    for (std::size_t start : {0, 30})
+    {
+        auto exact  = start == 0 ? IncrementalSingleLinkage<double>() : IncrementalSingleLinkage<double>(leading_matrix(matrix, start), pool);
+        auto approx = incremental_linkage(mst_linkage(leading_matrix(matrix, start), pool), LanceWilliamsUpdate<double>::group_average);
+        bool same   = true, complete = true;
+        for (auto m = start; m < matrix.size(); ++m)
+        {
+            std::vector<double> distances(m);
+            for (std::size_t i = 0; i < m; ++i)
+            {
+                distances[i] = matrix(i, m);
+            }
+            exact.insert(distances);
+            approx.insert(distances);
+            same = same && linkage_clusters(exact.linkage()) == linkage_clusters(mst_linkage(leading_matrix(matrix, m+1), pool));
+
+            const auto grown   = approx.linkage();
+            const auto heights = grown.heights();
+            complete = complete && grown.leaves() == m+1 && grown.size() == m && (m == 0 || grown[m-1].size == m+1)
+                && std::is_sorted(std::begin(heights), std::end(heights));
+        }
+        check(same, "IncrementalSingleLinkage matches mst_linkage after every insertion");
+        check(complete, "IncrementalLinkage keeps a complete, monotone dendrogram of all items");
+    }
+}
+
+/* The largest eigenvalue of a symmetric 4x4 matrix by cyclic Jacobi rotations */
+double largest_eigenvalue(double a[4][4])
+{
+    for (int sweep = 0; sweep < 50; ++sweep)
+    {
+        for (int p = 0; p < 4; ++p)
+        {
+            for (int q = p+1; q < 4; ++q)
+            {
+                if (std::abs(a[p][q]) < 1e-300)
+                {
+                    continue;
+                }
+                const auto theta = (a[q][q] - a[p][p])/(2*a[p][q]);
+                const auto t     = (theta >= 0 ? 1 : -1)/(std::abs(theta) + std::sqrt(theta*theta + 1));
+                const auto c     = 1/std::sqrt(t*t + 1), s = t*c;
+                for (int k = 0; k < 4; ++k)
+                {
+                    const auto kp = a[k][p], kq = a[k][q];
+                    a[k][p] = c*kp - s*kq;
+                    a[k][q] = s*kp + c*kq;
+                }
+                for (int k = 0; k < 4; ++k)
+                {
+                    const auto pk = a[p][k], qk = a[q][k];
+                    a[p][k] = c*pk - s*qk;
+                    a[q][k] = s*pk + c*qk;
+                }
+            }
+        }
+    }
+    return std::max(std::max(a[0][0], a[1][1]), std::max(a[2][2], a[3][3]));
+}
+
+/* RMSD after optimal superposition from the eigenvalues of Horn's key matrix, in double precision */
+double reference_rmsd(const float * a, const float * b, std::size_t atoms)
+{
+    double center_a[3] = {0, 0, 0}, center_b[3] = {0, 0, 0};
+    for (std::size_t atom = 0; atom < atoms; ++atom)
+    {
+        for (int x = 0; x < 3; ++x)
+        {
+            center_a[x] += a[3*atom + x]/static_cast<double>(atoms);
+            center_b[x] += b[3*atom + x]/static_cast<double>(atoms);
+        }
+    }
+    double s[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}}, g = 0;
+    for (std::size_t atom = 0; atom < atoms; ++atom)
+    {
+        for (int x = 0; x < 3; ++x)
+        {
+            const auto ax = a[3*atom + x] - center_a[x], bx = b[3*atom + x] - center_b[x];
+            g += ax*ax + bx*bx;
+            for (int y = 0; y < 3; ++y)
+            {
+                s[x][y] += ax*(b[3*atom + y] - center_b[y]);
+            }
+        }
+    }
+    double key[4][4] = {
+        {s[0][0] + s[1][1] + s[2][2], s[1][2] - s[2][1], s[2][0] - s[0][2], s[0][1] - s[1][0]},
+        {s[1][2] - s[2][1], s[0][0] - s[1][1] - s[2][2], s[0][1] + s[1][0], s[2][0] + s[0][2]},
+        {s[2][0] - s[0][2], s[0][1] + s[1][0], -s[0][0] + s[1][1] - s[2][2], s[1][2] + s[2][1]},
+        {s[0][1] - s[1][0], s[2][0] + s[0][2], s[1][2] + s[2][1], -s[0][0] - s[1][1] + s[2][2]}
+    };
+    return std::sqrt(std::max(0.0, (g - 2*largest_eigenvalue(key))/atoms));
+}
+
+bool close_to(double value, double reference, double tolerance)
+{
+    return std::abs(value - reference) <= tolerance*std::max(1.0, std::abs(reference));
+}
+
+/* Tiled distance matrices against a pair by pair computation */
+void test_distance_matrices(const std::string &directory)
+{
+    std::mt19937                          generator {8};
+    std::normal_distribution<float>       coordinate {0, 3};
+    const std::size_t                     n = 90, atoms = 20;
+    std::vector<float>                    values(n*3*atoms);
+    for (auto &x : values)
+    {
+        x = coordinate(generator);
+    }
+    /* Every tenth structure is a rotated and shifted copy of the one before, at RMSD zero */
+    for (std::size_t i = 1; i < n; i += 10)
+    {
+        const double angle = 0.3*i, c = std::cos(angle), s = std::sin(angle);
+        for (std::size_t atom = 0; atom < atoms; ++atom)
+        {
+            const auto from = &values[(i-1)*3*atoms + 3*atom];
+            const auto to   = &values[i*3*atoms + 3*atom];
+            to[0] = static_cast<float>(c*from[0] - s*from[1] + 5);
+            to[1] = static_cast<float>(s*from[0] + c*from[1] - 2);
+            to[2] = from[2] + 1;
+        }
+    }
+    const Coordinates<float> points {values, 3*atoms};
+    ThreadPool               pool {3};
+
+    for (auto metric : {Metric::euclidean, Metric::squared_euclidean, Metric::cosine, Metric::rmsd})
+    {
+        const auto matrix  = distance_matrix(points, metric, pool);
+        bool       correct = true;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            for (auto j = i+1; j < n; ++j)
+            {
+                const auto a = points.point(i), b = points.point(j);
+                double     squared = 0, dot = 0, norm_a = 0, norm_b = 0;
+                for (std::size_t k = 0; k < points.dimension(); ++k)
+                {
+                    squared += (a[k] - static_cast<double>(b[k]))*(a[k] - static_cast<double>(b[k]));
+                    dot     += a[k]*static_cast<double>(b[k]);
+                    norm_a  += a[k]*static_cast<double>(a[k]);
+                    norm_b  += b[k]*static_cast<double>(b[k]);
+                }
+                double reference = std::sqrt(squared);
+                switch (metric)
+                {
+                    case Metric::squared_euclidean: reference = squared; break;
+                    case Metric::cosine: reference = 1 - dot/std::sqrt(norm_a*norm_b); break;
+                    case Metric::rmsd: reference = reference_rmsd(a, b, atoms); break;
+                    default: break;
+                }
+                correct = correct && close_to(matrix(i, j), reference, 1e-4);
+            }
+        }
+        check(correct, "distance_matrix matches the distances computed pair by pair");
+
+        const auto filename = directory + "/points.bin";
+        {
+            DistanceMatrixWriter<float> writer {filename, std::vector<std::size_t>(n, 0)};
+            write_distance_matrix(points, metric, writer, pool);
+            writer.close();
+        }
+        const auto written = map_distance_matrix<float>(filename);
+        check(std::equal(matrix.data(), matrix.data() + matrix.length(), written.data()), "write_distance_matrix writes what distance_matrix computes");
+        std::remove(filename.c_str());
+    }
+
+    const RmsdDistance<float> rmsd {points};
+    bool                      superposed = true;
+    for (std::size_t i = 1; i < n; i += 10)
+    {
+        superposed = superposed && rmsd(i-1, i) < 1e-3;
+    }
+    check(superposed, "RmsdDistance of a rotated and shifted copy is zero");
+}
+
+/* Random points in a box of width 10, in double precision */
+Coordinates<double> random_points(std::size_t n, std::size_t d, unsigned seed)
+{
+    std::mt19937                           generator {seed};
+    std::uniform_real_distribution<double> coordinate {0, 10};
+    std::vector<double>                    values(n*d);
+    for (auto &x : values)
+    {
+        x = coordinate(generator);
+    }
+    return Coordinates<double>(std::move(values), d);
+}
+
+/* The matrix-free engines against the matrix engines on squared Euclidean distances */
+void test_matrix_free()
+{
+    typedef LanceWilliamsUpdate<double> LW;
+    ThreadPool pool {3};
+    for (unsigned seed = 0; seed < 3; ++seed)
+    {
+        const auto points  = random_points(80, 3, 40 + seed);
+        const auto squared = distance_matrix(points, Metric::squared_euclidean, pool);
+
+        auto distances = copy_matrix(squared);
+        check(same_clusters(linkage_clusters(centroid_linkage(points, LinkageMethod::ward_minimum_distance, pool)), linkage_clusters(nn_chain_linkage(distances, LW::ward_minimum_distance)), 1e-9),
+              "matrix-free Ward matches nn_chain_linkage");
+        distances = copy_matrix(squared);
+        check(same_clusters(linkage_clusters(centroid_linkage(points, LinkageMethod::centroid, pool)), linkage_clusters(generic_linkage(distances, LW::centroid)), 1e-9),
+              "matrix-free centroid matches generic_linkage");
+        distances = copy_matrix(squared);
+        check(same_clusters(linkage_clusters(centroid_linkage(points, LinkageMethod::median, pool)), linkage_clusters(generic_linkage(distances, LW::median)), 1e-9),
+              "matrix-free median matches generic_linkage");
+
+        /* Points that stand for several elements, against leaves at the weighted distance 2 w_i w_j / (w_i + w_j) |x_i - x_j|^2 */
+        std::vector<std::size_t> sizes(points.size());
+        for (std::size_t i = 0; i < sizes.size(); ++i)
+        {
+            sizes[i] = 1 + (i*7) % 4;
+        }
+        CondensedDistanceMatrix<double> weighted {points.size()};
+        for (std::size_t i = 0; i < points.size(); ++i)
+        {
+            for (auto j = i+1; j < points.size(); ++j)
+            {
+                weighted.row(i)[j-i-1] = 2.0*sizes[i]*sizes[j]/(sizes[i] + sizes[j])*squared(i, j);
+            }
+        }
+        check(same_clusters(linkage_clusters(ward_linkage(points, pool, sizes)), linkage_clusters(nn_chain_linkage(weighted, LW::ward_minimum_distance, sizes)), 1e-9),
+              "matrix-free Ward of weighted points matches nn_chain_linkage on weighted distances");
+    }
+}
+
+void test_kd_tree()
+{
+    typedef LanceWilliamsUpdate<double> LW;
+    ThreadPool one {1};
+    ThreadPool pool {4};
+    for (unsigned seed = 0; seed < 3; ++seed)
+    {
+        for (auto dimension : {2, 5})
+        {
+            const auto points    = random_points(300, dimension, 60 + seed);
+            const auto euclidean = distance_matrix(points, Metric::euclidean, pool);
+            const auto squared   = distance_matrix(points, Metric::squared_euclidean, pool);
+
+            const auto single = kd_tree_single_linkage(points, pool);
+            check(same_clusters(linkage_clusters(single), linkage_clusters(mst_linkage(euclidean, pool)), 1e-9), "kd-tree single linkage matches mst_linkage");
+            check(same_merges(single, kd_tree_single_linkage(points, one)), "kd-tree single linkage does not depend on the number of threads");
+
+            auto       distances = copy_matrix(squared);
+            const auto ward      = kd_tree_ward_linkage(points, pool);
+            check(same_clusters(linkage_clusters(ward), linkage_clusters(nn_chain_linkage(distances, LW::ward_minimum_distance)), 1e-9), "kd-tree Ward matches nn_chain_linkage");
+            check(same_clusters(linkage_clusters(ward), linkage_clusters(ward_linkage(points, pool)), 1e-9), "kd-tree Ward matches ward_linkage");
+            check(same_merges(ward, kd_tree_ward_linkage(points, one)), "kd-tree Ward does not depend on the number of threads");
+        }
+    }
+
+    /* Points on a grid, full of ties, and points that chain, which the rounds of reciprocal neighbours stop early on */
+    std::vector<double> grid_values {}, line_values {};
+    for (std::size_t i = 0; i < 400; ++i)
+    {
+        grid_values.insert(std::end(grid_values), {double(i % 20), double(i / 20)});
+        line_values.push_back(0.5*i*(i+1));
+    }
+    const Coordinates<double> grid {grid_values, 2};
+    const Coordinates<double> line {line_values, 1};
+    for (auto points : {&grid, &line})
+    {
+        const auto single = kd_tree_single_linkage(*points, pool);
+        check(same_distances(single, mst_linkage(distance_matrix(*points, Metric::euclidean, pool), pool), 1e-9), "kd-tree single linkage has the heights of mst_linkage");
+        const auto ward = kd_tree_ward_linkage(*points, pool);
+        check(ward.size() == points->size()-1 && same_merges(ward, kd_tree_ward_linkage(*points, one)), "kd-tree Ward merges all points the same way on any number of threads");
+    }
+    auto distances = distance_matrix(line, Metric::squared_euclidean, pool);
+    check(same_clusters(linkage_clusters(kd_tree_ward_linkage(line, pool)), linkage_clusters(nn_chain_linkage(distances, LW::ward_minimum_distance)), 1e-9), "kd-tree Ward matches nn_chain_linkage on a chain");
+}
+
+/* The matrix-free, kd-tree and incremental engines stop where the matrix engines stop */
+void test_merge_stop()
+{
+    typedef LanceWilliamsUpdate<double> LW;
+    ThreadPool pool {4};
+    const auto points    = random_points(300, 2, 70);
+    const auto euclidean = distance_matrix(points, Metric::euclidean, pool);
+    const auto squared   = distance_matrix(points, Metric::squared_euclidean, pool);
+
+    /* Stop by distance with 20 clusters left, by count, and by distance with the count coming first;
+     * the distance lies halfway between two merges, so rounding does not decide where the engines stop */
+    auto halfway = [&points](const Linkage<double> &linkage){ return (linkage[points.size()-21].distance + linkage[points.size()-20].distance)/2; };
+    auto       distances       = copy_matrix(squared);
+    const auto ward_height     = halfway(kd_tree_ward_linkage(points, pool));
+    const auto single_height   = halfway(mst_linkage(euclidean, pool));
+    const auto centroid_height = halfway(generic_linkage(distances, LW::centroid));
+    for (std::size_t kind = 0; kind < 3; ++kind)
+    {
+        auto stop_at = [kind](double height){
+                return kind == 0 ? MergeStop<double>::at_distance(height) : (kind == 1 ? MergeStop<double>::at_clusters(7) : MergeStop<double>(height, 40));
+            };
+        const std::size_t              clusters = kind == 0 ? 20 : (kind == 1 ? 7 : 40);
+        const std::vector<std::size_t> ones {};
+
+        distances = copy_matrix(squared);
+        const auto ward = nn_chain_linkage(distances, LW::ward_minimum_distance, ones, stop_at(ward_height));
+        check(ward.size() == points.size() - clusters, "nn_chain_linkage stops at the distance or count");
+        check(same_clusters(linkage_clusters(ward_linkage(points, pool, ones, stop_at(ward_height))), linkage_clusters(ward), 1e-9), "matrix-free Ward stops as nn_chain_linkage");
+        check(same_clusters(linkage_clusters(centroid_linkage(points, LinkageMethod::ward_minimum_distance, pool, ones, stop_at(ward_height))), linkage_clusters(ward), 1e-9),
+              "centroid_linkage passes the stop on to Ward");
+        check(same_clusters(linkage_clusters(kd_tree_ward_linkage(points, pool, ones, stop_at(ward_height))), linkage_clusters(ward), 1e-9), "kd-tree Ward stops as nn_chain_linkage");
+
+        distances = copy_matrix(squared);
+        const auto centroid = generic_linkage(distances, LW::centroid, ones, stop_at(centroid_height));
+        check(centroid.size() == points.size() - clusters, "generic_linkage stops at the distance or count");
+        check(same_clusters(linkage_clusters(centroid_linkage(points, LinkageMethod::centroid, pool, ones, stop_at(centroid_height))), linkage_clusters(centroid), 1e-9),
+              "matrix-free centroid stops as generic_linkage");
+
+        const auto single = mst_linkage(euclidean, pool, ones, stop_at(single_height));
+        check(single.size() == points.size() - clusters, "mst_linkage stops at the distance or count");
+        check(same_merges(kd_tree_single_linkage(points, pool, ones, stop_at(single_height)), single, 1e-9), "kd-tree single linkage stops as mst_linkage");
+        check(same_merges(IncrementalSingleLinkage<double>(euclidean, pool).linkage(ones, stop_at(single_height)), single), "IncrementalSingleLinkage stops as mst_linkage");
+    }
+}
+
+void test_cluster_statistics()
+{
+    const auto matrix = random_matrix(60, 7);
+    auto items = [&](){
+            std::list < BasicDistanceCluster < double>> result {};
+            for (std::size_t i = 0; i < matrix.size(); ++i)
+            {
+                result.emplace_back(std::vector<double>(matrix.row(i), matrix.row(i) + matrix.size()-i-1), std::vector<std::size_t> {i});
+            }
+            return result;
+        };
+    auto reference = items();
+    auto expected  = hierarchical_merge_into_tree(reference, LanceWilliamsUpdate<double>::group_average);
+
+    /* Progress after every merge: merges count up, time only passes, and the estimate ends at zero */
+    std::vector<ClusterProgress> reports {};
+    ClusterStatistics            statistics {[&reports](const ClusterProgress &progress){ reports.push_back(progress); }, 0};
+    std::size_t                  allocations = 0;
+    statistics.count_allocations([&allocations](){ return allocations += 2; });
+    auto clustered = items();
+    auto tree      = hierarchical_merge_into_tree(clustered, LanceWilliamsUpdate<double>::group_average, statistics);
+
+    check((**tree).merge_distance() == (**expected).merge_distance(), "observed clustering gives the same tree");
+    check(statistics.merges() == matrix.size()-1, "ClusterStatistics counts every merge");
+    check(reports.size() == matrix.size(), "progress is reported after every merge and once at the end");
+    bool ordered = true;
+    for (std::size_t k = 0; k < reports.size(); ++k)
+    {
+        ordered = ordered && reports[k].total_merges == matrix.size()-1 && reports[k].merges == std::min(k+1, matrix.size()-1)
+                  && reports[k].elapsed_seconds >= 0 && reports[k].eta_seconds >= 0 && (k == 0 || reports[k].elapsed_seconds >= reports[k-1].elapsed_seconds);
+    }
+    check(ordered, "progress reports count up merges and elapsed time");
+    check(reports[reports.size()-2].merges == matrix.size()-1 && reports[reports.size()-2].elapsed_seconds > 0,
+          "the report of the last merge has the time elapsed so far");
+    check(reports.back().eta_seconds == 0 && reports.back().elapsed_seconds == statistics.elapsed_seconds(), "the final report has the total time and nothing left");
+    check(statistics.allocations() == 2, "allocations are counted from start to finish");
+    check(statistics.distance_reads() > 0 && statistics.distance_writes() > 0, "distance reads and writes are counted");
+    double phases = 0;
+    for (std::size_t phase = 0; phase < static_cast<std::size_t>(ClusterPhase::count); ++phase)
+    {
+        phases += statistics.seconds(static_cast<ClusterPhase>(phase));
+    }
+    check(phases > 0 && phases <= statistics.elapsed_seconds(), "phase timings add up to at most the elapsed time");
+
+    /* A long interval only reports at the end */
+    std::size_t       calls = 0;
+    ClusterStatistics sparse {[&calls](const ClusterProgress &){ ++calls; }, 3600};
+    clustered = items();
+    hierarchical_merge_into_tree(clustered, LanceWilliamsUpdate<double>::group_average, sparse);
+    check(calls == 1, "progress with a long interval is only reported at the end");
+}
+
+/* The range of the quantized distances in the tests */
+struct TestRange
+{
+    static float lowest() { return 0; };
+    static float highest() { return 32768; };
+};
+
+template <typename DistanceType>
+Linkage<double> widened(const Linkage<DistanceType> &linkage)
+{
+    Linkage<double> result {linkage.leaves()};
+    for (const auto &step : linkage)
+    {
+        result.push_back({step.left, step.right, static_cast<float>(step.distance), step.size});
+    }
+    return result;
+}
+
+/* A policy on an engine with the distances stored as DistanceType, against the same distances as float.
+ * With a tolerance, rounding may swap merges of nearly the same height, so only the cut into groups
+ * and the heights of the merges above it are compared. */
+template <typename DistanceType, typename Policy, LinkageEngine Engine>
+void check_compact(const std::vector<float> &values, std::size_t n, double relative_tolerance, const std::string &name)
+{
+    const std::size_t                     groups = 5;
+    ThreadPool                            pool {2};
+    CondensedDistanceMatrix<DistanceType> compact {n};
+    CondensedDistanceMatrix<float>        exact {n};
+    for (std::size_t k = 0; k < values.size(); ++k)
+    {
+        compact.data()[k] = DistanceType(values[k]);
+        exact.data()[k]   = values[k];
+    }
+    const auto result    = widened(hierarchical_linkage<Policy, Engine>(compact, pool));
+    const auto reference = widened(hierarchical_linkage<Policy, Engine>(exact, pool));
+    const auto engine    = " on engine " + std::to_string(static_cast<int>(Engine));
+    if (relative_tolerance == 0)
+    {
+        check(same_merges(result, reference), name + " gives exactly the float merges" + engine);
+        return;
+    }
+    bool close = result.size() == n-1 && reference.size() == n-1 && cut_into(result, groups) == cut_into(reference, groups);
+    for (auto k = n-groups; close && k < n-1; ++k)
+    {
+        close = std::abs(result[k].distance - reference[k].distance) <= relative_tolerance*reference[k].distance;
+    }
+    check(close, name + " gives the float clusters and heights" + engine);
+}
+
+template <typename DistanceType, typename Policy>
+void check_compact(const std::vector<float> &values, std::size_t n, double relative_tolerance, const std::string &name)
+{
+    check_compact<DistanceType, Policy, LinkageEngine::nn_chain>(values, n, relative_tolerance, name);
+    check_compact<DistanceType, Policy, LinkageEngine::generic>(values, n, relative_tolerance, name);
+    check_compact<DistanceType, Policy, LinkageEngine::naive>(values, n, relative_tolerance, name);
+}
+
+template <typename DistanceType>
+void check_compact_type(const std::string &name, double tolerance)
+{
+    const std::size_t n = 60;
+    std::mt19937      generator {17};
+
+    /* Integers up to 255 are exact in the 16 bit floating point types, and minimum and maximum create no new values */
+    std::vector<float> integers(n*(n-1)/2);
+    for (auto &d : integers)
+    {
+        d = 1 + generator() % 255;
+    }
+    const auto exact = std::is_same<DistanceType, HalfDistance>::value || std::is_same<DistanceType, BFloat16Distance>::value;
+    check_compact<DistanceType, SingleLinkage>(integers, n, exact ? 0 : tolerance, name + " single linkage");
+    check_compact<DistanceType, SingleLinkage, LinkageEngine::minimum_spanning_tree>(integers, n, exact ? 0 : tolerance, name + " single linkage");
+    check_compact<DistanceType, CompleteLinkage>(integers, n, exact ? 0 : tolerance, name + " complete linkage");
+
+    /* Squared distances of points in five blobs 10 apart, which the averaging linkages separate despite rounding */
+    std::normal_distribution<float> spread {0, 0.5f};
+    std::vector<float>              x(n), y(n), squared {};
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        x[i] = 10.0f*(i % 5) + spread(generator);
+        y[i] = spread(generator);
+    }
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        for (auto j = i+1; j < n; ++j)
+        {
+            squared.push_back((x[i]-x[j])*(x[i]-x[j]) + (y[i]-y[j])*(y[i]-y[j]));
+        }
+    }
+    check_compact<DistanceType, GroupAverageLinkage>(squared, n, tolerance, name + " group average");
+    check_compact<DistanceType, WardLinkage>(squared, n, tolerance, name + " ward");
+
+    typedef std::numeric_limits<DistanceType> Limits;
+    check(Limits::is_specialized && Limits::has_infinity && static_cast<float>(Limits::infinity()) == std::numeric_limits<float>::infinity()
+          && Limits::max() < Limits::infinity() && !(DistanceType(0.0f) < Limits::lowest()), name + " has limits like float");
+}
+
+void test_compact_distances()
+{
+    check(static_cast<float>(std::numeric_limits<HalfDistance>::max()) == 65504 && static_cast<float>(std::numeric_limits<HalfDistance>::epsilon()) == 1.0f/1024
+          && static_cast<float>(std::numeric_limits<HalfDistance>::min()) == 1.0f/16384, "HalfDistance limits are those of binary16");
+    check(static_cast<float>(std::numeric_limits<BFloat16Distance>::max()) == 255*std::ldexp(1.0f, 120) && static_cast<float>(std::numeric_limits<BFloat16Distance>::epsilon()) == 1.0f/128,
+          "BFloat16Distance limits are those of bfloat16");
+    check(std::isnan(static_cast<float>(std::numeric_limits<HalfDistance>::quiet_NaN())) && std::isnan(static_cast<float>(std::numeric_limits<BFloat16Distance>::quiet_NaN())),
+          "16 bit floating point distances have a quiet NaN");
+    check(static_cast<float>(std::numeric_limits < QuantizedDistance < TestRange>>::max()) == TestRange::highest(), "the largest quantized distance is the end of the range");
+    check_compact_type<HalfDistance>("HalfDistance", 0.005);
+    check_compact_type<BFloat16Distance>("BFloat16Distance", 0.02);
+    check_compact_type < QuantizedDistance < TestRange>>("QuantizedDistance", 0.005);
+}
+
+template <typename Policy>
+void check_sparse(const char * name, double keep)
+{
+    for (unsigned seed = 0; seed < 3; ++seed)
+    {
+        const auto dense_distances = random_matrix(80, seed, keep);
+        auto       matrix          = copy_matrix(dense_distances);
+        const auto dense           = finite_merges(hierarchical_linkage<Policy, LinkageEngine::generic>(matrix));
+        const auto sparse          = sparse_linkage<Policy>(dense_distances.size(), finite_distances(dense_distances));
+        check(same_distances(dense, sparse, 1e-9), std::string("sparse_linkage matches the dense engine for ") + name);
+        check(cut_at_distance(dense, 4.0) == cut_at_distance(sparse, 4.0), std::string("sparse_linkage cuts as the dense engine for ") + name);
+    }
+}
+
+void test_sparse()
+{
+    check_sparse<SingleLinkage>("single", 1);
+    check_sparse<CompleteLinkage>("complete", 1);
+    check_sparse<SimpleAverageLinkage>("simple average", 1);
+    check_sparse<GroupAverageLinkage>("group average", 1);
+    check_sparse<WardLinkage>("ward", 1);
+    check_sparse<CentroidLinkage>("centroid", 1);
+    check_sparse<MedianLinkage>("median", 1);
+    /* Missing distances: merges with an infinite part stay infinite for these linkages */
+    check_sparse<SingleLinkage>("single with missing distances", 0.1);
+    check_sparse<CompleteLinkage>("complete with missing distances", 0.3);
+    check_sparse<SimpleAverageLinkage>("simple average with missing distances", 0.3);
+    check_sparse<GroupAverageLinkage>("group average with missing distances", 0.3);
+}
+
+void test_batch()
+{
+    std::vector < CondensedDistanceMatrix < double>> problems {};
+    for (std::size_t p = 0; p < 40; ++p)
+    {
+        problems.push_back(random_matrix(p % 13, p));
+    }
+    ThreadPool pool {3};
+    const auto batch = batch_linkage<GroupAverageLinkage>(problems, pool);
+    check(batch.size() == problems.size(), "batch_linkage has a linkage per problem");
+    for (std::size_t p = 0; p < problems.size(); ++p)
+    {
+        auto matrix = copy_matrix(problems[p]);
+        check(same_merges(batch.linkage(p), hierarchical_linkage<GroupAverageLinkage, LinkageEngine::nn_chain>(matrix)), "batch_linkage matches nn_chain_linkage");
+    }
+}
+
+void test_cluster_summaries()
+{
+    const std::size_t n      = 150;
+    const auto        matrix = random_matrix(n, 7);
+    std::vector<std::size_t> labels(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        labels[i] = i % 11 == 0 ? unclustered : (i*5) % 7;
+    }
+    for (std::size_t threads : {1, 4})
+    {
+        ThreadPool pool {threads};
+        const auto summaries = cluster_summaries(matrix, labels, pool);
+        check(summaries.size() == 7, "cluster_summaries has a summary per label");
+        for (std::size_t cluster = 0; cluster < summaries.size(); ++cluster)
+        {
+            std::vector<std::size_t> members {};
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                if (labels[i] == cluster)
+                {
+                    members.push_back(i);
+                }
+            }
+            double      best = std::numeric_limits<double>::infinity(), total = 0, diameter = 0;
+            std::size_t medoid = unclustered;
+            for (auto i : members)
+            {
+                double sum = 0;
+                for (auto j : members)
+                {
+                    if (i != j)
+                    {
+                        sum     += matrix(i, j);
+                        diameter = std::max(diameter, matrix(i, j));
+                    }
+                }
+                if (sum < best)
+                {
+                    best   = sum;
+                    medoid = i;
+                }
+                total += sum;
+            }
+            const auto &summary = summaries[cluster];
+            const auto  mean    = members.size() > 1 ? total/(members.size()*(members.size()-1.0)) : 0;
+            check(summary.size == members.size() && summary.medoid == medoid && summary.diameter == diameter && std::abs(summary.mean_distance - mean) < 1e-9,
+                  "cluster_summaries matches the brute force computation");
+        }
+    }
+}
+
+void test_leaf_ordering()
+{
+    auto       matrix  = random_matrix(60, 3);
+    const auto linkage = hierarchical_linkage<CompleteLinkage>(matrix);
+    const LeafOrdering ordering {linkage};
+    const auto n = linkage.leaves();
+
+    /* Members of every cluster as sets, from its two parts */
+    std::vector < std::set < std::size_t>> members(n + linkage.size());
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        members[i] = {i};
+    }
+    for (std::size_t k = 0; k < linkage.size(); ++k)
+    {
+        members[n+k] = members[linkage[k].left];
+        members[n+k].insert(std::begin(members[linkage[k].right]), std::end(members[linkage[k].right]));
+    }
+    std::vector<std::size_t> sorted_order(ordering.order());
+    std::sort(std::begin(sorted_order), std::end(sorted_order));
+    check(sorted_order.size() == n && std::adjacent_find(std::begin(sorted_order), std::end(sorted_order)) == std::end(sorted_order), "LeafOrdering orders every leaf once");
+    for (std::size_t id = 0; id < members.size(); ++id)
+    {
+        const auto range = ordering.members(id);
+        check(std::set<std::size_t>(std::begin(range), std::end(range)) == members[id] && ordering.size(id) == members[id].size(), "LeafOrdering ranges hold the members of each cluster");
+        check(ordering.contains(id, *members[id].begin()) && ordering.contains(n + linkage.size() - 1, id), "LeafOrdering contains the members of each cluster");
+    }
+}
+
+/* A distance that fails in every worker */
+struct FailingDistance
+{
+    double operator()(std::size_t, std::size_t) const
+    {
+        throw std::runtime_error("No distance.");
+    }
+};
+
+bool empty_directory(const std::string &directory)
+{
+    auto   listing = opendir(directory.c_str());
+    size_t entries = 0;
+    while (listing != nullptr && readdir(listing) != nullptr)
+    {
+        ++entries;
+    }
+    if (listing != nullptr)
+    {
+        closedir(listing);
+    }
+    return entries == 2;
+}
+
+void test_sharded(const std::string &directory)
+{
+    for (std::size_t groups : {1, 3, 5})
+    {
+        const auto matrix  = random_matrix(70, groups);
+        ThreadPool pool {2};
+        const auto sharded = sharded_single_linkage<double>(matrix.size(), matrix, groups, 2);
+        const auto mst     = mst_linkage(matrix, pool);
+        check(same_merges(sharded, mst), "sharded_single_linkage matches mst_linkage");
+    }
+
+    /* Shards of a single element leave empty forests */
+    const auto single = random_matrix(1, 1);
+    check(sharded_single_linkage<double>(single.size(), single, 1, 1).size() == 0, "sharded_single_linkage of one element has no merges");
+    {
+        const auto             pairs   = random_matrix(3, 2);
+        const auto             forests = directory + "/forests";
+        mkdir(forests.c_str(), 0700);
+        const ShardForestFiles kept {forests, true, shards(3)};
+        ThreadPool             pool {1};
+        check(same_merges(sharded_single_linkage<double>(pairs.size(), pairs, 3, 2, forests), mst_linkage(pairs, pool)),
+              "sharded_single_linkage of single element groups matches mst_linkage");
+    }
+
+    /* The temporary forest files go away when a worker fails */
+    const char * parent = std::getenv("TMPDIR");
+    const auto   saved  = std::string(parent != nullptr ? parent : "");
+    setenv("TMPDIR", directory.c_str(), 1);
+    bool thrown = false;
+    try
+    {
+        sharded_single_linkage<double>(20, FailingDistance {}, 3, 2);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    parent != nullptr ? setenv("TMPDIR", saved.c_str(), 1) : unsetenv("TMPDIR");
+    check(thrown, "sharded_single_linkage reports a failed worker");
+    check(empty_directory(directory), "sharded_single_linkage removes its temporary directory after a failure");
+}
+
+void test_mapped_linkage(const std::string &directory)
+{
+    auto       matrix   = random_matrix(90, 11, 0.05);
+    const auto linkage  = hierarchical_linkage<SingleLinkage, LinkageEngine::naive>(matrix);
+    const auto filename = directory + "/linkage.bin";
+    write_linkage(linkage, filename);
+    {
+        const MappedLinkage<double> mapped {filename};
+        check(same_merges(mapped.linkage(), linkage), "MappedLinkage reads back the merges written");
+        check(cut_at_distance(mapped, 2.0) == cut_at_distance(linkage, 2.0) && cut_into(mapped, 4) == cut_into(linkage, 4), "MappedLinkage cuts as the linkage written");
+    }
+    std::remove(filename.c_str());
+}
+
+void test_distance_matrix_file(const std::string &directory)
+{
+    const auto               matrix   = random_matrix(40, 12);
+    const auto               filename = directory + "/distances.bin";
+    std::vector<std::size_t> ids(matrix.size());
+    for (std::size_t i = 0; i < ids.size(); ++i)
+    {
+        ids[i] = 1000 + i;
+    }
+    {
+        DistanceMatrixWriter<double> writer {filename, ids};
+        for (std::size_t i = 0; i < matrix.size(); ++i)
+        {
+            writer.write_row(matrix.row(i), matrix.size()-i-1);
+        }
+        writer.close();
+        writer.close();
+    }
+    {
+        std::vector<std::size_t> mapped_ids;
+        const auto               mapped = map_distance_matrix<double>(filename, &mapped_ids);
+        bool                     same   = mapped.size() == matrix.size() && mapped_ids == ids;
+        for (std::size_t i = 0; same && i < matrix.size(); ++i)
+        {
+            for (std::size_t j = i+1; j < matrix.size(); ++j)
+            {
+                same = same && mapped(i, j) == matrix(i, j);
+            }
+        }
+        check(same, "map_distance_matrix reads back what DistanceMatrixWriter wrote");
+    }
+    bool thrown = false;
+    try
+    {
+        DistanceMatrixWriter<double> writer {filename, ids};
+        writer.close();
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    check(thrown, "DistanceMatrixWriter::close reports missing rows");
+
+    /* Fewer than two elements have no distances, but still need the whole header and the ids */
+    for (std::size_t n = 0; n < 2; ++n)
+    {
+        const std::vector<std::size_t> few_ids(n, 7);
+        {
+            DistanceMatrixWriter<double> writer {filename, few_ids};
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                writer.write_row(nullptr, 0);
+            }
+            writer.close();
+        }
+        std::vector<std::size_t> mapped_ids;
+        const auto               mapped = map_distance_matrix<double>(filename, &mapped_ids);
+        check(mapped.size() == n && mapped.length() == 0 && mapped_ids == few_ids, "map_distance_matrix reads files of fewer than two elements");
+    }
+    auto rejected = [&filename](std::uint64_t n, std::size_t bytes){
+            const auto header = distance_matrix_file_header<double>(n);
+            std::vector<char> content(bytes, 0);
+            std::memcpy(content.data(), &header, std::min(bytes, sizeof(header)));
+            std::unique_ptr<std::FILE, int(*)(std::FILE*)> file {std::fopen(filename.c_str(), "wb"), &std::fclose};
+            std::fwrite(content.data(), 1, content.size(), file.get());
+            file.reset();
+            try
+            {
+                map_distance_matrix<double>(filename);
+            }
+            catch (const std::runtime_error &)
+            {
+                return true;
+            }
+            return false;
+        };
+    check(rejected(0, sizeof(DistanceMatrixFileHeader)), "map_distance_matrix rejects a file that ends after the header");
+    check(rejected(std::uint64_t(1) << 32, 4096), "map_distance_matrix rejects a header with more elements than the file has room for");
+    check(rejected(std::numeric_limits<std::uint64_t>::max(), 4096), "map_distance_matrix rejects an element count that would overflow the sizes");
+    std::remove(filename.c_str());
+}
+
+/* A node of a parsed dendrogram: a leaf with its name, or a cluster with its children */
+struct ParsedNode
+{
+    std::string             name;      //< label of a leaf
+    bool                    has_value; //< whether value was given
+    double                  value;     //< branch length in Newick, merge distance in JSON
+    std::vector<ParsedNode> children;  //< the two parts of a cluster, none for a leaf
+};
+
+/* Reads back what write_newick and write_json write; throws std::runtime_error on anything else */
+class DendrogramParser
+{
+    public:
+        explicit DendrogramParser(const std::string &text) : text_ (text), at_ {0}
+        {};
+
+        /* One tree per line */
+        std::vector<ParsedNode> newick()
+        {
+            std::vector<ParsedNode> trees {};
+            while (skip_space())
+            {
+                trees.push_back(newick_node());
+                expect(';');
+            }
+            return trees;
+        };
+
+        /* The trees of {"leaves": n, "trees": [...]} */
+        std::vector<ParsedNode> json()
+        {
+            std::vector<ParsedNode> trees {};
+            expect('{');
+            expect_string("leaves");
+            expect(':');
+            json_number();
+            expect(',');
+            expect_string("trees");
+            expect(':');
+            expect('[');
+            while (peek() != ']')
+            {
+                if (!trees.empty())
+                {
+                    expect(',');
+                }
+                trees.push_back(json_node());
+            }
+            expect(']');
+            expect('}');
+            if (skip_space())
+            {
+                fail();
+            }
+            return trees;
+        };
+
+    private:
+        ParsedNode newick_node()
+        {
+            ParsedNode node {std::string(), false, 0, {}};
+            if (peek() == '(')
+            {
+                expect('(');
+                node.children.push_back(newick_node());
+                expect(',');
+                node.children.push_back(newick_node());
+                expect(')');
+            }
+            else if (peek() == '\'')
+            {
+                ++at_;
+                while (true)
+                {
+                    if (at_ >= text_.size())
+                    {
+                        fail();
+                    }
+                    if (text_[at_] == '\'')
+                    {
+                        if (at_+1 < text_.size() && text_[at_+1] == '\'')
+                        {
+                            ++at_;
+                        }
+                        else
+                        {
+                            break;
+                        }
+                    }
+                    node.name += text_[at_++];
+                }
+                ++at_;
+            }
+            else
+            {
+                while (at_ < text_.size() && std::string(":,);").find(text_[at_]) == std::string::npos)
+                {
+                    node.name += text_[at_++];
+                }
+                if (node.name.empty())
+                {
+                    fail();
+                }
+            }
+            if (peek() == ':')
+            {
+                ++at_;
+                node.has_value = true;
+                node.value     = finite_number();
+            }
+            return node;
+        };
+
+        ParsedNode json_node()
+        {
+            ParsedNode node {std::string(), false, 0, {}};
+            expect('{');
+            bool first = true;
+            while (peek() != '}')
+            {
+                if (!first)
+                {
+                    expect(',');
+                }
+                first = false;
+                const auto key = json_string();
+                expect(':');
+                if (key == "merge-distance")
+                {
+                    if (skip_space() && text_.compare(at_, 4, "null") == 0)
+                    {
+                        at_ += 4;
+                    }
+                    else
+                    {
+                        node.has_value = true;
+                        node.value     = json_number();
+                    }
+                }
+                else if (key == "children")
+                {
+                    expect('[');
+                    node.children.push_back(json_node());
+                    expect(',');
+                    node.children.push_back(json_node());
+                    expect(']');
+                }
+                else if (key == "name")
+                {
+                    node.name = json_string();
+                }
+                else if (key == "id" || key == "size")
+                {
+                    const auto value = json_number();
+                    if (key == "id" && node.name.empty())
+                    {
+                        node.name = std::to_string(static_cast<std::size_t>(value));
+                    }
+                }
+                else
+                {
+                    fail();
+                }
+            }
+            expect('}');
+            return node;
+        };
+
+        /* A number as JSON has it: no inf, nan or hexadecimal */
+        double json_number()
+        {
+            skip_space();
+            if (at_ >= text_.size() || std::string("-0123456789").find(text_[at_]) == std::string::npos)
+            {
+                fail();
+            }
+            return finite_number();
+        };
+
+        /* Newick parsers take no inf or nan either */
+        double finite_number()
+        {
+            const auto value = number();
+            if (!std::isfinite(value))
+            {
+                fail();
+            }
+            return value;
+        };
+
+        double number()
+        {
+            skip_space();
+            const char * first = text_.c_str() + at_;
+            char       * last  = nullptr;
+            const auto   value = std::strtod(first, &last);
+            if (last == first)
+            {
+                fail();
+            }
+            at_ += last - first;
+            return value;
+        };
+
+        std::string json_string()
+        {
+            expect('"');
+            std::string result {};
+            while (at_ < text_.size() && text_[at_] != '"')
+            {
+                auto c = text_[at_++];
+                if (c == '\\')
+                {
+                    if (at_ >= text_.size())
+                    {
+                        fail();
+                    }
+                    c = text_[at_++];
+                    if (c == 'u')
+                    {
+                        c = static_cast<char>(std::stoi(text_.substr(at_, 4), nullptr, 16));
+                        at_ += 4;
+                    }
+                    else if (c != '"' && c != '\\')
+                    {
+                        fail();
+                    }
+                }
+                result += c;
+            }
+            expect('"');
+            return result;
+        };
+
+        void expect_string(const std::string &expected)
+        {
+            if (json_string() != expected)
+            {
+                fail();
+            }
+        };
+
+        void expect(char c)
+        {
+            if (peek() != c)
+            {
+                fail();
+            }
+            ++at_;
+        };
+
+        char peek()
+        {
+            return skip_space() ? text_[at_] : '\0';
+        };
+
+        /* Whether there is anything but white space left */
+        bool skip_space()
+        {
+            while (at_ < text_.size() && std::string(" \t\r\n").find(text_[at_]) != std::string::npos)
+            {
+                ++at_;
+            }
+            return at_ < text_.size();
+        };
+
+        void fail() const
+        {
+            throw std::runtime_error("Cannot parse the dendrogram at position " + std::to_string(at_) + ".");
+        };
+
+        const std::string &text_; //< what is parsed
+        std::size_t        at_;   //< the next character
+};
+
+/* Collect the leaves below a parsed node, and its height; Newick gives branch lengths, JSON merge distances */
+std::set<std::size_t> parsed_clusters(const ParsedNode &node, bool lengths, const std::map<std::string, std::size_t> &leaf_of,
+                                      std::map < std::set < std::size_t>, double> &heights, double &height)
+{
+    if (node.children.empty())
+    {
+        height = 0;
+        const auto leaf = leaf_of.find(node.name);
+        return leaf == leaf_of.end() ? std::set<std::size_t>() : std::set<std::size_t> {leaf->second};
+    }
+    std::set<std::size_t> members {};
+    height = std::numeric_limits<double>::infinity();
+    for (const auto &child : node.children)
+    {
+        double     child_height = 0;
+        const auto below        = parsed_clusters(child, lengths, leaf_of, heights, child_height);
+        members.insert(std::begin(below), std::end(below));
+        if (lengths && child.has_value)
+        {
+            height = child_height + child.value;
+        }
+    }
+    if (!lengths)
+    {
+        height = node.has_value ? node.value : std::numeric_limits<double>::infinity();
+    }
+    heights[members] = height;
+    return members;
+}
+
+/* Write a linkage as Newick and JSON, parse both and compare the clusters and their heights */
+void check_dendrogram_round_trip(const Linkage<double> &linkage, const std::string &what)
+{
+    const auto               n = linkage.leaves();
+    std::vector<std::string> names(n);
+    std::map<std::string, std::size_t> leaf_of {};
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const char * decorations[] = {"plain", "it's a leaf", "quote\"d\\", "x(1),_y:z;"};
+        names[i]                   = decorations[i % 4] + std::to_string(i);
+        leaf_of[names[i]]          = i;
+    }
+
+    /* Newick has the heights of clusters, JSON their merge distances */
+    std::map < std::set < std::size_t>, double> expected_heights {}, expected_distances {};
+    {
+        std::vector < std::set < std::size_t>> members(n + linkage.size());
+        const auto heights = linkage.heights();
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            members[i] = {i};
+        }
+        for (std::size_t k = 0; k < linkage.size(); ++k)
+        {
+            members[n+k] = members[linkage[k].left];
+            members[n+k].insert(std::begin(members[linkage[k].right]), std::end(members[linkage[k].right]));
+            expected_heights[members[n+k]]   = heights[k];
+            expected_distances[members[n+k]] = linkage[k].distance;
+        }
+    }
+    auto same_heights = [](const std::map < std::set < std::size_t>, double> &parsed, const std::map < std::set < std::size_t>, double> &expected){
+            if (parsed.size() != expected.size())
+            {
+                return false;
+            }
+            for (const auto &cluster : parsed)
+            {
+                const auto match = expected.find(cluster.first);
+                if (match == expected.end() || std::isfinite(match->second) != std::isfinite(cluster.second)
+                    || (std::isfinite(match->second) && std::abs(match->second - cluster.second) > 1e-9*(1 + match->second)))
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+    for (bool newick : {true, false})
+    {
+        std::ostringstream stream {};
+        {
+            DendrogramOutput out {stream};
+            if (newick)
+            {
+                write_newick(linkage, out, &names);
+            }
+            else
+            {
+                write_json(linkage, out, &names);
+            }
+            out.flush();
+        }
+        const auto text = stream.str();
+        try
+        {
+            DendrogramParser parser {text};
+            const auto trees = newick ? parser.newick() : parser.json();
+            std::map < std::set < std::size_t>, double> heights {};
+            std::set<std::size_t> leaves {};
+            for (const auto &tree : trees)
+            {
+                double     height  = 0;
+                const auto members = parsed_clusters(tree, newick, leaf_of, heights, height);
+                leaves.insert(std::begin(members), std::end(members));
+            }
+            check(leaves.size() == n && trees.size() == n - linkage.size(), (newick ? "Newick of " : "JSON of ") + what + " has every leaf and tree");
+            check(same_heights(heights, newick ? expected_heights : expected_distances), (newick ? "Newick of " : "JSON of ") + what + " reads back the clusters and heights");
+        }
+        catch (const std::runtime_error &e)
+        {
+            check(false, (newick ? "Newick of " : "JSON of ") + what + " is valid: " + e.what());
+        }
+    }
+}
+
+void test_dendrogram_text()
+{
+    auto connected = random_matrix(30, 4);
+    check_dendrogram_round_trip(hierarchical_linkage<CentroidLinkage>(connected), "centroid linkage");
+
+    /* Two groups without distances between them, which condensed_linkage merges at infinity */
+    auto matrix = random_matrix(30, 5);
+    for (std::size_t i = 0; i < 30; ++i)
+    {
+        for (auto j = i+1; j < 30; ++j)
+        {
+            if ((i < 12) != (j < 12))
+            {
+                matrix(i, j) = std::numeric_limits<double>::infinity();
+            }
+        }
+    }
+    const auto sparse = sparse_linkage<CompleteLinkage>(30, finite_distances(matrix));
+    check_dendrogram_round_trip(hierarchical_linkage<CompleteLinkage, LinkageEngine::naive>(matrix), "disconnected input");
+    check_dendrogram_round_trip(sparse, "an incomplete linkage");
+}
+
+void test_trees()
+{
+    auto       matrix   = random_matrix(40, 9, 0.03);
+    const auto complete = hierarchical_linkage<SingleLinkage>(matrix);
+    const auto sparse   = sparse_linkage<SingleLinkage>(40, finite_distances(matrix));
+    std::vector < BasicDistanceCluster < double>> leaves {};
+    for (std::size_t i = 0; i < 40; ++i)
+    {
+        leaves.emplace_back(std::vector<double>(), std::vector<std::size_t> {i});
+    }
+    const auto tree = complete.tree(leaves);
+    check(tree != nullptr && (**tree).elements().size() == 40, "Linkage::tree holds every leaf");
+
+    const auto  forest = sparse.forest(leaves);
+    std::size_t total  = 0;
+    for (const auto &root : forest)
+    {
+        total += (**root).elements().size();
+    }
+    check(forest.size() == 40 - sparse.size() && total == 40, "Linkage::forest has a tree per cluster left");
+    bool thrown = false;
+    try
+    {
+        sparse.tree(leaves);
+    }
+    catch (const std::logic_error &)
+    {
+        thrown = true;
+    }
+    check(thrown, "Linkage::tree refuses an incomplete linkage");
+}
+
+} // namespace
+
+int main()
+{
+    const char * parent    = std::getenv("TMPDIR");
+    std::string  directory = std::string(parent != nullptr ? parent : "/tmp") + "/linkagetestXXXXXX";
+    if (mkdtemp(&directory[0]) == nullptr)
+    {
+        std::fprintf(stderr, "Cannot create a temporary directory.\n");
+        return 1;
+    }
+
+    test_list_reference();
+    test_thread_pool();
+    test_thread_counts();
+    test_kernels();
+    test_incremental();
+    test_matrix_free();
+    test_kd_tree();
+    test_merge_stop();
+    test_cluster_statistics();
+    test_compact_distances();
+    test_sparse();
+    test_batch();
+    test_cluster_summaries();
+    test_leaf_ordering();
+    test_sharded(directory);
+    test_mapped_linkage(directory);
+    test_distance_matrix_file(directory);
+    test_distance_matrices(directory);
+    test_dendrogram_text();
+    test_trees();
+
+    rmdir(directory.c_str());
+    std::fprintf(stderr, failures == 0 ? "All checks passed.\n" : "%d checks failed.\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+/*
+ * mergestop.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef MERGE_STOP_H_
+#define MERGE_STOP_H_
+
+#include <cstddef>
+
+/*! \brief When to stop merging clusters, before everything is merged into one.
+ *
+ * Merging stops before the first merge farther apart than max_distance, if bounded,
+ * or when only clusters are left, whichever comes first. What is left is a forest:
+ * an incomplete linkage with one tree per remaining cluster.
+ */
+template <typename DistanceType>
+struct MergeStop
+{
+    DistanceType max_distance; //< largest distance at which clusters are merged, if bounded
+    bool         bounded;      //< whether max_distance applies
+    std::size_t  clusters;     //< number of clusters at which to stop
+
+    /*!\brief Merge everything into one cluster. */
+    MergeStop() : max_distance(), bounded {false}, clusters {1}
+    {};
+
+    /*!\brief Stop at a distance or a number of clusters, whichever comes first. */
+    MergeStop(DistanceType distance, std::size_t cluster_count) : max_distance(distance), bounded {true}, clusters {cluster_count}
+    {};
+
+    /*!\brief Merge no clusters farther apart than distance. */
+    static MergeStop at_distance(DistanceType distance) { return MergeStop(distance, 1); };
+
+    /*!\brief Stop when count clusters are left. */
+    static MergeStop at_clusters(std::size_t count)
+    {
+        MergeStop stop {};
+        stop.clusters = count;
+        return stop;
+    };
+
+    /*!\brief Whether clusters this far apart are too far to be merged. */
+    bool too_far(DistanceType distance) const { return bounded && max_distance < distance; };
+
+    /*!\brief Whether the next merge, at distance with clusters_left before it, is not to be done. */
+    bool reached(DistanceType distance, std::size_t clusters_left) const { return clusters_left <= clusters || too_far(distance); };
+};
+
+#endif /* end of include guard: MERGE_STOP_H_ */
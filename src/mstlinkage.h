@@ -0,0 +1,198 @@
+/*
+ * mstlinkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef MST_LINKAGE_H_
+#define MST_LINKAGE_H_
+
+#include <algorithm>
+#include <limits>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "binarytree.h"
+#include "condenseddistancematrix.h"
+#include "linkage.h"
+#include "threadpool.h"
+
+/*! \brief An edge of a minimum spanning tree. */
+template <typename DistanceType>
+struct SpanningTreeEdge
+{
+    std::size_t  from;     //< element already in the tree
+    std::size_t  to;       //< element that was added to the tree
+    DistanceType distance; //< distance between the two
+};
+
+/*! \brief Minimum spanning tree with Prim's algorithm in O(n^2), rows scanned in parallel.
+ *
+ * Each step updates the distances of all elements outside the tree to the tree and picks the closest;
+ * both are split across the threads of the pool with a reduction that prefers the lowest
+ * element index among equal distances, so the result does not depend on the number of threads.
+ *
+ * \param[in] distances Mutual distances of the elements, left untouched.
+ * \param[in] pool Threads that scan the distances.
+ * \returns The n-1 edges in the order they were added to the tree.
+ */
+template <typename DistanceType>
+std::vector < SpanningTreeEdge < DistanceType>> minimum_spanning_tree(const CondensedDistanceMatrix<DistanceType> &distances, ThreadPool &pool)
+{
+    const auto n        = distances.size();
+    const auto infinity = std::numeric_limits<DistanceType>::infinity();
+
+    std::vector < SpanningTreeEdge < DistanceType>> edges {};
+    if (n < 2)
+    {
+        return edges;
+    }
+    edges.reserve(n-1);
+
+    std::vector<char>         in_tree(n, 0);
+    std::vector<DistanceType> distance_to_tree(n, infinity);
+    std::vector<std::size_t>  closest_in_tree(n, 0);
+
+    /* The closest candidate found by each thread */
+    std::vector<std::size_t>  thread_candidate(pool.size());
+
+    std::size_t current = 0;
+    in_tree[current] = 1;
+    for (std::size_t step = 1; step < n; ++step)
+    {
+        pool.run([&](std::size_t thread){
+                     const auto range     = pool.chunk(0, n, thread);
+                     auto       candidate = n;
+                     for (auto j = range.first; j < range.second; ++j)
+                     {
+                         if (!in_tree[j])
+                         {
+                             const auto d = distances(current, j);
+                             if (d < distance_to_tree[j])
+                             {
+                                 distance_to_tree[j] = d;
+                                 closest_in_tree[j]  = current;
+                             }
+                             if (candidate == n || distance_to_tree[j] < distance_to_tree[candidate])
+                             {
+                                 candidate = j;
+                             }
+                         }
+                     }
+                     thread_candidate[thread] = candidate;
+                 });
+
+        /* Chunks are in ascending order, so keeping the first minimum keeps the lowest index */
+        auto next = n;
+        for (auto candidate : thread_candidate)
+        {
+            if (candidate != n && (next == n || distance_to_tree[candidate] < distance_to_tree[next]))
+            {
+                next = candidate;
+            }
+        }
+        edges.push_back({closest_in_tree[next], next, distance_to_tree[next]});
+        in_tree[next] = 1;
+        current       = next;
+    }
+    return edges;
+}
+
+/*! \brief Single linkage clustering from the edges of a minimum spanning tree (or forest).
+ *
+ * The single linkage dendrogram merges the components connected by the spanning tree edges
+ * in order of increasing edge length. Edges of equal length are merged in the order they are given.
+ *
+ * \param[in] edges Edges of a minimum spanning tree of the n elements.
+ * \param[in] n The number of elements.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Merging ends at the first edge that is too long, or when few enough components are left.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> spanning_tree_linkage(std::vector < SpanningTreeEdge < DistanceType>> edges, std::size_t n, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                            const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    LinkageBuilder<DistanceType> builder {n, std::move(leaf_sizes)};
+    std::stable_sort(std::begin(edges), std::end(edges), [](const SpanningTreeEdge<DistanceType> &a, const SpanningTreeEdge<DistanceType> &b){ return a.distance < b.distance; });
+
+    /* Union-find over elements; the representative of each component is its lowest element,
+     * which is also the slot of the component, just as in condensed_linkage. */
+    std::vector<std::size_t> representative(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        representative[i] = i;
+    }
+    auto find = [&representative](std::size_t i){
+            while (representative[i] != i)
+            {
+                representative[i] = representative[representative[i]];
+                i                 = representative[i];
+            }
+            return i;
+        };
+
+    auto components = n;
+    for (const auto &edge : edges)
+    {
+        if (stop.reached(edge.distance, components--))
+        {
+            break;
+        }
+        const auto a     = find(edge.from);
+        const auto b     = find(edge.to);
+        const auto left  = std::min(a, b);
+        const auto right = std::max(a, b);
+        representative[right] = left;
+        builder.merge(left, right, edge.distance);
+    }
+    return builder.release();
+}
+
+/*! \brief Single linkage clustering via a minimum spanning tree built with Prim's algorithm.
+ * \param[in] distances Mutual distances of the leaves, left untouched.
+ * \param[in] pool Threads that scan the distances.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Where to stop merging, see spanning_tree_linkage.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> mst_linkage(const CondensedDistanceMatrix<DistanceType> &distances, ThreadPool &pool, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                  const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    return spanning_tree_linkage(minimum_spanning_tree(distances, pool), distances.size(), std::move(leaf_sizes), stop);
+}
+
+/*! \brief Single linkage clustering via a minimum spanning tree.
+ *
+ * \tparam Clusterable The items to be clustered must provide DistanceType, merger and size.
+ * \param[in] distances Mutual distances of the items, left untouched.
+ * \param[in] leaves One clusterable per row of the distance matrix.
+ * \param[in] pool Threads that scan the distances.
+ *
+ * The tree is built from mst_linkage.
+ */
+template <typename Clusterable>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_single_linkage(const CondensedDistanceMatrix<typename Clusterable::DistanceType> &distances, std::vector<Clusterable> leaves, ThreadPool &pool)
+{
+    auto linkage = mst_linkage(distances, pool, leaf_sizes(leaves));
+    return linkage.tree(std::move(leaves));
+}
+
+/*! \brief Single linkage clustering via a minimum spanning tree on all cores. */
+template <typename Clusterable>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_single_linkage(const CondensedDistanceMatrix<typename Clusterable::DistanceType> &distances, std::vector<Clusterable> leaves)
+{
+    ThreadPool pool {};
+    return hierarchical_merge_single_linkage(distances, std::move(leaves), pool);
+}
+
+/*! \brief Single linkage clustering of list items, copying their distances into one condensed matrix first.
+ *
+ * Drop-in replacement for hierarchical_merge_into_tree with LanceWilliamsUpdate::single_linkage.
+ */
+template <typename Clusterable>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_single_linkage(std::list<Clusterable> &items_to_cluster)
+{
+    CondensedDistanceMatrix<typename Clusterable::DistanceType> distances {items_to_cluster};
+    return hierarchical_merge_single_linkage(distances, leaves_without_distances(items_to_cluster));
+}
+
+#endif /* end of include guard: MST_LINKAGE_H_ */
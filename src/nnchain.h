@@ -0,0 +1,180 @@
+/*
+ * nnchain.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef NN_CHAIN_H_
+#define NN_CHAIN_H_
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "binarytree.h"
+#include "condenseddistancematrix.h"
+#include "linkage.h"
+
+/*! \brief Working memory of nn_chain_merges, kept between clusterings to avoid allocating it again. */
+struct NnChainWorkspace
+{
+    std::vector<std::size_t> active; //< rows that still hold a cluster, in ascending order
+    std::vector<std::size_t> chain;  //< the chain of nearest neighbours
+};
+
+/*! \brief The merges of the nearest-neighbour-chain algorithm, recorded in a builder in the order they are found.
+ *
+ * See nn_chain_linkage; allocates nothing once workspace has grown to n elements.
+ *
+ * \param[in] distances Mutual distances of the leaves, overwritten during merging.
+ * \param[in] merge_distance A reducible LanceWilliamsUpdate function.
+ * \param[in] builder Receives the merges, set up for the n leaves of distances.
+ * \param[in] workspace Working memory.
+ * \param[in] stop Clusters that are too far from all others are set aside, since they never merge again;
+ *            the number of clusters is not checked, as merges are not found in order.
+ */
+template <typename DistanceType, typename MergeFunction>
+void nn_chain_merges(CondensedDistanceMatrix<DistanceType> &distances, MergeFunction merge_distance, LinkageBuilder<DistanceType> &builder, NnChainWorkspace &workspace,
+                     const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    const auto  n             = distances.size();
+    const auto &cluster_sizes = builder.sizes();
+    if (n < 2)
+    {
+        return;
+    }
+
+    auto &active = workspace.active;
+    active.resize(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        active[i] = i;
+    }
+
+    auto &chain = workspace.chain;
+    chain.clear();
+    chain.reserve(n);
+
+    while (active.size() > 1)
+    {
+        if (chain.empty())
+        {
+            chain.push_back(active.front());
+        }
+
+        /* Grow the chain until its last two clusters are mutual nearest neighbours */
+        std::size_t a, b;
+        auto        minimum_distance = DistanceType();
+        bool        isolated         = false;
+        while (true)
+        {
+            a = chain.back();
+            /* The predecessor wins ties, which guarantees the chain terminates */
+            b = chain.size() > 1 ? chain[chain.size()-2] : (a == active.front() ? active[1] : active.front());
+            minimum_distance = distances(a, b);
+            for (auto x : active)
+            {
+                if (x != a && distances(a, x) < minimum_distance)
+                {
+                    minimum_distance = distances(a, x);
+                    b                = x;
+                }
+            }
+            if (stop.too_far(minimum_distance))
+            {
+                /* In a reducible linkage, no merge brings a cluster closer than both its parts were */
+                isolated = true;
+                break;
+            }
+            if (chain.size() > 1 && b == chain[chain.size()-2])
+            {
+                break;
+            }
+            chain.push_back(b);
+        }
+        if (isolated)
+        {
+            chain.pop_back();
+            active.erase(std::lower_bound(std::begin(active), std::end(active), a));
+            continue;
+        }
+        chain.pop_back();
+        chain.pop_back();
+
+        const auto left  = std::min(a, b);
+        const auto right = std::max(a, b);
+
+        /* Update the distances of the merged cluster in place, in the row and column of left */
+        for (auto k : active)
+        {
+            if (k != left && k != right)
+            {
+                auto &d_to_left = distances(k, left);
+                d_to_left = DistanceType(merge_distance(minimum_distance, cluster_sizes[k], cluster_sizes[left], cluster_sizes[right], d_to_left, distances(k, right)));
+            }
+        }
+        active.erase(std::lower_bound(std::begin(active), std::end(active), right));
+
+        builder.merge(left, right, minimum_distance);
+    }
+}
+
+/*! \brief Hierarchical clustering with the nearest-neighbour-chain algorithm in O(n^2) time.
+ *
+ * Follows a chain of nearest neighbours from an arbitrary cluster until two clusters
+ * are mutual nearest neighbours, then merges them. This yields the same dendrogram as
+ * always merging the globally closest pair only if the linkage is reducible, i.e. if a merged
+ * cluster is never closer to a third cluster than both its parts were:
+ * single_linkage, complete_linkage, simple_average, group_average and ward_minimum_distance.
+ * Use generic_linkage for centroid and median.
+ *
+ * Merges are not found in order of increasing distance, so the linkage is sorted afterwards.
+ * When distances are tied, the previous cluster on the chain is preferred, then the one with the lowest row index.
+ *
+ * \tparam MergeFunction A reducible LanceWilliamsUpdate function.
+ * \param[in] distances Mutual distances of the leaves, overwritten during merging.
+ * \param[in] merge_distance A function defining how to calculate the new distances to the merged cluster.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Where to stop merging: clusters farther than the distance are never chained,
+ *            the merges beyond the number of clusters are dropped after sorting.
+ */
+template <typename DistanceType, typename MergeFunction>
+Linkage<DistanceType> nn_chain_linkage(CondensedDistanceMatrix<DistanceType> &distances, MergeFunction merge_distance, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                       const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    LinkageBuilder<DistanceType> builder {distances.size(), std::move(leaf_sizes)};
+    NnChainWorkspace             workspace {};
+    nn_chain_merges(distances, merge_distance, builder, workspace, stop);
+    auto linkage = builder.release();
+    linkage.sort();
+    linkage.truncate(stop);
+    return linkage;
+}
+
+/*! \brief Nearest-neighbour-chain clustering of items whose distances are stored in a condensed matrix.
+ *
+ * \tparam Clusterable The items to be clustered must provide DistanceType, merger and size.
+ * \param[in] distances Mutual distances of the items, overwritten during merging.
+ * \param[in] leaves One clusterable per row of the distance matrix.
+ * \param[in] merge_distance A reducible LanceWilliamsUpdate function.
+ *
+ * The tree is built from nn_chain_linkage.
+ */
+template <typename Clusterable, typename MergeFunction>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_nn_chain(CondensedDistanceMatrix<typename Clusterable::DistanceType> &distances, std::vector<Clusterable> leaves, MergeFunction merge_distance)
+{
+    auto linkage = nn_chain_linkage(distances, merge_distance, leaf_sizes(leaves));
+    return linkage.tree(std::move(leaves));
+}
+
+/*! \brief Nearest-neighbour-chain clustering of list items, copying their distances into one condensed matrix first.
+ *
+ * Drop-in replacement for hierarchical_merge_into_tree with reducible linkages.
+ */
+template <typename Clusterable, typename MergeFunction>
+std::unique_ptr < BinaryTree < Clusterable>> hierarchical_merge_nn_chain(std::list<Clusterable> &items_to_cluster, MergeFunction merge_distance)
+{
+    CondensedDistanceMatrix<typename Clusterable::DistanceType> distances {items_to_cluster};
+    return hierarchical_merge_nn_chain(distances, leaves_without_distances(items_to_cluster), merge_distance);
+}
+
+#endif /* end of include guard: NN_CHAIN_H_ */
@@ -0,0 +1,494 @@
+/*
+ * shardedlinkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef SHARDED_LINKAGE_H_
+#define SHARDED_LINKAGE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "distancematrixbuilder.h"
+#include "distancematrixfile.h"
+#include "linkage.h"
+#include "mstlinkage.h"
+
+/*! \brief Single linkage of problems larger than memory, split into shards that run in separate processes.
+ *
+ * The elements are split into contiguous groups. A shard is a pair of groups; its worker computes the
+ * minimum spanning tree of the elements of both groups, reading only the distances within and between
+ * the two groups. Every edge of the global minimum spanning tree is the lightest edge across some cut,
+ * and stays the lightest across that cut in any shard that holds both of its ends, so the union of the
+ * shard trees contains the global tree, which Kruskal's algorithm extracts from the union.
+ *
+ * Edges are ordered by distance, then by their lower and higher element index. With this strict order
+ * the spanning tree is unique and the result does not depend on the number of groups or processes.
+ *
+ * With g groups there are g(g-1)/2 shards of about 2n/g elements each. A worker holds O(n/g) numbers
+ * besides the distances it reads, and the merge holds about g*n edges.
+ * Workers exchange nothing but their forest files, which is also how shards may later be spread
+ * across machines: shard_spanning_tree and write_spanning_forest run anywhere the input is readable.
+ */
+
+/*! \brief A pair of element groups, whose spanning tree one worker computes. */
+struct Shard
+{
+    std::size_t first_group;  //< the lower group
+    std::size_t second_group; //< the higher group, equal to first_group only if there is a single group
+};
+
+/*! \brief Split n elements into contiguous groups of nearly equal size.
+ * \returns groups+1 bounds, group g holds the elements bounds[g] .. bounds[g+1]-1.
+ */
+inline std::vector<std::size_t> shard_bounds(std::size_t n, std::size_t groups)
+{
+    groups = std::max<std::size_t>(1, std::min(groups, std::max<std::size_t>(n, 1)));
+    std::vector<std::size_t> bounds(groups+1);
+    for (std::size_t g = 0; g <= groups; ++g)
+    {
+        bounds[g] = n*g/groups;
+    }
+    return bounds;
+}
+
+/*! \brief All pairs of groups; a single group is paired with itself. */
+inline std::vector<Shard> shards(std::size_t groups)
+{
+    if (groups < 2)
+    {
+        return std::vector<Shard> {{0, 0}};
+    }
+    std::vector<Shard> result {};
+    for (std::size_t a = 0; a < groups; ++a)
+    {
+        for (auto b = a+1; b < groups; ++b)
+        {
+            result.push_back({a, b});
+        }
+    }
+    return result;
+}
+
+/*! \brief Strict order of edges: by distance, then by lower and higher element index. */
+template <typename DistanceType>
+bool lighter_edge(DistanceType d_a, std::size_t from_a, std::size_t to_a, DistanceType d_b, std::size_t from_b, std::size_t to_b)
+{
+    if (d_a != d_b)
+    {
+        return d_a < d_b;
+    }
+    const auto low_a = std::min(from_a, to_a), low_b = std::min(from_b, to_b);
+    if (low_a != low_b)
+    {
+        return low_a < low_b;
+    }
+    return std::max(from_a, to_a) < std::max(from_b, to_b);
+}
+
+/*! \brief Minimum spanning tree of the elements of one shard with Prim's algorithm, on the calling thread only.
+ * \param[in] distance Distance of two elements as distance(i, j), e.g. a CondensedDistanceMatrix or EuclideanDistance.
+ * \param[in] bounds Group bounds from shard_bounds.
+ * \param[in] shard The two groups.
+ * \returns The edges of the tree, with global element indices.
+ */
+template <typename DistanceType, typename PairDistance>
+std::vector < SpanningTreeEdge < DistanceType>> shard_spanning_tree(const PairDistance &distance, const std::vector<std::size_t> &bounds, Shard shard)
+{
+    std::vector<std::size_t> elements {};
+    for (auto i = bounds[shard.first_group]; i < bounds[shard.first_group+1]; ++i)
+    {
+        elements.push_back(i);
+    }
+    if (shard.second_group != shard.first_group)
+    {
+        for (auto i = bounds[shard.second_group]; i < bounds[shard.second_group+1]; ++i)
+        {
+            elements.push_back(i);
+        }
+    }
+    const auto m = elements.size();
+
+    std::vector < SpanningTreeEdge < DistanceType>> edges {};
+    if (m < 2)
+    {
+        return edges;
+    }
+    edges.reserve(m-1);
+    std::vector<char>         in_tree(m, 0);
+    std::vector<DistanceType> distance_to_tree(m, std::numeric_limits<DistanceType>::infinity());
+    std::vector<std::size_t>  closest_in_tree(m, elements[0]);
+
+    std::size_t current = 0;
+    in_tree[current] = 1;
+    for (std::size_t step = 1; step < m; ++step)
+    {
+        auto next = m;
+        for (std::size_t j = 0; j < m; ++j)
+        {
+            if (in_tree[j])
+            {
+                continue;
+            }
+            const DistanceType d = distance(elements[current], elements[j]);
+            if (lighter_edge(d, elements[current], elements[j], distance_to_tree[j], closest_in_tree[j], elements[j]))
+            {
+                distance_to_tree[j] = d;
+                closest_in_tree[j]  = elements[current];
+            }
+            if (next == m || lighter_edge(distance_to_tree[j], closest_in_tree[j], elements[j], distance_to_tree[next], closest_in_tree[next], elements[next]))
+            {
+                next = j;
+            }
+        }
+        edges.push_back({closest_in_tree[next], elements[next], distance_to_tree[next]});
+        in_tree[next] = 1;
+        current       = next;
+    }
+    return edges;
+}
+
+/*! \brief Header of a spanning forest file, followed by count from indices, count to indices (both uint64)
+ * and count distances, in the byte order of the writing machine.
+ */
+struct SpanningForestFileHeader
+{
+    char          magic[8];  //< "CLUSTSF" and a terminating zero
+    std::uint32_t version;   //< format version, currently 1
+    std::uint32_t precision; //< a DistancePrecision
+    std::uint64_t count;     //< number of edges
+};
+
+/*! \brief Write the edges of a spanning forest to a file.
+ * \throws std::runtime_error if the file cannot be written completely.
+ */
+template <typename DistanceType>
+void write_spanning_forest(const std::string &filename, const std::vector < SpanningTreeEdge < DistanceType>> &edges)
+{
+    SpanningForestFileHeader header {};
+    std::strncpy(header.magic, "CLUSTSF", sizeof(header.magic));
+    header.version   = 1;
+    header.precision = static_cast<std::uint32_t>(distance_precision<DistanceType>::value);
+    header.count     = edges.size();
+
+    std::vector<std::uint64_t> from(edges.size()), to(edges.size());
+    std::vector<DistanceType>  distances(edges.size());
+    for (std::size_t k = 0; k < edges.size(); ++k)
+    {
+        from[k]      = edges[k].from;
+        to[k]        = edges[k].to;
+        distances[k] = edges[k].distance;
+    }
+
+    auto file = std::fopen(filename.c_str(), "wb");
+    if (file == nullptr)
+    {
+        throw std::runtime_error("Cannot open spanning forest file " + filename + " for writing.");
+    }
+    auto complete = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    /* an empty forest has no arrays, whose data() may be null */
+    if (!edges.empty())
+    {
+        complete = complete && std::fwrite(from.data(), sizeof(std::uint64_t), from.size(), file) == from.size();
+        complete = complete && std::fwrite(to.data(), sizeof(std::uint64_t), to.size(), file) == to.size();
+        complete = complete && std::fwrite(distances.data(), sizeof(DistanceType), distances.size(), file) == distances.size();
+    }
+    if (std::fclose(file) != 0 || !complete)
+    {
+        throw std::runtime_error("Cannot write spanning forest file " + filename);
+    }
+}
+
+/*! \brief Read the edges of a spanning forest written by write_spanning_forest.
+ * \throws std::runtime_error if the file cannot be read or holds another precision.
+ */
+template <typename DistanceType>
+std::vector < SpanningTreeEdge < DistanceType>> read_spanning_forest(const std::string &filename)
+{
+    auto file = std::fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        throw std::runtime_error("Cannot open spanning forest file " + filename);
+    }
+    SpanningForestFileHeader header {};
+    auto complete = std::fread(&header, sizeof(header), 1, file) == 1
+        && std::strncmp(header.magic, "CLUSTSF", sizeof(header.magic)) == 0 && header.version == 1
+        && header.precision == static_cast<std::uint32_t>(distance_precision<DistanceType>::value);
+
+    std::vector<std::uint64_t> from(complete ? header.count : 0), to(from.size());
+    std::vector<DistanceType>  distances(from.size());
+    if (!from.empty())
+    {
+        complete = complete && std::fread(from.data(), sizeof(std::uint64_t), from.size(), file) == from.size();
+        complete = complete && std::fread(to.data(), sizeof(std::uint64_t), to.size(), file) == to.size();
+        complete = complete && std::fread(distances.data(), sizeof(DistanceType), distances.size(), file) == distances.size();
+    }
+    std::fclose(file);
+    if (!complete)
+    {
+        throw std::runtime_error("File " + filename + " does not hold a spanning forest of the requested precision.");
+    }
+
+    std::vector < SpanningTreeEdge < DistanceType>> edges(from.size());
+    for (std::size_t k = 0; k < edges.size(); ++k)
+    {
+        edges[k] = {static_cast<std::size_t>(from[k]), static_cast<std::size_t>(to[k]), distances[k]};
+    }
+    return edges;
+}
+
+/*! \brief Minimum spanning forest of the union of spanning forests with Kruskal's algorithm.
+ * \param[in] edges The edges of all forests.
+ * \param[in] n The number of elements.
+ * \returns The kept edges in the strict edge order of lighter_edge.
+ */
+template <typename DistanceType>
+std::vector < SpanningTreeEdge < DistanceType>> merge_spanning_forests(std::vector < SpanningTreeEdge < DistanceType>> edges, std::size_t n)
+{
+    std::sort(std::begin(edges), std::end(edges), [](const SpanningTreeEdge<DistanceType> &a, const SpanningTreeEdge<DistanceType> &b){
+                  return lighter_edge(a.distance, a.from, a.to, b.distance, b.from, b.to);
+              });
+
+    std::vector<std::size_t> representative(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        representative[i] = i;
+    }
+    auto find = [&representative](std::size_t i){
+            while (representative[i] != i)
+            {
+                representative[i] = representative[representative[i]];
+                i                 = representative[i];
+            }
+            return i;
+        };
+
+    std::vector < SpanningTreeEdge < DistanceType>> tree {};
+    tree.reserve(n > 0 ? n-1 : 0);
+    for (const auto &edge : edges)
+    {
+        const auto a = find(edge.from);
+        const auto b = find(edge.to);
+        if (a != b)
+        {
+            representative[std::max(a, b)] = std::min(a, b);
+            tree.push_back(edge);
+        }
+    }
+    return tree;
+}
+
+/*! \brief Run tasks 0 .. count-1, each in a forked process, with at most processes of them at a time.
+ *
+ * The children inherit the memory of the caller copy-on-write, including mapped files, and run on a single thread;
+ * they must report their results through files. Standard output is flushed before forking.
+ * Only the processes forked here are waited for, so other children of the caller are left alone.
+ *
+ * \throws std::runtime_error if a process cannot be started or a task fails.
+ */
+inline void run_in_processes(std::size_t count, std::size_t processes, const std::function<void(std::size_t)> &task)
+{
+    processes = std::max<std::size_t>(processes, 1);
+    std::size_t        started = 0, failed = 0;
+    std::vector<pid_t> running {};
+    std::fflush(nullptr);
+    while (started < count || !running.empty())
+    {
+        if (started < count && running.size() < processes && failed == 0)
+        {
+            const auto child = fork();
+            if (child == 0)
+            {
+                try
+                {
+                    task(started);
+                }
+                catch (...)
+                {
+                    _exit(1);
+                }
+                _exit(0);
+            }
+            if (child < 0)
+            {
+                ++failed;
+                started = count;
+                continue;
+            }
+            ++started;
+            running.push_back(child);
+            continue;
+        }
+        if (running.empty())
+        {
+            break;
+        }
+        /* Reap any worker that has finished, or else wait for the oldest one */
+        int  status   = 0;
+        auto finished = std::end(running);
+        for (auto worker = std::begin(running); worker != std::end(running) && finished == std::end(running); ++worker)
+        {
+            const auto result = waitpid(*worker, &status, WNOHANG);
+            if (result < 0)
+            {
+                throw std::runtime_error("Lost track of the worker processes.");
+            }
+            if (result == *worker)
+            {
+                finished = worker;
+            }
+        }
+        if (finished == std::end(running))
+        {
+            finished = std::begin(running);
+            if (waitpid(*finished, &status, 0) != *finished)
+            {
+                throw std::runtime_error("Lost track of the worker processes.");
+            }
+        }
+        running.erase(finished);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            ++failed;
+        }
+    }
+    if (failed > 0)
+    {
+        throw std::runtime_error("A worker process failed.");
+    }
+}
+
+/*! \brief Removes the forest files of the shards and their directory when it goes out of scope, if they are temporary. */
+class ShardForestFiles
+{
+    public:
+        /*!\brief Keep the files of shards in folder, remove them and folder afterwards if temporary. */
+        ShardForestFiles(const std::string &folder, bool temporary, const std::vector<Shard> &shards) :
+            folder_ (folder), temporary_ {temporary}, shards_ (shards)
+        {};
+
+        ShardForestFiles(const ShardForestFiles &)            = delete;
+        ShardForestFiles &operator=(const ShardForestFiles &) = delete;
+
+        ~ShardForestFiles()
+        {
+            if (temporary_)
+            {
+                for (const auto &shard : shards_)
+                {
+                    std::remove(filename(shard).c_str());
+                }
+                rmdir(folder_.c_str());
+            }
+        };
+
+        /*!\brief The file of a shard. */
+        std::string filename(const Shard &shard) const
+        {
+            return folder_ + "/forest_" + std::to_string(shard.first_group) + "_" + std::to_string(shard.second_group) + ".bin";
+        };
+
+    private:
+        std::string        folder_;    //< where the files are
+        bool               temporary_; //< whether to remove the files and folder
+        std::vector<Shard> shards_;    //< shards whose files may exist
+};
+
+/*! \brief Single linkage clustering with the spanning trees of the shards computed in worker processes.
+ * \param[in] n The number of elements.
+ * \param[in] distance Distance of two elements as distance(i, j), evaluated in the workers.
+ * \param[in] groups Number of element groups; workers read distances of about 2n/groups elements each.
+ * \param[in] processes Number of worker processes that run at the same time.
+ * \param[in] directory Where the workers leave their forest files "forest_<a>_<b>.bin", which are kept;
+ *  if empty, a temporary directory is used and removed afterwards.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \throws std::runtime_error if a worker fails or its forest cannot be read.
+ */
+template <typename DistanceType, typename PairDistance>
+Linkage<DistanceType> sharded_single_linkage(std::size_t n, const PairDistance &distance, std::size_t groups, std::size_t processes,
+                                             const std::string &directory = std::string(), std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>())
+{
+    const auto bounds     = shard_bounds(n, groups);
+    const auto all_shards = shards(bounds.size()-1);
+    const auto temporary  = directory.empty();
+    auto       folder     = directory;
+    if (temporary)
+    {
+        const char * parent = std::getenv("TMPDIR");
+        std::string  name   = std::string(parent != nullptr ? parent : "/tmp") + "/clustershardXXXXXX";
+        if (mkdtemp(&name[0]) == nullptr)
+        {
+            throw std::runtime_error("Cannot create a directory for the shard forests.");
+        }
+        folder = name;
+    }
+    const ShardForestFiles files {folder, temporary, all_shards};
+
+    run_in_processes(all_shards.size(), processes, [&](std::size_t k){
+                         write_spanning_forest(files.filename(all_shards[k]), shard_spanning_tree<DistanceType>(distance, bounds, all_shards[k]));
+                     });
+    std::vector < SpanningTreeEdge < DistanceType>> edges {};
+    for (const auto &shard : all_shards)
+    {
+        const auto forest = read_spanning_forest<DistanceType>(files.filename(shard));
+        edges.insert(std::end(edges), std::begin(forest), std::end(forest));
+    }
+    return spanning_tree_linkage(merge_spanning_forests(std::move(edges), n), n, std::move(leaf_sizes));
+}
+
+/*! \brief Single linkage clustering of a distance matrix file, sharded across worker processes.
+ *
+ * The file is mapped once and shared with the workers, each of which pages in only the rows and columns of its shard.
+ * \param[in] filename File written by DistanceMatrixWriter.
+ * \param[in] groups Number of element groups, see sharded_single_linkage.
+ * \param[in] processes Number of worker processes that run at the same time.
+ * \param[in] directory Where to keep the forest files, a temporary directory if empty.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> sharded_single_linkage(const std::string &filename, std::size_t groups, std::size_t processes,
+                                             const std::string &directory = std::string(), std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>())
+{
+    const auto distances = map_distance_matrix<DistanceType>(filename, nullptr, false);
+    return sharded_single_linkage<DistanceType>(distances.size(), distances, groups, processes, directory, std::move(leaf_sizes));
+}
+
+/*! \brief Single linkage clustering of points, sharded across worker processes that compute distances on the fly.
+ * \param[in] points The points, in memory or mapped by map_coordinates.
+ * \param[in] metric How to measure distance; rmsd takes every point as a structure of d/3 atoms.
+ * \param[in] groups Number of element groups, see sharded_single_linkage.
+ * \param[in] processes Number of worker processes that run at the same time.
+ * \param[in] directory Where to keep the forest files, a temporary directory if empty.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ */
+template <typename CoordinateType>
+Linkage<CoordinateType> sharded_single_linkage(const Coordinates<CoordinateType> &points, Metric metric, std::size_t groups, std::size_t processes,
+                                               const std::string &directory = std::string(), std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>())
+{
+    const auto n = points.size();
+    switch (metric)
+    {
+        case Metric::squared_euclidean:
+            return sharded_single_linkage<CoordinateType>(n, SquaredEuclideanDistance<CoordinateType>(points), groups, processes, directory, std::move(leaf_sizes));
+        case Metric::cosine:
+            return sharded_single_linkage<CoordinateType>(n, CosineDistance<CoordinateType>(points), groups, processes, directory, std::move(leaf_sizes));
+        case Metric::rmsd:
+            return sharded_single_linkage<CoordinateType>(n, RmsdDistance<CoordinateType>(points), groups, processes, directory, std::move(leaf_sizes));
+        case Metric::euclidean:
+        default:
+            return sharded_single_linkage<CoordinateType>(n, EuclideanDistance<CoordinateType>(points), groups, processes, directory, std::move(leaf_sizes));
+    }
+}
+
+#endif /* end of include guard: SHARDED_LINKAGE_H_ */
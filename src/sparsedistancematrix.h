@@ -0,0 +1,246 @@
+/*
+ * sparsedistancematrix.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef SPARSE_DISTANCE_MATRIX_H_
+#define SPARSE_DISTANCE_MATRIX_H_
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "distancematrixbuilder.h"
+#include "threadpool.h"
+
+/*! \brief A stored distance between the elements first and second. */
+template <typename DistanceType>
+struct SparseDistance
+{
+    std::size_t  first;    //< one element
+    std::size_t  second;   //< the other element
+    DistanceType distance; //< distance between the two
+};
+
+/*! \brief Symmetric distance matrix that stores only some of the distances, in compressed sparse rows.
+ *
+ * Distances that are not stored are infinite: clusters that are not joined by stored distances are never merged,
+ * so an incomplete linkage comes out when the stored distances do not connect all elements.
+ * Memory is O(n + stored distances), each distance is kept in the rows of both of its elements.
+ */
+template <typename DistanceType>
+class SparseDistanceMatrix
+{
+    public:
+        /*!\brief An entry of a row: the distance to column. */
+        struct Entry
+        {
+            std::size_t  column;   //< the other element
+            DistanceType distance; //< distance to it
+        };
+
+        typedef const Entry * const_iterator;
+
+        /*!\brief A row of the matrix, the entries ordered by column. */
+        class Row
+        {
+            public:
+                Row(const Entry * first, const Entry * last) : first_ {first}, last_ {last}
+                {};
+
+                const_iterator begin() const { return first_; };
+                const_iterator end() const { return last_; };
+                std::size_t size() const { return last_ - first_; };
+
+            private:
+                const Entry * first_; //< first entry
+                const Entry * last_;  //< one past the last entry
+        };
+
+        /*!\brief Build the rows from a list of distances in O(n + edges log edges).
+         *
+         * Each pair may be given in either order; a pair given more than once keeps its smallest distance.
+         * Distances of an element to itself, infinite and NaN distances are left out.
+         *
+         * \param[in] n The number of elements.
+         * \param[in] distances The distances to be stored.
+         */
+        SparseDistanceMatrix(std::size_t n, const std::vector < SparseDistance < DistanceType>> &distances) :
+            n_ {n}, offsets_(n+1, 0)
+        {
+            auto stored = [](const SparseDistance<DistanceType> &d){
+                    return d.first != d.second && d.distance < std::numeric_limits<DistanceType>::infinity();
+                };
+            for (const auto &d : distances)
+            {
+                if (stored(d))
+                {
+                    ++offsets_[d.first+1];
+                    ++offsets_[d.second+1];
+                }
+            }
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                offsets_[i+1] += offsets_[i];
+            }
+            entries_.resize(offsets_[n]);
+            std::vector<std::size_t> next(std::begin(offsets_), std::end(offsets_)-1);
+            for (const auto &d : distances)
+            {
+                if (stored(d))
+                {
+                    entries_[next[d.first]++]  = {d.second, d.distance};
+                    entries_[next[d.second]++] = {d.first, d.distance};
+                }
+            }
+
+            /* order each row by column and keep the closest of duplicates, compacting the rows in place */
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                const auto first = entries_.begin() + offsets_[i];
+                const auto last  = entries_.begin() + offsets_[i+1];
+                std::sort(first, last, [](const Entry &a, const Entry &b){
+                              return a.column < b.column || (a.column == b.column && a.distance < b.distance);
+                          });
+                offsets_[i] = kept;
+                for (auto entry = first; entry != last; ++entry)
+                {
+                    if (entry == first || entry->column != (entry-1)->column)
+                    {
+                        entries_[kept++] = *entry;
+                    }
+                }
+            }
+            offsets_[n] = kept;
+            entries_.resize(kept);
+            entries_.shrink_to_fit();
+        };
+
+        /*!\brief The number of elements. */
+        std::size_t size() const { return n_; };
+
+        /*!\brief The number of stored distances, each pair counted once. */
+        std::size_t stored() const { return entries_.size()/2; };
+
+        /*!\brief The stored distances of element i. */
+        Row row(std::size_t i) const
+        {
+            return {entries_.data() + offsets_[i], entries_.data() + offsets_[i+1]};
+        };
+
+        /*!\brief The distance between i and j, infinity if it is not stored. */
+        DistanceType distance(std::size_t i, std::size_t j) const
+        {
+            const auto first = entries_.begin() + offsets_[i];
+            const auto last  = entries_.begin() + offsets_[i+1];
+            const auto entry = std::lower_bound(first, last, j, [](const Entry &e, std::size_t column){ return e.column < column; });
+            return entry != last && entry->column == j ? entry->distance : std::numeric_limits<DistanceType>::infinity();
+        };
+
+        /*!\brief Each stored distance once, with first < second, ordered by first and second. */
+        std::vector < SparseDistance < DistanceType>> distances() const
+        {
+            std::vector < SparseDistance < DistanceType>> result {};
+            result.reserve(stored());
+            for (std::size_t i = 0; i < n_; ++i)
+            {
+                for (const auto &entry : row(i))
+                {
+                    if (entry.column > i)
+                    {
+                        result.push_back({i, entry.column, entry.distance});
+                    }
+                }
+            }
+            return result;
+        };
+
+    private:
+        std::size_t              n_;       //< number of elements
+        std::vector<std::size_t> offsets_; //< start of each row in entries_, and the end of the last
+        std::vector<Entry>       entries_; //< all rows after each other
+};
+
+/*! \brief The distances of n points under any metric that are at most radius, without storing the others.
+ *
+ * Computes all pairs in the tiles of distance_matrix, but keeps memory at O(n + distances within radius).
+ *
+ * \param[in] n The number of points.
+ * \param[in] metric Returns the distance of points i and j, called from several threads at once.
+ * \param[in] radius Largest distance to be stored.
+ * \param[in] tile Points per side of a tile.
+ * \param[in] pool Threads that compute the distances.
+ */
+template <typename DistanceType, typename PairDistance>
+SparseDistanceMatrix<DistanceType> radius_distance_matrix(std::size_t n, const PairDistance &metric, DistanceType radius, std::size_t tile, ThreadPool &pool)
+{
+    std::vector < std::vector < SparseDistance < DistanceType>> > found(pool.size());
+    const auto tiles_per_side = (n + tile-1)/tile;
+    pool.run([&](std::size_t thread){
+                 std::size_t number = 0;
+                 for (std::size_t row_tile = 0; row_tile < tiles_per_side; ++row_tile)
+                 {
+                     for (auto column_tile = row_tile; column_tile < tiles_per_side; ++column_tile, ++number)
+                     {
+                         if (number % pool.size() != thread)
+                         {
+                             continue;
+                         }
+                         const auto row_end    = std::min(n, (row_tile+1)*tile);
+                         const auto column_end = std::min(n, (column_tile+1)*tile);
+                         for (auto i = row_tile*tile; i < row_end; ++i)
+                         {
+                             for (auto j = std::max(i+1, column_tile*tile); j < column_end; ++j)
+                             {
+                                 const DistanceType d = metric(i, j);
+                                 if (d <= radius)
+                                 {
+                                     found[thread].push_back({i, j, d});
+                                 }
+                             }
+                         }
+                     }
+                 }
+             });
+
+    std::vector < SparseDistance < DistanceType>> distances {};
+    std::size_t total = 0;
+    for (const auto &part : found)
+    {
+        total += part.size();
+    }
+    distances.reserve(total);
+    for (auto &part : found)
+    {
+        distances.insert(std::end(distances), std::begin(part), std::end(part));
+        std::vector < SparseDistance < DistanceType>>().swap(part);
+    }
+    return SparseDistanceMatrix<DistanceType>(n, distances);
+}
+
+/*! \brief The distances of points under a built-in metric that are at most radius.
+ * \param[in] points The points, in memory or mapped by map_coordinates.
+ * \param[in] metric How to measure distance; rmsd takes every point as a structure of d/3 atoms.
+ * \param[in] radius Largest distance to be stored.
+ * \param[in] pool Threads that compute the distances.
+ */
+template <typename CoordinateType>
+SparseDistanceMatrix<CoordinateType> radius_distance_matrix(const Coordinates<CoordinateType> &points, Metric metric, CoordinateType radius, ThreadPool &pool)
+{
+    const auto n    = points.size();
+    const auto tile = tile_size<CoordinateType>(points.dimension());
+    switch (metric)
+    {
+        case Metric::squared_euclidean:
+            return radius_distance_matrix<CoordinateType>(n, SquaredEuclideanDistance<CoordinateType>(points), radius, tile, pool);
+        case Metric::cosine:
+            return radius_distance_matrix<CoordinateType>(n, CosineDistance<CoordinateType>(points), radius, tile, pool);
+        case Metric::rmsd:
+            return radius_distance_matrix<CoordinateType>(n, RmsdDistance<CoordinateType>(points), radius, tile_size<double>(points.dimension()), pool);
+        case Metric::euclidean:
+        default:
+            return radius_distance_matrix<CoordinateType>(n, EuclideanDistance<CoordinateType>(points), radius, tile, pool);
+    }
+}
+
+#endif /* end of include guard: SPARSE_DISTANCE_MATRIX_H_ */
@@ -0,0 +1,242 @@
+/*
+ * sparselinkage.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef SPARSE_LINKAGE_H_
+#define SPARSE_LINKAGE_H_
+
+#include <algorithm>
+#include <queue>
+#include <type_traits>
+#include <vector>
+
+#include "linkage.h"
+#include "linkagepolicies.h"
+#include "mstlinkage.h"
+#include "sparsedistancematrix.h"
+
+/*! \brief Single linkage clustering of sparse distances with Kruskal's algorithm.
+ *
+ * Sorts the stored distances once and joins components with a union-find, in O(edges log edges)
+ * time and O(n + edges) memory. Equal distances are taken in the order of their elements.
+ * Elements that are not connected by stored distances stay apart: the linkage then has fewer than n-1
+ * merges, one tree per connected component, as LinkageCut expects of an incomplete linkage.
+ *
+ * \param[in] distances The stored distances, all others are infinite.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Where to stop merging; distances that are too far are dropped before sorting.
+ */
+template <typename DistanceType>
+Linkage<DistanceType> sparse_single_linkage(const SparseDistanceMatrix<DistanceType> &distances, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                            const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    const auto n     = distances.size();
+    auto       edges = distances.distances();
+    edges.erase(std::remove_if(std::begin(edges), std::end(edges), [&stop](const SparseDistance<DistanceType> &edge){ return stop.too_far(edge.distance); }), std::end(edges));
+    std::stable_sort(std::begin(edges), std::end(edges), [](const SparseDistance<DistanceType> &a, const SparseDistance<DistanceType> &b){ return a.distance < b.distance; });
+
+    std::vector<std::size_t> representative(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        representative[i] = i;
+    }
+    auto find = [&representative](std::size_t i){
+            while (representative[i] != i)
+            {
+                representative[i] = representative[representative[i]];
+                i                 = representative[i];
+            }
+            return i;
+        };
+
+    std::vector < SpanningTreeEdge < DistanceType>> forest {};
+    forest.reserve(n > 0 ? n-1 : 0);
+    for (const auto &edge : edges)
+    {
+        const auto a = find(edge.first);
+        const auto b = find(edge.second);
+        if (a != b)
+        {
+            representative[std::max(a, b)] = std::min(a, b);
+            forest.push_back({edge.first, edge.second, edge.distance});
+        }
+    }
+    std::vector < SparseDistance < DistanceType>>().swap(edges);
+    return spanning_tree_linkage(std::move(forest), n, std::move(leaf_sizes), stop);
+}
+
+namespace detail
+{
+
+/*! \brief Greedy merging of the closest pair of clusters over sparse distances, for any Lance-Williams linkage but single.
+ *
+ * Missing distances are infinite, and for all these linkages a merged cluster is infinitely far from a third cluster
+ * as soon as one of its parts is. So the merged cluster keeps only the neighbours that both parts have in common,
+ * and neighbour lists only shrink as clusters merge.
+ *
+ * Clusters carry their SciPy ids; a merged cluster gets a higher id than all before, so appending it keeps
+ * every neighbour list ordered by id and two lists are intersected in a single pass. Neighbours that have been
+ * merged into other clusters are not removed from the lists, but skipped, as are stale pairs in the queue.
+ *
+ * Merging stops at the first pair that is too far. For complete linkage, merged distances are never shorter than
+ * those of the parts, so pairs that are too far are not even queued; the averages may come closer and must keep them.
+ */
+template <typename Policy, typename DistanceType>
+Linkage<DistanceType> sparse_linkage(const SparseDistanceMatrix<DistanceType> &distances, std::vector<std::size_t> leaf_sizes, const MergeStop<DistanceType> &stop, std::false_type /*single*/)
+{
+    struct Neighbour
+    {
+        std::size_t  id;       //< the neighbouring cluster
+        DistanceType distance; //< distance to it
+    };
+    struct Candidate
+    {
+        DistanceType distance; //< distance of the pair
+        std::size_t  low;      //< the cluster with the lower id
+        std::size_t  high;     //< the cluster with the higher id
+    };
+    /* the closest pair first, equal distances by their ids */
+    auto later = [](const Candidate &a, const Candidate &b){
+            return b.distance < a.distance || (!(a.distance < b.distance) && (a.low > b.low || (a.low == b.low && a.high > b.high)));
+        };
+
+    const auto            n        = distances.size();
+    const auto            clusters = n > 0 ? 2*n-1 : 0;
+    Linkage<DistanceType> linkage {n};
+    if (leaf_sizes.empty())
+    {
+        leaf_sizes.assign(n, 1);
+    }
+    const bool prune = Policy::method == LinkageMethod::complete_linkage;
+    auto       queued = [&stop, prune](DistanceType distance){ return !prune || !stop.too_far(distance); };
+
+    std::vector<std::size_t> sizes {std::move(leaf_sizes)};
+    sizes.resize(clusters);
+    std::vector<char> alive(clusters, 0);
+    std::fill(std::begin(alive), std::begin(alive) + n, 1);
+
+    std::vector < std::vector < Neighbour>> neighbours(clusters);
+    std::vector<Candidate>                  pairs {};
+    pairs.reserve(distances.stored());
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const auto row = distances.row(i);
+        neighbours[i].reserve(row.size());
+        for (const auto &entry : row)
+        {
+            if (!queued(entry.distance))
+            {
+                continue;
+            }
+            neighbours[i].push_back({entry.column, entry.distance});
+            if (entry.column > i)
+            {
+                pairs.push_back({entry.distance, i, entry.column});
+            }
+        }
+    }
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(later)> queue {later, std::move(pairs)};
+
+    Policy merge_distance {};
+    while (!queue.empty())
+    {
+        const auto pair = queue.top();
+        queue.pop();
+        if (!alive[pair.low] || !alive[pair.high])
+        {
+            continue;
+        }
+        if (stop.reached(pair.distance, n - linkage.size()))
+        {
+            break;
+        }
+        const auto id = n + linkage.size();
+        linkage.push_back({pair.low, pair.high, pair.distance, sizes[pair.low] + sizes[pair.high]});
+        sizes[id]        = sizes[pair.low] + sizes[pair.high];
+        alive[pair.low]  = 0;
+        alive[pair.high] = 0;
+        alive[id]        = 1;
+
+        const auto &left   = neighbours[pair.low];
+        const auto &right  = neighbours[pair.high];
+        auto       &merged = neighbours[id];
+        auto        l      = std::begin(left);
+        auto        r      = std::begin(right);
+        while (l != std::end(left) && r != std::end(right))
+        {
+            if (!alive[l->id] || l->id < r->id)
+            {
+                ++l;
+            }
+            else if (!alive[r->id] || r->id < l->id)
+            {
+                ++r;
+            }
+            else
+            {
+                const auto d = DistanceType(merge_distance(pair.distance, sizes[l->id], sizes[pair.low], sizes[pair.high], l->distance, r->distance));
+                if (queued(d))
+                {
+                    merged.push_back({l->id, d});
+                }
+                ++l;
+                ++r;
+            }
+        }
+        std::vector<Neighbour>().swap(neighbours[pair.low]);
+        std::vector<Neighbour>().swap(neighbours[pair.high]);
+
+        for (const auto &neighbour : merged)
+        {
+            neighbours[neighbour.id].push_back({id, neighbour.distance});
+            queue.push({neighbour.distance, neighbour.id, id});
+        }
+    }
+    return linkage;
+}
+
+template <typename Policy, typename DistanceType>
+Linkage<DistanceType> sparse_linkage(const SparseDistanceMatrix<DistanceType> &distances, std::vector<std::size_t> leaf_sizes, const MergeStop<DistanceType> &stop, std::true_type /*single*/)
+{
+    return sparse_single_linkage(distances, std::move(leaf_sizes), stop);
+}
+
+} // namespace detail
+
+/*! \brief Hierarchical clustering of sparse distances, where missing distances are infinite.
+ *
+ * Time and memory grow with the number of stored distances instead of n^2.
+ * Single linkage runs Kruskal's algorithm, see sparse_single_linkage. All other policies merge the closest pair
+ * of clusters from a priority queue; two clusters are only merged if all distances between their elements
+ * are stored, since the linkage of any other pair is infinite. The merges of centroid and median come out
+ * unsorted, as with generic_linkage.
+ *
+ * Elements that cannot be merged stay apart, and the linkage has fewer than n-1 merges.
+ *
+ * \tparam Policy A linkage policy from linkagepolicies.h.
+ * \param[in] distances The stored distances, all others are infinite.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Where to stop merging, which leaves more trees.
+ */
+template <typename Policy, typename DistanceType>
+Linkage<DistanceType> sparse_linkage(const SparseDistanceMatrix<DistanceType> &distances, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                     const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    return detail::sparse_linkage<Policy>(distances, std::move(leaf_sizes), stop, std::integral_constant<bool, Policy::method == LinkageMethod::single_linkage>());
+}
+
+/*! \brief Hierarchical clustering of n elements from a list of their distances, where missing distances are infinite.
+ * \tparam Policy A linkage policy from linkagepolicies.h.
+ * \param[in] n The number of elements.
+ * \param[in] distances The known distances, see SparseDistanceMatrix for duplicates.
+ * \param[in] leaf_sizes Number of elements in each leaf, one each if empty.
+ * \param[in] stop Where to stop merging, which leaves more trees.
+ */
+template <typename Policy, typename DistanceType>
+Linkage<DistanceType> sparse_linkage(std::size_t n, const std::vector < SparseDistance < DistanceType>> &distances, std::vector<std::size_t> leaf_sizes = std::vector<std::size_t>(),
+                                     const MergeStop<DistanceType> &stop = MergeStop<DistanceType>())
+{
+    return sparse_linkage<Policy>(SparseDistanceMatrix<DistanceType>(n, distances), std::move(leaf_sizes), stop);
+}
+
+#endif /* end of include guard: SPARSE_LINKAGE_H_ */
@@ -29,8 +29,6 @@ int main ()
     // perform a hierarchical clustering
     auto result = hierarchical_merge_into_tree(clusters, LanceWilliamsUpdate<DistanceCluster::DistanceType>::simple_average);
 
-    std::string out; //< keeps the output
-
     // Proof of principle: Cut away from all clusters whose list of ids starts with a "1". Note that cluster ids aren't sorted
     auto cut_predicate = [](DistanceCluster & a){return a.elements()[0]==1;};
     auto cut_branches = result->cut(cut_predicate);
@@ -38,7 +36,7 @@ int main ()
     // Print the left-over clusters
     for (auto &branch : *result)
     {
-        out += (*branch).print();
+        fputs((*branch).print().c_str(), stderr);
     }
 
     // Extract the bottom of the left-over binary tree
@@ -46,9 +44,9 @@ int main ()
 
     // print the bottom of the left-over binary tree
     for (const auto &branch : clusterbottom){
-        out += (**branch).print();
+        fputs((**branch).print().c_str(), stderr);
     }
-    fprintf(stderr, "%s\n", out.c_str());
+    fputs("\n", stderr);
 
     return 0;
 }
@@ -0,0 +1,163 @@
+/*
+ * threadpool.h
+ *      Author: cblau@gwdg.de
+ */
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*! \brief A fixed set of threads that run the same task together, fork-join style.
+ *
+ * The threads are started once and sleep between tasks, so that a task may be
+ * as short as a single row scan. The calling thread takes part as thread 0.
+ */
+class ThreadPool
+{
+    public:
+        /*!\brief Start the worker threads.
+         * \param[in] n_threads Total number of threads including the caller, all cores by default.
+         */
+        explicit ThreadPool(std::size_t n_threads = default_size())
+        {
+            for (std::size_t thread = 1; thread < std::max<std::size_t>(n_threads, 1); ++thread)
+            {
+                workers_.emplace_back([this, thread](){ work(thread); });
+            }
+        };
+
+        ThreadPool(const ThreadPool &)            = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock {mutex_};
+                stop_ = true;
+                ++generation_;
+            }
+            start_.notify_all();
+            for (auto &worker : workers_)
+            {
+                worker.join();
+            }
+        };
+
+        /*!\brief The number of threads, including the calling thread. */
+        std::size_t size() const { return workers_.size()+1; };
+
+        /*!\brief Run task(thread) on every thread and return when all are done.
+         * \param[in] task Called once with each thread index 0..size()-1.
+         * \throws The first exception thrown by the task on any thread, after all threads have finished.
+         */
+        void run(const std::function<void(std::size_t)> &task)
+        {
+            if (workers_.empty())
+            {
+                task(0);
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock {mutex_};
+                task_    = &task;
+                pending_ = workers_.size();
+                ++generation_;
+            }
+            start_.notify_all();
+            try
+            {
+                task(0);
+            }
+            catch (...)
+            {
+                keep_error();
+            }
+            std::exception_ptr error {};
+            {
+                std::unique_lock<std::mutex> lock {mutex_};
+                done_.wait(lock, [this](){ return pending_ == 0; });
+                std::swap(error, error_);
+            }
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        };
+
+        /*!\brief The part [first, second) of the range [begin, end) that a thread works on.
+         * Chunks are contiguous, in thread order and differ in length by at most one.
+         */
+        std::pair<std::size_t, std::size_t> chunk(std::size_t begin, std::size_t end, std::size_t thread) const
+        {
+            const auto length = end - begin;
+            return {begin + length*thread/size(), begin + length*(thread+1)/size()};
+        };
+
+        /*!\brief Number of hardware threads, at least one. */
+        static std::size_t default_size()
+        {
+            return std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+        };
+
+    private:
+        /* Keep the exception being handled, unless another thread was first */
+        void keep_error()
+        {
+            std::lock_guard<std::mutex> lock {mutex_};
+            if (!error_)
+            {
+                error_ = std::current_exception();
+            }
+        };
+
+        void work(std::size_t thread)
+        {
+            std::size_t generation = 0;
+            while (true)
+            {
+                const std::function<void(std::size_t)> * task;
+                {
+                    std::unique_lock<std::mutex> lock {mutex_};
+                    start_.wait(lock, [this, generation](){ return generation_ != generation; });
+                    generation = generation_;
+                    if (stop_)
+                    {
+                        return;
+                    }
+                    task = task_;
+                }
+                try
+                {
+                    (*task)(thread);
+                }
+                catch (...)
+                {
+                    keep_error();
+                }
+                std::lock_guard<std::mutex> lock {mutex_};
+                if (--pending_ == 0)
+                {
+                    done_.notify_one();
+                }
+            }
+        };
+
+        std::vector<std::thread>                 workers_;              //< threads 1..size()-1
+        std::mutex                               mutex_;                //< guards all following members
+        std::condition_variable                  start_;                //< signals a new task or stop
+        std::condition_variable                  done_;                 //< signals that all workers finished
+        const std::function<void(std::size_t)> * task_       = nullptr; //< the current task
+        std::size_t                              pending_    = 0;       //< workers still running the task
+        std::exception_ptr                       error_;                //< first exception thrown by the current task
+        std::size_t                              generation_ = 0;       //< counts tasks, so workers run each once
+        bool                                     stop_       = false;   //< workers shall return
+};
+
+#endif /* end of include guard: THREAD_POOL_H_ */